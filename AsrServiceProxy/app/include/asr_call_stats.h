@@ -0,0 +1,29 @@
+#ifndef _ASR_CALL_STATS_H_
+#define _ASR_CALL_STATS_H_
+
+#include <stdint.h>
+
+// Stage breakdown of one asr request, all durations in microseconds.
+// Stages that were not reached stay negative and are not recorded.
+struct AsrCallStats {
+    int64_t queue_us = -1;          // brpc: request received -> handler entered
+    int64_t token_wait_us = -1;     // waiting for the access token lock
+    int64_t dns_us = -1;            // CURLINFO_NAMELOOKUP_TIME
+    int64_t connect_us = -1;        // CURLINFO_CONNECT_TIME - NAMELOOKUP_TIME
+    int64_t tls_us = -1;            // CURLINFO_APPCONNECT_TIME - CONNECT_TIME, 0 for http
+    int64_t upload_us = -1;         // PRETRANSFER_TIME -> last request byte sent
+    int64_t think_us = -1;          // last request byte sent -> STARTTRANSFER_TIME
+    int64_t download_us = -1;       // STARTTRANSFER_TIME -> TOTAL_TIME
+    int64_t parse_us = -1;          // parsing the backend json
+    int64_t backend_us = -1;        // whole backend call
+    int64_t total_us = -1;          // queue + handler
+};
+
+class AsrCallRecorder {
+public:
+    // feed every reached stage into its bvar::LatencyRecorder,
+    // exposed at /vars as asr_proxy_stage_<stage>_*
+    static void record(const AsrCallStats& stats);
+};
+
+#endif  /*_ASR_CALL_STATS_H_*/
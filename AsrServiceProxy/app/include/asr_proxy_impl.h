@@ -4,10 +4,14 @@
 #include <brpc/server.h>
 #include "asr_service.h"
 #include "asr_service_proxy.pb.h"
+#include "slow_request_recorder.h"
+#include "traffic_recorder.h"
 
 class AsrProxyImpl : public onething::AsrProxyService {
 public:
-    AsrProxyImpl(std::shared_ptr<AsrService>& asr_service);
+    AsrProxyImpl(std::shared_ptr<AsrService>& asr_service,
+                 std::shared_ptr<SlowRequestRecorder>& slow_request_recorder,
+                 std::shared_ptr<TrafficRecorder>& traffic_recorder);
     ~AsrProxyImpl();
 
     void asr(google::protobuf::RpcController* controller,
@@ -17,6 +21,8 @@ public:
 
 private:
     std::shared_ptr<AsrService>& _asr_service;
+    std::shared_ptr<SlowRequestRecorder>& _slow_request_recorder;
+    std::shared_ptr<TrafficRecorder>& _traffic_recorder;
 };
 
 #endif  /*_ASR_PROXY_IMPL_H_*/
@@ -14,11 +14,14 @@ typedef enum {
 } ReturnCode;
 
 class Config;
+struct AsrCallStats;
 
 class AsrService {
 public:
     virtual ~AsrService();
-    virtual int call(const char* audio_data, int audio_data_size, std::string& asr_result) = 0;
+    // stats may be NULL, otherwise the backend fills in its stage timings
+    virtual int call(const char* audio_data, int audio_data_size, std::string& asr_result,
+                     AsrCallStats* stats) = 0;
     virtual bool init(const Config& conf) = 0;
 };
 
@@ -10,7 +10,8 @@ class BdAsrService : public AsrService {
 public:
     virtual ~BdAsrService();
 
-    virtual int call(const char* audio_data, int audio_data_size, std::string& asr_result);
+    virtual int call(const char* audio_data, int audio_data_size, std::string& asr_result,
+                     AsrCallStats* stats);
     virtual bool init(const Config& conf);
 
 private:
@@ -19,7 +19,32 @@ public:
     const std::string& get_capacity_scope();
     int get_concurrent_number();
     int get_logoff_ms();
+    int get_log_block_timeout_us();
+    const std::string& get_log_overflow_policy();
+    const std::string& get_log_sink();
+    const std::string& get_log_file();
+    int get_log_flush_bytes();
+    int get_log_flush_ms();
+    const std::string& get_log_binary_file();
+    const std::string& get_log_rate_limits();
+    int get_log_rate_window_ms();
+    int get_log_fold_duplicates();
+    int get_log_segment_mb();
+    int get_log_daily_rolling();
+    int get_log_compress_level();
+    int get_log_compress_rate_kb();
+    int get_log_keep_mb();
+    const std::string& get_log_crash_file();
+    const std::string& get_log_format();
     int get_server_port();
+    const std::string& get_slow_request_dir();
+    int get_slow_request_max_mb();
+    float get_slow_request_sample_rate();
+    int get_slow_request_threshold_ms();
+    const std::string& get_token_server();
+    const std::string& get_traffic_record_dir();
+    int get_traffic_record_max_segments();
+    int get_traffic_record_segment_mb();
     const char *get_command_line_help();
     bool is_enable_asr_service();
     int load_from_file(const char *file);
@@ -45,7 +70,32 @@ private:
     void set_concurrent_number(const char* optarg);
     void set_enable_asr_service(bool enable_asr_service);
     void set_logoff_ms(const char* optarg);
+    void set_log_block_timeout_us(const char* optarg);
+    void set_log_overflow_policy(const char* optarg);
+    void set_log_sink(const char* optarg);
+    void set_log_file(const char* optarg);
+    void set_log_flush_bytes(const char* optarg);
+    void set_log_flush_ms(const char* optarg);
+    void set_log_binary_file(const char* optarg);
+    void set_log_rate_limits(const char* optarg);
+    void set_log_rate_window_ms(const char* optarg);
+    void set_log_fold_duplicates(const char* optarg);
+    void set_log_segment_mb(const char* optarg);
+    void set_log_daily_rolling(const char* optarg);
+    void set_log_compress_level(const char* optarg);
+    void set_log_compress_rate_kb(const char* optarg);
+    void set_log_keep_mb(const char* optarg);
+    void set_log_crash_file(const char* optarg);
+    void set_log_format(const char* optarg);
     void set_server_port(const char* optarg);
+    void set_slow_request_dir(const char* optarg);
+    void set_slow_request_max_mb(const char* optarg);
+    void set_slow_request_sample_rate(const char* optarg);
+    void set_slow_request_threshold_ms(const char* optarg);
+    void set_token_server(const char* optarg);
+    void set_traffic_record_dir(const char* optarg);
+    void set_traffic_record_max_segments(const char* optarg);
+    void set_traffic_record_segment_mb(const char* optarg);
     int read_file_content(const char *file, std::string &result);
     void init_default();
 
@@ -59,7 +109,32 @@ private:
     int _concurrent_number = 2;
     bool _enable_asr_service = true;
     int _log_off_ms = 2000;
+    int _log_block_timeout_us = 10000;
+    std::string _log_overflow_policy;
+    std::string _log_sink;
+    std::string _log_file;
+    int _log_flush_bytes = 262144;
+    int _log_flush_ms = 200;
+    std::string _log_binary_file;
+    std::string _log_rate_limits;
+    int _log_rate_window_ms = 1000;
+    int _log_fold_duplicates = 1;
+    int _log_segment_mb = 64;
+    int _log_daily_rolling = 1;
+    int _log_compress_level = 6;
+    int _log_compress_rate_kb = 8192;
+    int _log_keep_mb = 4096;
+    std::string _log_crash_file;
+    std::string _log_format;
     int _server_port = 8005;
+    std::string _slow_request_dir;
+    int _slow_request_max_mb = 256;
+    float _slow_request_sample_rate = 0;
+    int _slow_request_threshold_ms = 5000;
+    std::string _token_server;
+    std::string _traffic_record_dir;
+    int _traffic_record_max_segments = 32;
+    int _traffic_record_segment_mb = 64;
     std::string _working_dir;
 };
 
@@ -0,0 +1,29 @@
+#ifndef _LOG_CONTEXT_H_
+#define _LOG_CONTEXT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fields of the request a bthread is serving, which the log library attaches
+// to every text log of that bthread as "key=value" pairs (see
+// log_set_context_callback). They live in bthread-local storage, so they
+// follow the request when the bthread moves between worker pthreads, and are
+// formatted once per request, a log call only copies them.
+class LogContext {
+public:
+    // creates the bthread key and hands the callback to the log library, once at startup
+    static void init();
+};
+
+// Sets the fields for the current bthread until the scope ends.
+class LogContextScope {
+public:
+    LogContextScope(uint64_t request_id, const char* client, size_t audio_bytes);
+    ~LogContextScope();
+
+private:
+    LogContextScope(const LogContextScope&);
+    LogContextScope& operator=(const LogContextScope&);
+};
+
+#endif  /*_LOG_CONTEXT_H_*/
@@ -5,6 +5,8 @@
 #include "config.h"
 #include "asr_proxy_impl.h"
 #include "asr_service.h"
+#include "slow_request_recorder.h"
+#include "traffic_recorder.h"
 #include "brpc/server.h"
 
 class Pipeline {
@@ -17,6 +19,14 @@ public:
 
 private:
     int get_asr_service();
+    void init_log_overflow_policy();
+    void init_log_rate_limit();
+    void init_log_context();
+    void init_log_sink();
+    void init_log_binary();
+    void init_log_crash_handler();
+    int start_slow_request_recorder();
+    int start_traffic_recorder();
     int print_help_or_version(char** argv);
     int start_brpc_server(std::shared_ptr<AsrProxyImpl>& asr_proxy_impl);
     int stop_brpc_server(int log_off_ms);
@@ -25,6 +35,8 @@ private:
     Config _conf;
     std::shared_ptr<AsrService> _asr_service;
     std::shared_ptr<AsrProxyImpl> _asr_proxy_impl;
+    std::shared_ptr<SlowRequestRecorder> _slow_request_recorder;
+    std::shared_ptr<TrafficRecorder> _traffic_recorder;
     brpc::Server _brpc_server;
 };
 
@@ -0,0 +1,75 @@
+#ifndef _SLOW_REQUEST_RECORDER_H_
+#define _SLOW_REQUEST_RECORDER_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "asr_call_stats.h"
+#include "config.h"
+
+// Captures requests that were slower than a threshold or failed, so they can
+// be investigated and replayed offline. A sampled capture copies the audio on
+// the request thread and everything else (file writes, eviction) happens on a
+// background thread. Captures are laid out as
+//     <dir>/audio/<id>.pcm   raw request audio, usable as an asr_bench corpus
+//     <dir>/meta/<id>.json   request metadata and stage breakdown
+// and the oldest ones are removed once the directory exceeds its budget.
+class SlowRequestRecorder {
+public:
+    SlowRequestRecorder();
+    ~SlowRequestRecorder();
+
+    bool init(const Config& conf);
+    void stop();
+
+    // called once per request after the backend returned
+    void maybe_capture(const std::string& audio, const AsrCallStats& stats, int ret,
+                       const std::string& asr_result, const std::string& remote_side);
+
+private:
+    struct Capture {
+        std::string reason;
+        std::string audio;
+        std::string asr_result;
+        std::string remote_side;
+        AsrCallStats stats;
+        int ret;
+        int64_t time_ms;
+    };
+
+    struct StoredCapture {
+        std::string id;
+        int64_t bytes;
+    };
+
+    void write_loop();
+    void write_capture(const Capture& capture);
+    void load_existing_captures();
+    void evict_oldest();
+    std::string audio_path(const std::string& id) const;
+    std::string meta_path(const std::string& id) const;
+
+    static const size_t max_pending = 64;
+
+    Config _conf;
+    std::string _dir;
+    int64_t _threshold_us = 0;
+    double _sample_rate = 0;
+    int64_t _max_bytes = 0;
+
+    std::thread _writer_thrd;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<Capture*> _pending;
+    bool _stop = true;
+
+    // only touched by the writer thread
+    std::deque<StoredCapture> _stored;
+    int64_t _stored_bytes = 0;
+    uint64_t _seq = 0;
+};
+
+#endif  /*_SLOW_REQUEST_RECORDER_H_*/
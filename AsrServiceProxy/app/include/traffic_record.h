@@ -0,0 +1,44 @@
+#ifndef _TRAFFIC_RECORD_H_
+#define _TRAFFIC_RECORD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk format of recorded traffic, shared by the proxy (writer) and
+// asr_replay (reader). A recording is a directory of segment files named
+// traffic_<create_ms>.seg, each laid out as
+//     TrafficSegmentHeader
+//     { TrafficRecordHeader, params, audio, zero padding to 8 bytes }*
+// Integers are in host byte order. A segment that is still being written,
+// or was cut short by a crash, may end with a partial record; readers stop
+// at the first record that does not fit.
+
+#define TRAFFIC_SEGMENT_MAGIC "ASRTRAF1"
+#define TRAFFIC_SEGMENT_PREFIX "traffic_"
+#define TRAFFIC_SEGMENT_SUFFIX ".seg"
+
+static const uint32_t TRAFFIC_SEGMENT_VERSION = 1;
+static const uint32_t TRAFFIC_RECORD_MAGIC = 0x44434552;  // "RECD"
+
+struct TrafficSegmentHeader {
+    char magic[8];              // TRAFFIC_SEGMENT_MAGIC without the trailing '\0'
+    uint32_t version;
+    uint32_t header_size;       // sizeof(TrafficSegmentHeader), records start here
+    int64_t create_time_us;     // wall clock
+};
+
+struct TrafficRecordHeader {
+    uint32_t magic;
+    uint32_t params_len;        // url-encoded request parameters, e.g. format=pcm&rate=16000
+    uint32_t audio_len;
+    uint32_t reserved;
+    int64_t arrival_us;         // wall clock time the proxy received the request
+};
+
+// bytes taken by one record including its padding
+inline size_t traffic_record_size(uint32_t params_len, uint32_t audio_len) {
+    size_t size = sizeof(TrafficRecordHeader) + params_len + audio_len;
+    return (size + 7) & ~((size_t) 7);
+}
+
+#endif  /*_TRAFFIC_RECORD_H_*/
@@ -0,0 +1,65 @@
+#ifndef _TRAFFIC_RECORDER_H_
+#define _TRAFFIC_RECORDER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "config.h"
+
+// Records every incoming request (arrival time, parameters and audio) into
+// size-bounded segment files, see traffic_record.h for the format. The
+// request thread only copies the audio into a bounded queue; a background
+// thread appends to the current segment, rolls to a new one when it is full
+// and removes the oldest segments beyond traffic_record_max_segments.
+// Recordings are replayed with tools/asr_replay.
+class TrafficRecorder {
+public:
+    TrafficRecorder();
+    ~TrafficRecorder();
+
+    bool init(const Config& conf);
+    void stop();
+
+    // called once per request as soon as it is received
+    void record(const std::string& audio, int64_t arrival_us);
+
+private:
+    struct Record {
+        std::string audio;
+        int64_t arrival_us;
+    };
+
+    void write_loop();
+    void write_record(const Record& record);
+    bool open_segment(int64_t now_us);
+    void close_segment();
+    void load_existing_segments();
+    void remove_old_segments();
+
+    // records waiting for the writer beyond this many bytes are dropped
+    static const int64_t max_pending_bytes = 64 * 1024 * 1024;
+
+    Config _conf;
+    std::string _dir;
+    std::string _params;
+    int64_t _segment_bytes = 0;
+    int _max_segments = 0;
+
+    std::thread _writer_thrd;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<Record*> _pending;
+    int64_t _pending_bytes = 0;
+    bool _stop = true;
+
+    // only touched by the writer thread
+    FILE* _segment = NULL;
+    int64_t _segment_size = 0;
+    std::deque<std::string> _segments;
+};
+
+#endif  /*_TRAFFIC_RECORDER_H_*/
@@ -0,0 +1,58 @@
+#include "asr_call_stats.h"
+#include <bvar/bvar.h>
+
+namespace {
+
+struct StageRecorders {
+    StageRecorders()
+        : queue("asr_proxy_stage_queue"),
+          token_wait("asr_proxy_stage_token_wait"),
+          dns("asr_proxy_stage_dns"),
+          connect("asr_proxy_stage_connect"),
+          tls("asr_proxy_stage_tls"),
+          upload("asr_proxy_stage_upload"),
+          think("asr_proxy_stage_backend_think"),
+          download("asr_proxy_stage_download"),
+          parse("asr_proxy_stage_parse"),
+          backend("asr_proxy_stage_backend"),
+          total("asr_proxy_stage_total") {
+    }
+
+    bvar::LatencyRecorder queue;
+    bvar::LatencyRecorder token_wait;
+    bvar::LatencyRecorder dns;
+    bvar::LatencyRecorder connect;
+    bvar::LatencyRecorder tls;
+    bvar::LatencyRecorder upload;
+    bvar::LatencyRecorder think;
+    bvar::LatencyRecorder download;
+    bvar::LatencyRecorder parse;
+    bvar::LatencyRecorder backend;
+    bvar::LatencyRecorder total;
+};
+
+// defined at namespace scope so the stages show up at /vars before the first request
+StageRecorders s_recorders;
+
+inline void record_stage(bvar::LatencyRecorder& recorder, int64_t value_us) {
+    if (value_us >= 0) {
+        recorder << value_us;
+    }
+}
+
+}  // namespace
+
+void AsrCallRecorder::record(const AsrCallStats& stats) {
+    StageRecorders& r = s_recorders;
+    record_stage(r.queue, stats.queue_us);
+    record_stage(r.token_wait, stats.token_wait_us);
+    record_stage(r.dns, stats.dns_us);
+    record_stage(r.connect, stats.connect_us);
+    record_stage(r.tls, stats.tls_us);
+    record_stage(r.upload, stats.upload_us);
+    record_stage(r.think, stats.think_us);
+    record_stage(r.download, stats.download_us);
+    record_stage(r.parse, stats.parse_us);
+    record_stage(r.backend, stats.backend_us);
+    record_stage(r.total, stats.total_us);
+}
@@ -1,8 +1,24 @@
+#include <brpc/traceprintf.h>
 #include "asr_proxy_impl.h"
+#include "asr_call_stats.h"
+#include "log_context.h"
 #include <aip_log.hpp>
+#include <aip_time.hpp>
+#include <atomic>
 
-AsrProxyImpl::AsrProxyImpl(std::shared_ptr<AsrService>& asr_service) :
-    _asr_service(asr_service) {
+namespace {
+
+// for requests whose client did not set a log id
+std::atomic<uint64_t> s_next_request_id(1);
+
+}  // namespace
+
+AsrProxyImpl::AsrProxyImpl(std::shared_ptr<AsrService>& asr_service,
+                           std::shared_ptr<SlowRequestRecorder>& slow_request_recorder,
+                           std::shared_ptr<TrafficRecorder>& traffic_recorder) :
+    _asr_service(asr_service),
+    _slow_request_recorder(slow_request_recorder),
+    _traffic_recorder(traffic_recorder) {
 }
 
 AsrProxyImpl::~AsrProxyImpl() {
@@ -15,6 +31,22 @@ void AsrProxyImpl::asr(google::protobuf::RpcController* cntl_base,
     brpc::ClosureGuard done_guard(done);
     brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
 
+    // every log of this request, also from the asr service, carries these fields
+    uint64_t request_id = cntl->has_log_id() ? cntl->log_id() : s_next_request_id++;
+    LogContextScope log_context(request_id, butil::endpoint2str(cntl->remote_side()).c_str(),
+                                request->audio().size());
+
+    AsrCallStats stats;
+    // on the server side latency_us() is the time spent queued before this handler
+    stats.queue_us = cntl->latency_us();
+    int64_t handler_begin_us = monotonic_time_us();
+    TRACEPRINTF("audio_bytes=%d queue_us=%lld", (int) request->audio().size(),
+                (long long) stats.queue_us);
+    if (_traffic_recorder != nullptr) {
+        // record the time the request arrived, not the time it was dequeued
+        _traffic_recorder->record(request->audio(), gettimeofday_us() - stats.queue_us);
+    }
+
     if (_asr_service == nullptr) {
         AIP_LOG_FATAL("asr_service is nullptr!");
 	response->set_code(-1);
@@ -23,7 +55,17 @@ void AsrProxyImpl::asr(google::protobuf::RpcController* cntl_base,
     }
 
     std::string asr_result;
-    ReturnCode ret = _asr_service->call(request->audio().data(), request->audio().size(), asr_result);
+    ReturnCode ret = _asr_service->call(request->audio().data(), request->audio().size(), asr_result,
+                                        &stats);
+    stats.total_us = stats.queue_us + (monotonic_time_us() - handler_begin_us);
+    AsrCallRecorder::record(stats);
+    TRACEPRINTF("asr ret=%d result_bytes=%d backend_us=%lld", (int) ret, (int) asr_result.size(),
+                (long long) stats.backend_us);
+    if (_slow_request_recorder != nullptr) {
+        _slow_request_recorder->maybe_capture(request->audio(), stats, ret, asr_result,
+                                              butil::endpoint2str(cntl->remote_side()).c_str());
+    }
+
     if (ret != RETURN_OK) {
         response->set_code(-1);
         response->set_msg("asr call failed!");
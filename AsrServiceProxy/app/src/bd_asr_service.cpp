@@ -1,6 +1,10 @@
 #include <chrono>
+#include <functional>
+#include <brpc/traceprintf.h>
 #include "bd_asr_service.h"
+#include "asr_call_stats.h"
 #include "aip_log.hpp"
+#include "aip_time.hpp"
 #include "base64.hpp"
 #include "json_util.hpp"
 
@@ -33,15 +37,94 @@ size_t writefunc(void *ptr, size_t size, size_t nmemb, char **result) {
   return result_len;
 }
 
-int BdAsrService::call(const char* audio_data, int audio_data_size, std::string& asr_result) {
+// libcurl 进度回调, 记录请求体发送完毕的时刻
+struct UploadProgress {
+    int64_t begin_us;
+    int64_t upload_done_us;
+};
+
+static int xferinfofunc(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                        curl_off_t ultotal, curl_off_t ulnow) {
+  UploadProgress *progress = (UploadProgress *) clientp;
+  if (progress->upload_done_us < 0 && ultotal > 0 && ulnow >= ultotal) {
+    progress->upload_done_us = monotonic_time_us() - progress->begin_us;
+  }
+  return 0;
+}
+
+// curl timings are seconds since curl_easy_perform started, -1 if a phase was not reached
+static int64_t curl_phase_us(double later_s, double earlier_s) {
+    if (later_s <= 0 || later_s < earlier_s) {
+        return -1;
+    }
+    return (int64_t) ((later_s - earlier_s) * 1000000);
+}
+
+static void fill_curl_stats(CURL *curl, const UploadProgress& progress, AsrCallStats* stats) {
+    double namelookup = 0, connect = 0, appconnect = 0;
+    double pretransfer = 0, starttransfer = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME, &pretransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+
+    stats->dns_us = curl_phase_us(namelookup, 0);
+    stats->connect_us = curl_phase_us(connect, namelookup);
+    // APPCONNECT_TIME stays 0 for plain http
+    stats->tls_us = appconnect > 0 ? curl_phase_us(appconnect, connect) : 0;
+
+    if (progress.upload_done_us >= 0) {
+        double upload_done = progress.upload_done_us / 1000000.0;
+        stats->upload_us = curl_phase_us(upload_done, pretransfer);
+        stats->think_us = curl_phase_us(starttransfer, upload_done);
+    } else {
+        stats->think_us = curl_phase_us(starttransfer, pretransfer);
+    }
+    stats->download_us = curl_phase_us(total, starttransfer);
+}
+
+// annotate the rpcz span of the current request with the backend phases
+static void trace_curl_call(CURL *curl, CURLcode res_curl, const char* backend,
+                            const AsrCallStats* stats) {
+    if (!brpc::CanAnnotateSpan()) {
+        return;
+    }
+
+    char *primary_ip = NULL;
+    long primary_port = 0;
+    long http_status = 0;
+    curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &primary_ip);
+    curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &primary_port);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+
+    TRACEPRINTF("backend=%s peer=%s:%ld curl_code=%d http_status=%ld",
+                backend, primary_ip ? primary_ip : "-", primary_port, (int) res_curl, http_status);
+    TRACEPRINTF("curl dns_us=%lld connect_us=%lld tls_us=%lld upload_us=%lld think_us=%lld download_us=%lld",
+                (long long) stats->dns_us, (long long) stats->connect_us, (long long) stats->tls_us,
+                (long long) stats->upload_us, (long long) stats->think_us, (long long) stats->download_us);
+}
+
+int BdAsrService::call(const char* audio_data, int audio_data_size, std::string& asr_result,
+                       AsrCallStats* stats) {
     AIP_LOG_NOTICE("BdAsrService call.");
 
+    AsrCallStats local_stats;
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    int64_t call_begin_us = monotonic_time_us();
+
     char url[300];
     CURL *curl = curl_easy_init(); // 需要释放
     char *cuid = curl_easy_escape(curl, "1234567C"/*config->cuid*/, strlen("1234567C"/*config->cuid*/)); // 需要释放
 
     {
         std::lock_guard<std::mutex> lc(_token_mutex);
+        stats->token_wait_us = monotonic_time_us() - call_begin_us;
+        TRACEPRINTF("token cache %s, token_wait_us=%lld", _asr_token.empty() ? "miss" : "hit",
+                    (long long) stats->token_wait_us);
 	if (!_asr_token.empty()) {
             snprintf(url, sizeof(url), "%s?cuid=%s&token=%s&dev_pid=%d",
                      _conf.get_asr_server().c_str(), cuid, _asr_token.c_str(), _conf.get_audio_type());
@@ -75,7 +158,14 @@ int BdAsrService::call(const char* audio_data, int audio_data_size, std::string&
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writefunc);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &result);  // 需要释放
 
+    UploadProgress progress = { monotonic_time_us(), -1 };
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfofunc);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
+
     CURLcode res_curl = curl_easy_perform(curl);
+    fill_curl_stats(curl, progress, stats);
+    trace_curl_call(curl, res_curl, _conf.get_asr_server().c_str(), stats);
 
 
     printf("request url :%s\n", url);
@@ -88,16 +178,20 @@ int BdAsrService::call(const char* audio_data, int audio_data_size, std::string&
         res = ERROR_ASR_CURL;
     } else {
         printf("YOUR FINAL RESULT: %s\n", result);
+        int64_t parse_begin_us = monotonic_time_us();
         if (handle_asr_result(result, asr_result) == RETURN_OK) {
 	  res = RETURN_OK;
 	} else {
 	  res = RETURN_ERROR;
 	}
+        stats->parse_us = monotonic_time_us() - parse_begin_us;
+        TRACEPRINTF("parse_us=%lld result_ok=%d", (long long) stats->parse_us, res == RETURN_OK);
     }
 
     curl_slist_free_all(headerlist);
     free(result);
     curl_easy_cleanup(curl);
+    stats->backend_us = monotonic_time_us() - call_begin_us;
     return res;
 }
 
@@ -168,10 +262,9 @@ void BdAsrService::get_token() {
 	char url_pattern[] = "%s?grant_type=client_credentials&client_id=%s&client_secret=%s";
 	char url[200];
 	char *response = NULL;
-	char api_token_url[] = "http://openapi.baidu.com/oauth/2.0/token";
         std::string request_token;
 
-	snprintf(url, 200, url_pattern, api_token_url, _conf.get_app_key().c_str(), _conf.get_appsecret_key().c_str());
+	snprintf(url, 200, url_pattern, _conf.get_token_server().c_str(), _conf.get_app_key().c_str(), _conf.get_appsecret_key().c_str());
         AIP_LOG_NOTICE("url is: %s", url);
 
 	CURL *curl = curl_easy_init();
@@ -24,7 +24,32 @@ typedef enum _opt_id {
     OPT_CONCURRENT_NUMBER,
     OPT_ENABLE_ASR_SERVICE,
     OPT_LOG_OFF_MS,
+    OPT_LOG_BLOCK_TIMEOUT_US,
+    OPT_LOG_OVERFLOW_POLICY,
+    OPT_LOG_SINK,
+    OPT_LOG_FILE,
+    OPT_LOG_FLUSH_BYTES,
+    OPT_LOG_FLUSH_MS,
+    OPT_LOG_BINARY_FILE,
+    OPT_LOG_RATE_LIMITS,
+    OPT_LOG_RATE_WINDOW_MS,
+    OPT_LOG_FOLD_DUPLICATES,
+    OPT_LOG_SEGMENT_MB,
+    OPT_LOG_DAILY_ROLLING,
+    OPT_LOG_COMPRESS_LEVEL,
+    OPT_LOG_COMPRESS_RATE_KB,
+    OPT_LOG_KEEP_MB,
+    OPT_LOG_CRASH_FILE,
+    OPT_LOG_FORMAT,
     OPT_SERVER_PORT,
+    OPT_SLOW_REQUEST_DIR,
+    OPT_SLOW_REQUEST_MAX_MB,
+    OPT_SLOW_REQUEST_SAMPLE_RATE,
+    OPT_SLOW_REQUEST_THRESHOLD_MS,
+    OPT_TOKEN_SERVER,
+    OPT_TRAFFIC_RECORD_DIR,
+    OPT_TRAFFIC_RECORD_MAX_SEGMENTS,
+    OPT_TRAFFIC_RECORD_SEGMENT_MB,
 } opt_id_t;
 
 typedef struct _option_entry {
@@ -46,7 +71,32 @@ const static option_entry_t s_options[] = {
     { "--concurrent-number", "the concurrent number of calling asr service", "2" },
     { "--enable-asr-service", "enable asr service", "true" },
     { "--log-off-ms", "the waiting time of connection disconnected", "2000" },
+    { "--log-block-timeout-us", "how long a log call waits for room with the block overflow policy", "10000" },
+    { "--log-overflow-policy", "block, drop_newest, drop_low or spill when the log queue is full", "drop_low" },
+    { "--log-sink", "log4cpp, file for the native batching file sink, or mmap for memory mapped rolling segments", "log4cpp" },
+    { "--log-file", "the file of the native log sink, relative to the log directory", "asr_proxy.log" },
+    { "--log-flush-bytes", "the native log sink writes once this much is buffered", "262144" },
+    { "--log-flush-ms", "the native log sink writes lines at the latest after this long", "200" },
+    { "--log-binary-file", "when set, AIP_LOG_* write deferred binary records to this file for logdecode, relative to the log directory", "" },
+    { "--log-rate-limits", "lines one call site may log per window by level, e.g. debug=100,warning=200, empty for no limit", "" },
+    { "--log-rate-window-ms", "window of the log rate limits and of folding repeated lines", "1000" },
+    { "--log-fold-duplicates", "1 folds a line equal to the previous one of its call site into a repeat count", "0" },
+    { "--log-segment-mb", "size of the memory mapped segments of the mmap log sink", "64" },
+    { "--log-daily-rolling", "1 also starts a new mmap log segment at midnight", "1" },
+    { "--log-compress-level", "gzip level for rotated mmap log segments, 0 leaves them uncompressed", "6" },
+    { "--log-compress-rate-kb", "KB per second the log compressor may read, 0 for no cap", "8192" },
+    { "--log-keep-mb", "compressed log segments kept, the oldest are removed beyond this, 0 keeps all", "4096" },
+    { "--log-crash-file", "where queued logs and the stack go when the process crashes, empty for no crash handler", "asr_proxy.crash.log" },
+    { "--log-format", "line format of the file and mmap log sinks, text or json for JSON lines", "text" },
     { "--server-port", "the server port", "8005" },
+    { "--slow-request-dir", "the directory where slow or failed requests are captured", "./slow_requests" },
+    { "--slow-request-max-mb", "the disk budget of captured requests, oldest are removed first", "256" },
+    { "--slow-request-sample-rate", "the fraction of slow or failed requests captured, 0 disables", "0" },
+    { "--slow-request-threshold-ms", "requests slower than this are captured", "5000" },
+    { "--token-server", "the url of the access token server", "http://openapi.baidu.com/oauth/2.0/token" },
+    { "--traffic-record-dir", "the directory where incoming traffic is recorded, empty disables", "" },
+    { "--traffic-record-max-segments", "the number of traffic segments kept, oldest are removed first", "32" },
+    { "--traffic-record-segment-mb", "the size of one traffic segment file", "64" },
     { 0, 0, 0 }
 };
 
@@ -62,7 +112,32 @@ static struct option s_long_options[] = {
     { "concurrent-number", required_argument, 0, OPT_CONCURRENT_NUMBER},
     { "enable-asr-service", required_argument, 0, OPT_ENABLE_ASR_SERVICE},
     { "log-off-ms", required_argument, 2000, OPT_LOG_OFF_MS},
+    { "log-block-timeout-us", required_argument, 0, OPT_LOG_BLOCK_TIMEOUT_US},
+    { "log-overflow-policy", required_argument, 0, OPT_LOG_OVERFLOW_POLICY},
+    { "log-sink", required_argument, 0, OPT_LOG_SINK},
+    { "log-file", required_argument, 0, OPT_LOG_FILE},
+    { "log-flush-bytes", required_argument, 0, OPT_LOG_FLUSH_BYTES},
+    { "log-flush-ms", required_argument, 0, OPT_LOG_FLUSH_MS},
+    { "log-binary-file", required_argument, 0, OPT_LOG_BINARY_FILE},
+    { "log-rate-limits", required_argument, 0, OPT_LOG_RATE_LIMITS},
+    { "log-rate-window-ms", required_argument, 0, OPT_LOG_RATE_WINDOW_MS},
+    { "log-fold-duplicates", required_argument, 0, OPT_LOG_FOLD_DUPLICATES},
+    { "log-segment-mb", required_argument, 0, OPT_LOG_SEGMENT_MB},
+    { "log-daily-rolling", required_argument, 0, OPT_LOG_DAILY_ROLLING},
+    { "log-compress-level", required_argument, 0, OPT_LOG_COMPRESS_LEVEL},
+    { "log-compress-rate-kb", required_argument, 0, OPT_LOG_COMPRESS_RATE_KB},
+    { "log-keep-mb", required_argument, 0, OPT_LOG_KEEP_MB},
+    { "log-crash-file", required_argument, 0, OPT_LOG_CRASH_FILE},
+    { "log-format", required_argument, 0, OPT_LOG_FORMAT},
     { "server-port", required_argument, 8005, OPT_SERVER_PORT},
+    { "slow-request-dir", required_argument, 0, OPT_SLOW_REQUEST_DIR},
+    { "slow-request-max-mb", required_argument, 0, OPT_SLOW_REQUEST_MAX_MB},
+    { "slow-request-sample-rate", required_argument, 0, OPT_SLOW_REQUEST_SAMPLE_RATE},
+    { "slow-request-threshold-ms", required_argument, 0, OPT_SLOW_REQUEST_THRESHOLD_MS},
+    { "token-server", required_argument, 0, OPT_TOKEN_SERVER},
+    { "traffic-record-dir", required_argument, 0, OPT_TRAFFIC_RECORD_DIR},
+    { "traffic-record-max-segments", required_argument, 0, OPT_TRAFFIC_RECORD_MAX_SEGMENTS},
+    { "traffic-record-segment-mb", required_argument, 0, OPT_TRAFFIC_RECORD_SEGMENT_MB},
     {0, 0, 0}
     };
 
@@ -85,7 +160,32 @@ void Config::init_default() {
     this->_capacity_scope = "audio_voice_assistant_get";
     this->_concurrent_number = 2;
     this->_log_off_ms = 2000;
+    this->_log_block_timeout_us = 10000;
+    this->_log_overflow_policy = "drop_low";
+    this->_log_sink = "log4cpp";
+    this->_log_file = "asr_proxy.log";
+    this->_log_flush_bytes = 262144;
+    this->_log_flush_ms = 200;
+    this->_log_binary_file = "";
+    this->_log_rate_limits = "";
+    this->_log_rate_window_ms = 1000;
+    this->_log_fold_duplicates = 0;
+    this->_log_segment_mb = 64;
+    this->_log_daily_rolling = 1;
+    this->_log_compress_level = 6;
+    this->_log_compress_rate_kb = 8192;
+    this->_log_keep_mb = 4096;
+    this->_log_crash_file = "asr_proxy.crash.log";
+    this->_log_format = "text";
     this->_server_port = 8005;
+    this->_slow_request_dir = "./slow_requests";
+    this->_slow_request_max_mb = 256;
+    this->_slow_request_sample_rate = 0;
+    this->_slow_request_threshold_ms = 5000;
+    this->_token_server = "http://openapi.baidu.com/oauth/2.0/token";
+    this->_traffic_record_dir = "";
+    this->_traffic_record_max_segments = 32;
+    this->_traffic_record_segment_mb = 64;
 }
 
 const char* Config::get_command_line_help() {
@@ -167,10 +267,110 @@ int Config::load_from_file(const char* file) {
                     if (!log_off_ms.isNull()) {
                         set_logoff_ms(StringUtil::trim(log_off_ms.asString()).c_str());
                     }
+                    Json::Value& log_block_timeout_us = conf["log_block_timeout_us"];
+                    if (!log_block_timeout_us.isNull()) {
+                        set_log_block_timeout_us(StringUtil::trim(log_block_timeout_us.asString()).c_str());
+                    }
+                    Json::Value& log_overflow_policy = conf["log_overflow_policy"];
+                    if (!log_overflow_policy.isNull()) {
+                        set_log_overflow_policy(StringUtil::trim(log_overflow_policy.asString()).c_str());
+                    }
+                    Json::Value& log_sink = conf["log_sink"];
+                    if (!log_sink.isNull()) {
+                        set_log_sink(StringUtil::trim(log_sink.asString()).c_str());
+                    }
+                    Json::Value& log_file = conf["log_file"];
+                    if (!log_file.isNull()) {
+                        set_log_file(StringUtil::trim(log_file.asString()).c_str());
+                    }
+                    Json::Value& log_flush_bytes = conf["log_flush_bytes"];
+                    if (!log_flush_bytes.isNull()) {
+                        set_log_flush_bytes(StringUtil::trim(log_flush_bytes.asString()).c_str());
+                    }
+                    Json::Value& log_flush_ms = conf["log_flush_ms"];
+                    if (!log_flush_ms.isNull()) {
+                        set_log_flush_ms(StringUtil::trim(log_flush_ms.asString()).c_str());
+                    }
+                    Json::Value& log_binary_file = conf["log_binary_file"];
+                    if (!log_binary_file.isNull()) {
+                        set_log_binary_file(StringUtil::trim(log_binary_file.asString()).c_str());
+                    }
+                    Json::Value& log_rate_limits = conf["log_rate_limits"];
+                    if (!log_rate_limits.isNull()) {
+                        set_log_rate_limits(StringUtil::trim(log_rate_limits.asString()).c_str());
+                    }
+                    Json::Value& log_rate_window_ms = conf["log_rate_window_ms"];
+                    if (!log_rate_window_ms.isNull()) {
+                        set_log_rate_window_ms(StringUtil::trim(log_rate_window_ms.asString()).c_str());
+                    }
+                    Json::Value& log_fold_duplicates = conf["log_fold_duplicates"];
+                    if (!log_fold_duplicates.isNull()) {
+                        set_log_fold_duplicates(StringUtil::trim(log_fold_duplicates.asString()).c_str());
+                    }
+                    Json::Value& log_segment_mb = conf["log_segment_mb"];
+                    if (!log_segment_mb.isNull()) {
+                        set_log_segment_mb(StringUtil::trim(log_segment_mb.asString()).c_str());
+                    }
+                    Json::Value& log_daily_rolling = conf["log_daily_rolling"];
+                    if (!log_daily_rolling.isNull()) {
+                        set_log_daily_rolling(StringUtil::trim(log_daily_rolling.asString()).c_str());
+                    }
+                    Json::Value& log_compress_level = conf["log_compress_level"];
+                    if (!log_compress_level.isNull()) {
+                        set_log_compress_level(StringUtil::trim(log_compress_level.asString()).c_str());
+                    }
+                    Json::Value& log_compress_rate_kb = conf["log_compress_rate_kb"];
+                    if (!log_compress_rate_kb.isNull()) {
+                        set_log_compress_rate_kb(StringUtil::trim(log_compress_rate_kb.asString()).c_str());
+                    }
+                    Json::Value& log_keep_mb = conf["log_keep_mb"];
+                    if (!log_keep_mb.isNull()) {
+                        set_log_keep_mb(StringUtil::trim(log_keep_mb.asString()).c_str());
+                    }
+                    Json::Value& log_crash_file = conf["log_crash_file"];
+                    if (!log_crash_file.isNull()) {
+                        set_log_crash_file(StringUtil::trim(log_crash_file.asString()).c_str());
+                    }
+                    Json::Value& log_format = conf["log_format"];
+                    if (!log_format.isNull()) {
+                        set_log_format(StringUtil::trim(log_format.asString()).c_str());
+                    }
                     Json::Value& server_port = conf["server_port"];
                     if (!server_port.isNull()) {
                         set_server_port(StringUtil::trim(server_port.asString()).c_str());
                     }
+                    Json::Value& slow_request_dir = conf["slow_request_dir"];
+                    if (!slow_request_dir.isNull()) {
+                        set_slow_request_dir(StringUtil::trim(slow_request_dir.asString()).c_str());
+                    }
+                    Json::Value& slow_request_max_mb = conf["slow_request_max_mb"];
+                    if (!slow_request_max_mb.isNull()) {
+                        set_slow_request_max_mb(StringUtil::trim(slow_request_max_mb.asString()).c_str());
+                    }
+                    Json::Value& slow_request_sample_rate = conf["slow_request_sample_rate"];
+                    if (!slow_request_sample_rate.isNull()) {
+                        set_slow_request_sample_rate(StringUtil::trim(slow_request_sample_rate.asString()).c_str());
+                    }
+                    Json::Value& slow_request_threshold_ms = conf["slow_request_threshold_ms"];
+                    if (!slow_request_threshold_ms.isNull()) {
+                        set_slow_request_threshold_ms(StringUtil::trim(slow_request_threshold_ms.asString()).c_str());
+                    }
+                    Json::Value& token_server = conf["token_server"];
+                    if (!token_server.isNull()) {
+                        set_token_server(StringUtil::trim(token_server.asString()).c_str());
+                    }
+                    Json::Value& traffic_record_dir = conf["traffic_record_dir"];
+                    if (!traffic_record_dir.isNull()) {
+                        set_traffic_record_dir(StringUtil::trim(traffic_record_dir.asString()).c_str());
+                    }
+                    Json::Value& traffic_record_max_segments = conf["traffic_record_max_segments"];
+                    if (!traffic_record_max_segments.isNull()) {
+                        set_traffic_record_max_segments(StringUtil::trim(traffic_record_max_segments.asString()).c_str());
+                    }
+                    Json::Value& traffic_record_segment_mb = conf["traffic_record_segment_mb"];
+                    if (!traffic_record_segment_mb.isNull()) {
+                        set_traffic_record_segment_mb(StringUtil::trim(traffic_record_segment_mb.asString()).c_str());
+                    }
                 }
             }
         } else {
@@ -221,10 +421,110 @@ void Config::set_logoff_ms(const char* optarg) {
     this->_log_off_ms = string_to_int(optarg);
 }
 
+void Config::set_log_block_timeout_us(const char* optarg) {
+    this->_log_block_timeout_us = string_to_int(optarg);
+}
+
+void Config::set_log_overflow_policy(const char* optarg) {
+    this->_log_overflow_policy = optarg;
+}
+
+void Config::set_log_sink(const char* optarg) {
+    this->_log_sink = optarg;
+}
+
+void Config::set_log_file(const char* optarg) {
+    this->_log_file = optarg;
+}
+
+void Config::set_log_flush_bytes(const char* optarg) {
+    this->_log_flush_bytes = string_to_int(optarg);
+}
+
+void Config::set_log_flush_ms(const char* optarg) {
+    this->_log_flush_ms = string_to_int(optarg);
+}
+
+void Config::set_log_binary_file(const char* optarg) {
+    this->_log_binary_file = optarg;
+}
+
+void Config::set_log_rate_limits(const char* optarg) {
+    this->_log_rate_limits = optarg;
+}
+
+void Config::set_log_rate_window_ms(const char* optarg) {
+    this->_log_rate_window_ms = string_to_int(optarg);
+}
+
+void Config::set_log_fold_duplicates(const char* optarg) {
+    this->_log_fold_duplicates = string_to_int(optarg);
+}
+
+void Config::set_log_segment_mb(const char* optarg) {
+    this->_log_segment_mb = string_to_int(optarg);
+}
+
+void Config::set_log_daily_rolling(const char* optarg) {
+    this->_log_daily_rolling = string_to_int(optarg);
+}
+
+void Config::set_log_compress_level(const char* optarg) {
+    this->_log_compress_level = string_to_int(optarg);
+}
+
+void Config::set_log_compress_rate_kb(const char* optarg) {
+    this->_log_compress_rate_kb = string_to_int(optarg);
+}
+
+void Config::set_log_keep_mb(const char* optarg) {
+    this->_log_keep_mb = string_to_int(optarg);
+}
+
+void Config::set_log_crash_file(const char* optarg) {
+    this->_log_crash_file = optarg;
+}
+
+void Config::set_log_format(const char* optarg) {
+    this->_log_format = optarg;
+}
+
 void Config::set_server_port(const char* optarg) {
     this->_server_port = string_to_int(optarg);
 }
 
+void Config::set_slow_request_dir(const char* optarg) {
+    this->_slow_request_dir = optarg;
+}
+
+void Config::set_slow_request_max_mb(const char* optarg) {
+    this->_slow_request_max_mb = string_to_int(optarg);
+}
+
+void Config::set_slow_request_sample_rate(const char* optarg) {
+    this->_slow_request_sample_rate = string_to_float(optarg);
+}
+
+void Config::set_slow_request_threshold_ms(const char* optarg) {
+    this->_slow_request_threshold_ms = string_to_int(optarg);
+}
+
+void Config::set_token_server(const char* optarg) {
+    this->_token_server = optarg;
+}
+
+void Config::set_traffic_record_dir(const char* optarg) {
+    this->_traffic_record_dir = optarg;
+}
+
+void Config::set_traffic_record_max_segments(const char* optarg) {
+    this->_traffic_record_max_segments = string_to_int(optarg);
+}
+
+void Config::set_traffic_record_segment_mb(const char* optarg) {
+    this->_traffic_record_segment_mb = string_to_int(optarg);
+}
+
 int Config::read_file_content(const char* file, std::string& result) {
     result.clear();
     std::ifstream is(file, std::ifstream::in);
@@ -245,7 +545,7 @@ int Config::read_file_content(const char* file, std::string& result) {
                 len = length;
             } else {
                 AIP_LOG_FATAL("read_file_content: failed to read content, "
-                                "need %d. actual %d", length, is.gcount());
+                                "need %d. actual %ld", length, (long) is.gcount());
             }
             is.close();
             delete [] buffer;
@@ -315,11 +615,136 @@ int Config::load_command_line(char* const* argv, int argc) {
         }
         break;
 
+        case OPT_LOG_BLOCK_TIMEOUT_US: {
+            set_log_block_timeout_us(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_OVERFLOW_POLICY: {
+            set_log_overflow_policy(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_SINK: {
+            set_log_sink(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_FILE: {
+            set_log_file(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_FLUSH_BYTES: {
+            set_log_flush_bytes(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_FLUSH_MS: {
+            set_log_flush_ms(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_BINARY_FILE: {
+            set_log_binary_file(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_RATE_LIMITS: {
+            set_log_rate_limits(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_RATE_WINDOW_MS: {
+            set_log_rate_window_ms(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_FOLD_DUPLICATES: {
+            set_log_fold_duplicates(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_SEGMENT_MB: {
+            set_log_segment_mb(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_DAILY_ROLLING: {
+            set_log_daily_rolling(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_COMPRESS_LEVEL: {
+            set_log_compress_level(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_COMPRESS_RATE_KB: {
+            set_log_compress_rate_kb(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_KEEP_MB: {
+            set_log_keep_mb(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_CRASH_FILE: {
+            set_log_crash_file(cleaned_optarg);
+        }
+        break;
+
+        case OPT_LOG_FORMAT: {
+            set_log_format(cleaned_optarg);
+        }
+        break;
+
         case OPT_SERVER_PORT: {
             set_server_port(cleaned_optarg);
         }
         break;
 
+        case OPT_SLOW_REQUEST_DIR: {
+            set_slow_request_dir(cleaned_optarg);
+        }
+        break;
+
+        case OPT_SLOW_REQUEST_MAX_MB: {
+            set_slow_request_max_mb(cleaned_optarg);
+        }
+        break;
+
+        case OPT_SLOW_REQUEST_SAMPLE_RATE: {
+            set_slow_request_sample_rate(cleaned_optarg);
+        }
+        break;
+
+        case OPT_SLOW_REQUEST_THRESHOLD_MS: {
+            set_slow_request_threshold_ms(cleaned_optarg);
+        }
+        break;
+
+        case OPT_TOKEN_SERVER: {
+            set_token_server(cleaned_optarg);
+        }
+        break;
+
+        case OPT_TRAFFIC_RECORD_DIR: {
+            set_traffic_record_dir(cleaned_optarg);
+        }
+        break;
+
+        case OPT_TRAFFIC_RECORD_MAX_SEGMENTS: {
+            set_traffic_record_max_segments(cleaned_optarg);
+        }
+        break;
+
+        case OPT_TRAFFIC_RECORD_SEGMENT_MB: {
+            set_traffic_record_segment_mb(cleaned_optarg);
+        }
+        break;
+
         case OPT_ENABLE_ASR_SERVICE: {
             set_enable_asr_service(StringUtil::to_bool(cleaned_optarg));
         }
@@ -384,10 +809,110 @@ int Config::get_server_port() {
     return this->_server_port;
 }
 
+const std::string& Config::get_slow_request_dir() {
+    return this->_slow_request_dir;
+}
+
+int Config::get_slow_request_max_mb() {
+    return this->_slow_request_max_mb;
+}
+
+float Config::get_slow_request_sample_rate() {
+    return this->_slow_request_sample_rate;
+}
+
+int Config::get_slow_request_threshold_ms() {
+    return this->_slow_request_threshold_ms;
+}
+
+const std::string& Config::get_token_server() {
+    return this->_token_server;
+}
+
+const std::string& Config::get_traffic_record_dir() {
+    return this->_traffic_record_dir;
+}
+
+int Config::get_traffic_record_max_segments() {
+    return this->_traffic_record_max_segments;
+}
+
+int Config::get_traffic_record_segment_mb() {
+    return this->_traffic_record_segment_mb;
+}
+
 int Config::get_logoff_ms() {
     return this->_log_off_ms;
 }
 
+int Config::get_log_block_timeout_us() {
+    return this->_log_block_timeout_us;
+}
+
+const std::string& Config::get_log_overflow_policy() {
+    return this->_log_overflow_policy;
+}
+
+const std::string& Config::get_log_sink() {
+    return this->_log_sink;
+}
+
+const std::string& Config::get_log_file() {
+    return this->_log_file;
+}
+
+int Config::get_log_flush_bytes() {
+    return this->_log_flush_bytes;
+}
+
+int Config::get_log_flush_ms() {
+    return this->_log_flush_ms;
+}
+
+const std::string& Config::get_log_binary_file() {
+    return this->_log_binary_file;
+}
+
+const std::string& Config::get_log_rate_limits() {
+    return this->_log_rate_limits;
+}
+
+int Config::get_log_rate_window_ms() {
+    return this->_log_rate_window_ms;
+}
+
+int Config::get_log_fold_duplicates() {
+    return this->_log_fold_duplicates;
+}
+
+int Config::get_log_segment_mb() {
+    return this->_log_segment_mb;
+}
+
+int Config::get_log_daily_rolling() {
+    return this->_log_daily_rolling;
+}
+
+int Config::get_log_compress_level() {
+    return this->_log_compress_level;
+}
+
+int Config::get_log_compress_rate_kb() {
+    return this->_log_compress_rate_kb;
+}
+
+int Config::get_log_keep_mb() {
+    return this->_log_keep_mb;
+}
+
+const std::string& Config::get_log_crash_file() {
+    return this->_log_crash_file;
+}
+
+const std::string& Config::get_log_format() {
+    return this->_log_format;
+}
+
 bool Config::is_enable_asr_service() {
     return this->_enable_asr_service;
 }
@@ -464,7 +989,32 @@ std::string Config::to_string() {
     builder << "audio type:           " << get_audio_type() << std::endl;
     builder << "asr server:           " << get_asr_server() << std::endl;
     builder << "concurrent number:    " << get_concurrent_number() << std::endl;
+    builder << "log block timeout:    " << get_log_block_timeout_us() << std::endl;
+    builder << "log overflow policy:  " << get_log_overflow_policy() << std::endl;
+    builder << "log sink:             " << get_log_sink() << std::endl;
+    builder << "log file:             " << get_log_file() << std::endl;
+    builder << "log flush bytes:      " << get_log_flush_bytes() << std::endl;
+    builder << "log flush ms:         " << get_log_flush_ms() << std::endl;
+    builder << "log binary file:      " << get_log_binary_file() << std::endl;
+    builder << "log rate limits:      " << get_log_rate_limits() << std::endl;
+    builder << "log rate window ms:   " << get_log_rate_window_ms() << std::endl;
+    builder << "log fold duplicates:  " << get_log_fold_duplicates() << std::endl;
+    builder << "log segment mb:       " << get_log_segment_mb() << std::endl;
+    builder << "log daily rolling:    " << get_log_daily_rolling() << std::endl;
+    builder << "log compress level:   " << get_log_compress_level() << std::endl;
+    builder << "log compress rate kb: " << get_log_compress_rate_kb() << std::endl;
+    builder << "log keep mb:          " << get_log_keep_mb() << std::endl;
+    builder << "log crash file:       " << get_log_crash_file() << std::endl;
+    builder << "log format:           " << get_log_format() << std::endl;
     builder << "server port:    " << get_server_port() << std::endl;
+    builder << "slow request dir:     " << get_slow_request_dir() << std::endl;
+    builder << "slow request max mb:  " << get_slow_request_max_mb() << std::endl;
+    builder << "slow request sample:  " << get_slow_request_sample_rate() << std::endl;
+    builder << "slow request ms:      " << get_slow_request_threshold_ms() << std::endl;
+    builder << "token server:         " << get_token_server() << std::endl;
+    builder << "traffic record dir:   " << get_traffic_record_dir() << std::endl;
+    builder << "traffic max segments: " << get_traffic_record_max_segments() << std::endl;
+    builder << "traffic segment mb:   " << get_traffic_record_segment_mb() << std::endl;
     return builder.str();
 }
 
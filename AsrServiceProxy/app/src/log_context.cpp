@@ -0,0 +1,74 @@
+#include "log_context.h"
+#include <bthread/bthread.h>
+#include <logapi.hpp>
+#include <stdio.h>
+
+namespace {
+
+struct Fields {
+    size_t len;
+    char text[192];
+};
+
+bthread_key_t s_key;
+bool s_key_valid = false;
+
+void delete_fields(void* fields) {
+    delete static_cast<Fields*>(fields);
+}
+
+const char* LOGAPI current_fields(size_t* len) {
+    Fields* fields = static_cast<Fields*>(bthread_getspecific(s_key));
+    if (fields == NULL || fields->len == 0) {
+        return NULL;
+    }
+
+    *len = fields->len;
+    return fields->text;
+}
+
+}  // namespace
+
+void LogContext::init() {
+    if (s_key_valid) {
+        return;
+    }
+
+    if (bthread_key_create(&s_key, delete_fields) != 0) {
+        return;
+    }
+
+    s_key_valid = true;
+    log_set_context_callback(current_fields);
+}
+
+LogContextScope::LogContextScope(uint64_t request_id, const char* client, size_t audio_bytes) {
+    if (!s_key_valid) {
+        return;
+    }
+
+    // kept for the next request of the bthread, freed when the bthread ends
+    Fields* fields = static_cast<Fields*>(bthread_getspecific(s_key));
+    if (fields == NULL) {
+        fields = new Fields();
+        if (bthread_setspecific(s_key, fields) != 0) {
+            delete fields;
+            return;
+        }
+    }
+
+    int len = snprintf(fields->text, sizeof(fields->text), "req_id=%llu client=%s audio_bytes=%zu",
+                       (unsigned long long) request_id, client, audio_bytes);
+    fields->len = len < 0 ? 0 : ((size_t) len < sizeof(fields->text) ? len : sizeof(fields->text) - 1);
+}
+
+LogContextScope::~LogContextScope() {
+    if (!s_key_valid) {
+        return;
+    }
+
+    Fields* fields = static_cast<Fields*>(bthread_getspecific(s_key));
+    if (fields != NULL) {
+        fields->len = 0;
+    }
+}
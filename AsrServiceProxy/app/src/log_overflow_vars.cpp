@@ -0,0 +1,39 @@
+#include <logapi.hpp>
+#include <bvar/bvar.h>
+
+// Exposes the overflow counters of the log library at /vars, so dropped
+// log lines show up next to the request metrics that caused them.
+
+namespace {
+
+int64_t get_log_dropped(void*) {
+    log_overflow_stats_t stats;
+    log_get_overflow_stats(&stats);
+    return (int64_t) stats._dropped;
+}
+
+int64_t get_log_dropped_low(void*) {
+    log_overflow_stats_t stats;
+    log_get_overflow_stats(&stats);
+    return (int64_t) stats._dropped_low;
+}
+
+int64_t get_log_block_timeouts(void*) {
+    log_overflow_stats_t stats;
+    log_get_overflow_stats(&stats);
+    return (int64_t) stats._block_timeouts;
+}
+
+int64_t get_log_spilled(void*) {
+    log_overflow_stats_t stats;
+    log_get_overflow_stats(&stats);
+    return (int64_t) stats._spilled;
+}
+
+bvar::PassiveStatus<int64_t> s_log_dropped("asr_proxy_log_dropped", get_log_dropped, NULL);
+bvar::PassiveStatus<int64_t> s_log_dropped_low("asr_proxy_log_dropped_low", get_log_dropped_low, NULL);
+bvar::PassiveStatus<int64_t> s_log_block_timeouts("asr_proxy_log_block_timeouts",
+                                                  get_log_block_timeouts, NULL);
+bvar::PassiveStatus<int64_t> s_log_spilled("asr_proxy_log_spilled", get_log_spilled, NULL);
+
+}  // namespace
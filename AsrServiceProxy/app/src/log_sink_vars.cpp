@@ -0,0 +1,40 @@
+#include <logapi.hpp>
+#include <bvar/bvar.h>
+
+// Exposes the native log sink counters at /vars, writes against records
+// shows how well bursts are batched.
+
+namespace {
+
+int64_t get_log_sink_records(void*) {
+    log_file_sink_stats_t stats;
+    log_get_file_sink_stats(&stats);
+    return (int64_t) stats._records;
+}
+
+int64_t get_log_sink_bytes(void*) {
+    log_file_sink_stats_t stats;
+    log_get_file_sink_stats(&stats);
+    return (int64_t) stats._bytes;
+}
+
+int64_t get_log_sink_writes(void*) {
+    log_file_sink_stats_t stats;
+    log_get_file_sink_stats(&stats);
+    return (int64_t) stats._writes;
+}
+
+int64_t get_log_sink_write_errors(void*) {
+    log_file_sink_stats_t stats;
+    log_get_file_sink_stats(&stats);
+    return (int64_t) stats._write_errors;
+}
+
+bvar::PassiveStatus<int64_t> s_log_sink_records("asr_proxy_log_sink_records",
+                                                get_log_sink_records, NULL);
+bvar::PassiveStatus<int64_t> s_log_sink_bytes("asr_proxy_log_sink_bytes", get_log_sink_bytes, NULL);
+bvar::PassiveStatus<int64_t> s_log_sink_writes("asr_proxy_log_sink_writes", get_log_sink_writes, NULL);
+bvar::PassiveStatus<int64_t> s_log_sink_write_errors("asr_proxy_log_sink_write_errors",
+                                                     get_log_sink_write_errors, NULL);
+
+}  // namespace
@@ -15,9 +15,11 @@
 #include "pipeline.h"
 #include "asr_proxy_impl.h"
 #include "asr_service_factory.h"
+#include "log_context.h"
 
 void module_log_init(void);
 void module_log_fini();
+extern "C" int unreg_log4cpp();
 
 Pipeline::Pipeline() {
 }
@@ -39,6 +41,150 @@ int Pipeline::get_asr_service() {
     return 0;
 }
 
+void Pipeline::init_log_overflow_policy() {
+    const std::string& name = _conf.get_log_overflow_policy();
+    LogOverflowPolicy policy = LOG_OVERFLOW_DROP_LOW;
+    if (name == "block") {
+        policy = LOG_OVERFLOW_BLOCK;
+    } else if (name == "drop_newest") {
+        policy = LOG_OVERFLOW_DROP_NEWEST;
+    } else if (name == "spill") {
+        policy = LOG_OVERFLOW_SPILL;
+    } else if (name != "drop_low") {
+        AIP_LOG_WARNING("unknown log overflow policy %s, use drop_low", name.c_str());
+    }
+
+    log_set_overflow_policy(policy, _conf.get_log_block_timeout_us());
+}
+
+void Pipeline::init_log_rate_limit() {
+    static const struct {
+        const char* _name;
+        int _level;
+    } s_levels[] = {
+        { "debug", DEBUG }, { "trace", INFO }, { "notice", NOTICE },
+        { "warning", WARNING }, { "error", ERROR },
+    };
+
+    // "notice=200,warning=200", a level left out is not limited
+    std::map<std::string, std::string> limits;
+    const std::string& spec = _conf.get_log_rate_limits();
+    if (!spec.empty() && StringUtil::split(spec, ',', '=', &limits) != 0) {
+        AIP_LOG_WARNING("bad log rate limits %s, expect level=lines,...", spec.c_str());
+        limits.clear();
+    }
+
+    for (std::map<std::string, std::string>::const_iterator it = limits.begin();
+            it != limits.end(); ++it) {
+        int level = 0;
+        for (size_t i = 0; i < sizeof(s_levels) / sizeof(s_levels[0]); i++) {
+            if (it->first == s_levels[i]._name) {
+                level = s_levels[i]._level;
+            }
+        }
+        if (level == 0) {
+            AIP_LOG_WARNING("unknown level %s in log rate limits", it->first.c_str());
+            continue;
+        }
+        log_set_rate_limit(level, atoi(it->second.c_str()));
+    }
+
+    log_set_rate_window(_conf.get_log_rate_window_ms(), _conf.get_log_fold_duplicates());
+}
+
+void Pipeline::init_log_context() {
+    // request id, client and audio size on every log of a request
+    LogContext::init();
+
+    const std::string& format = _conf.get_log_format();
+    if (format == "json") {
+        log_set_line_format(LOG_FORMAT_JSON);
+    } else if (format != "text") {
+        AIP_LOG_WARNING("unknown log format %s, use text", format.c_str());
+    }
+}
+
+void Pipeline::init_log_sink() {
+    const std::string& name = _conf.get_log_sink();
+    if (name == "log4cpp") {
+        return;
+    }
+    if (name != "file" && name != "mmap") {
+        AIP_LOG_WARNING("unknown log sink %s, use log4cpp", name.c_str());
+        return;
+    }
+
+    // relative to the log directory, the current directory while this runs
+    int opened = 0;
+    if (name == "mmap") {
+        opened = log_mmap_sink_open(_conf.get_log_file().c_str(), _conf.get_log_segment_mb(),
+                                    _conf.get_log_daily_rolling());
+    } else {
+        opened = log_file_sink_open(_conf.get_log_file().c_str(), _conf.get_log_flush_bytes(),
+                                    _conf.get_log_flush_ms());
+    }
+    if (!opened) {
+        AIP_LOG_WARNING("failed to open log file %s, use log4cpp", _conf.get_log_file().c_str());
+        return;
+    }
+
+    // rotated segments are gzipped off the request path, the oldest go once over log_keep_mb
+    if (name == "mmap" && _conf.get_log_compress_level() > 0
+        && !log_archive_open(_conf.get_log_file().c_str(), _conf.get_log_compress_level(),
+                             _conf.get_log_compress_rate_kb(), _conf.get_log_keep_mb())) {
+        AIP_LOG_WARNING("failed to start the log compressor, segments stay uncompressed");
+    }
+
+    // the file sink writes the same lines, keep log4cpp from writing them twice
+    unreg_log4cpp();
+}
+
+void Pipeline::init_log_binary() {
+    const std::string& path = _conf.get_log_binary_file();
+    if (path.empty()) {
+        return;
+    }
+
+    // AIP_LOG_* go to this file from now on, the other logs stay with the text sink
+    if (!log_binary_open(path.c_str(), _conf.get_log_flush_bytes(), _conf.get_log_flush_ms())) {
+        AIP_LOG_WARNING("failed to open binary log file %s, log text", path.c_str());
+    }
+}
+
+void Pipeline::init_log_crash_handler() {
+    const std::string& path = _conf.get_log_crash_file();
+    if (path.empty()) {
+        return;
+    }
+
+    // relative to the log directory like the other log files
+    if (!log_crash_handler_install(path.c_str())) {
+        AIP_LOG_WARNING("failed to open crash log file %s, no crash handler", path.c_str());
+    }
+}
+
+int Pipeline::start_slow_request_recorder() {
+    _slow_request_recorder = std::make_shared<SlowRequestRecorder>();
+    if (!_slow_request_recorder->init(_conf)) {
+        AIP_LOG_FATAL("slow request recorder init failed!");
+        _slow_request_recorder.reset();
+        return -1;
+    }
+
+    return 0;
+}
+
+int Pipeline::start_traffic_recorder() {
+    _traffic_recorder = std::make_shared<TrafficRecorder>();
+    if (!_traffic_recorder->init(_conf)) {
+        AIP_LOG_FATAL("traffic recorder init failed!");
+        _traffic_recorder.reset();
+        return -1;
+    }
+
+    return 0;
+}
+
 int Pipeline::print_help_or_version(char** argv) {
     if (strncmp(argv[1], "-help", strlen("-help")) == 0 ||
         strncmp(argv[1], "--help", strlen("--help")) == 0) {
@@ -77,11 +223,17 @@ int Pipeline::run(int argc, char** argv) {
     chdir(path.str().c_str());
 
     module_log_init();
+    init_log_overflow_policy();
+    init_log_rate_limit();
+    init_log_context();
+    init_log_sink();
+    init_log_binary();
+    init_log_crash_handler();
 
     // back to original dir
     chdir(_conf.get_working_dir().c_str());
 
-    AIP_LOG_NOTICE(_conf.to_string().c_str());
+    AIP_LOG_NOTICE("%s", _conf.to_string().c_str());
 
     // avoid the crash for SIGPIPE
     signal(SIGPIPE, SIG_IGN);
@@ -92,7 +244,12 @@ int Pipeline::run(int argc, char** argv) {
         return -1;
     }
 
-    _asr_proxy_impl = std::make_shared<AsrProxyImpl>(_asr_service);
+    // capturing slow requests and recording traffic are best effort, serve without them on failure
+    start_slow_request_recorder();
+    start_traffic_recorder();
+
+    _asr_proxy_impl = std::make_shared<AsrProxyImpl>(_asr_service, _slow_request_recorder,
+                                                     _traffic_recorder);
     start_brpc_server(_asr_proxy_impl);
 
     while (!_stop) {
@@ -101,6 +258,17 @@ int Pipeline::run(int argc, char** argv) {
     }
 
     stop_brpc_server(_conf.get_logoff_ms());
+    if (_slow_request_recorder != nullptr) {
+        _slow_request_recorder->stop();
+    }
+    if (_traffic_recorder != nullptr) {
+        _traffic_recorder->stop();
+    }
+    log_binary_close();
+    log_file_sink_close();
+    log_mmap_sink_close();
+    log_archive_close();
+    log_crash_handler_uninstall();
     module_log_fini();
 
     return 0;
@@ -0,0 +1,257 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <aip_log.hpp>
+#include <json_util.hpp>
+#include <utils.hpp>
+#include <butil/fast_rand.h>
+#include <bvar/bvar.h>
+#include "slow_request_recorder.h"
+
+static bvar::Adder<int64_t> s_slow_request_captured("asr_proxy_slow_request_captured");
+static bvar::Adder<int64_t> s_slow_request_dropped("asr_proxy_slow_request_dropped");
+
+SlowRequestRecorder::SlowRequestRecorder() {
+}
+
+SlowRequestRecorder::~SlowRequestRecorder() {
+    stop();
+}
+
+bool SlowRequestRecorder::init(const Config& conf) {
+    _conf = conf;
+    _sample_rate = _conf.get_slow_request_sample_rate();
+    if (_sample_rate <= 0) {
+        AIP_LOG_NOTICE("slow request capture disabled.");
+        return true;
+    }
+
+    _dir = _conf.get_slow_request_dir();
+    _threshold_us = _conf.get_slow_request_threshold_ms() * 1000LL;
+    _max_bytes = _conf.get_slow_request_max_mb() * 1024LL * 1024LL;
+
+    mkdir(_dir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH);
+    mkdir((_dir + "/audio").c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH);
+    mkdir((_dir + "/meta").c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH);
+    if (!FileUtil::is_dir((_dir + "/meta").c_str())) {
+        AIP_LOG_FATAL("failed to create slow request dir %s", _dir.c_str());
+        return false;
+    }
+
+    load_existing_captures();
+
+    try {
+        _stop = false;
+        _writer_thrd = std::thread(std::bind(&SlowRequestRecorder::write_loop, this));
+    } catch (std::runtime_error& err) {
+        _stop = true;
+        AIP_LOG_FATAL("SlowRequestRecorder::write_loop failed: %s", err.what());
+        return false;
+    }
+
+    AIP_LOG_NOTICE("slow request capture: dir %s, threshold %d ms, sample rate %f, %d MB.",
+                   _dir.c_str(), _conf.get_slow_request_threshold_ms(), _sample_rate,
+                   _conf.get_slow_request_max_mb());
+    return true;
+}
+
+void SlowRequestRecorder::stop() {
+    {
+        std::lock_guard<std::mutex> lc(_mutex);
+        if (_stop) {
+            return;
+        }
+        _stop = true;
+    }
+    _cond.notify_all();
+
+    if (_writer_thrd.joinable()) {
+        _writer_thrd.join();
+    }
+}
+
+void SlowRequestRecorder::maybe_capture(const std::string& audio, const AsrCallStats& stats, int ret,
+                                        const std::string& asr_result,
+                                        const std::string& remote_side) {
+    if (_sample_rate <= 0) {
+        return;
+    }
+
+    const char* reason = NULL;
+    if (ret != 0) {
+        reason = "error";
+    } else if (stats.total_us > _threshold_us) {
+        reason = "slow";
+    } else {
+        return;
+    }
+
+    if (_sample_rate < 1 && butil::fast_rand_double() >= _sample_rate) {
+        return;
+    }
+
+    {
+        // cheap check before copying the audio
+        std::lock_guard<std::mutex> lc(_mutex);
+        if (_stop || _pending.size() >= max_pending) {
+            s_slow_request_dropped << 1;
+            return;
+        }
+    }
+
+    Capture* capture = new Capture();
+    capture->reason = reason;
+    capture->audio = audio;
+    capture->asr_result = asr_result;
+    capture->remote_side = remote_side;
+    capture->stats = stats;
+    capture->ret = ret;
+    capture->time_ms = TimeUtil::now_ms();
+
+    {
+        std::lock_guard<std::mutex> lc(_mutex);
+        if (_stop || _pending.size() >= max_pending) {
+            s_slow_request_dropped << 1;
+            delete capture;
+            return;
+        }
+        _pending.push_back(capture);
+    }
+    _cond.notify_one();
+}
+
+void SlowRequestRecorder::write_loop() {
+    while (true) {
+        Capture* capture = NULL;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return _stop || !_pending.empty(); });
+            if (_pending.empty()) {
+                return;
+            }
+            capture = _pending.front();
+            _pending.pop_front();
+        }
+
+        write_capture(*capture);
+        delete capture;
+    }
+}
+
+void SlowRequestRecorder::write_capture(const Capture& capture) {
+    char id[64];
+    snprintf(id, sizeof(id), "%013lld_%06llu", (long long) capture.time_ms,
+             (unsigned long long) (_seq++ % 1000000));
+
+    Json::Value root(Json::objectValue);
+    root["id"] = id;
+    root["reason"] = capture.reason;
+    root["time_ms"] = (Json::Int64) capture.time_ms;
+    root["remote_side"] = capture.remote_side;
+    root["ret"] = capture.ret;
+    root["audio_bytes"] = (Json::UInt64) capture.audio.size();
+    root["audio_file"] = std::string("audio/") + id + ".pcm";
+    root["asr_result"] = capture.asr_result;
+
+    Json::Value stages(Json::objectValue);
+    stages["queue_us"] = (Json::Int64) capture.stats.queue_us;
+    stages["token_wait_us"] = (Json::Int64) capture.stats.token_wait_us;
+    stages["dns_us"] = (Json::Int64) capture.stats.dns_us;
+    stages["connect_us"] = (Json::Int64) capture.stats.connect_us;
+    stages["tls_us"] = (Json::Int64) capture.stats.tls_us;
+    stages["upload_us"] = (Json::Int64) capture.stats.upload_us;
+    stages["think_us"] = (Json::Int64) capture.stats.think_us;
+    stages["download_us"] = (Json::Int64) capture.stats.download_us;
+    stages["parse_us"] = (Json::Int64) capture.stats.parse_us;
+    stages["backend_us"] = (Json::Int64) capture.stats.backend_us;
+    stages["total_us"] = (Json::Int64) capture.stats.total_us;
+    root["stages"] = stages;
+    std::string meta = JsonUtils::parse_to_string(root, true);
+
+    std::ofstream audio_os(audio_path(id).c_str(), std::ofstream::out | std::ofstream::binary);
+    audio_os.write(capture.audio.data(), capture.audio.size());
+    audio_os.close();
+    std::ofstream meta_os(meta_path(id).c_str(), std::ofstream::out);
+    meta_os << meta;
+    meta_os.close();
+    if (!audio_os || !meta_os) {
+        AIP_LOG_WARNING("failed to write slow request %s", id);
+        unlink(audio_path(id).c_str());
+        unlink(meta_path(id).c_str());
+        return;
+    }
+
+    StoredCapture stored;
+    stored.id = id;
+    stored.bytes = capture.audio.size() + meta.size();
+    _stored.push_back(stored);
+    _stored_bytes += stored.bytes;
+    s_slow_request_captured << 1;
+    AIP_LOG_NOTICE("captured %s request %s, total %lld us.", capture.reason.c_str(), id,
+                   (long long) capture.stats.total_us);
+
+    while (_stored_bytes > _max_bytes && !_stored.empty()) {
+        evict_oldest();
+    }
+}
+
+void SlowRequestRecorder::evict_oldest() {
+    const StoredCapture& oldest = _stored.front();
+    unlink(audio_path(oldest.id).c_str());
+    unlink(meta_path(oldest.id).c_str());
+    _stored_bytes -= oldest.bytes;
+    _stored.pop_front();
+}
+
+void SlowRequestRecorder::load_existing_captures() {
+    std::string meta_dir = _dir + "/meta";
+    DIR* dir = opendir(meta_dir.c_str());
+    if (dir == NULL) {
+        return;
+    }
+
+    std::vector<std::string> ids;
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name = entry->d_name;
+        size_t pos = name.rfind(".json");
+        if (pos != std::string::npos && pos + 5 == name.size()) {
+            ids.push_back(name.substr(0, pos));
+        }
+    }
+    closedir(dir);
+
+    // ids start with a zero padded timestamp, so name order is capture order
+    std::sort(ids.begin(), ids.end());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        StoredCapture stored;
+        stored.id = ids[i];
+        stored.bytes = 0;
+        struct stat st;
+        if (stat(audio_path(ids[i]).c_str(), &st) == 0) {
+            stored.bytes += st.st_size;
+        }
+        if (stat(meta_path(ids[i]).c_str(), &st) == 0) {
+            stored.bytes += st.st_size;
+        }
+        _stored.push_back(stored);
+        _stored_bytes += stored.bytes;
+    }
+
+    while (_stored_bytes > _max_bytes && !_stored.empty()) {
+        evict_oldest();
+    }
+}
+
+std::string SlowRequestRecorder::audio_path(const std::string& id) const {
+    return _dir + "/audio/" + id + ".pcm";
+}
+
+std::string SlowRequestRecorder::meta_path(const std::string& id) const {
+    return _dir + "/meta/" + id + ".json";
+}
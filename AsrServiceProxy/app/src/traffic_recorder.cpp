@@ -0,0 +1,252 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <vector>
+#include <aip_log.hpp>
+#include <aip_time.hpp>
+#include <utils.hpp>
+#include <bvar/bvar.h>
+#include "traffic_record.h"
+#include "traffic_recorder.h"
+
+static bvar::Adder<int64_t> s_traffic_recorded("asr_proxy_traffic_recorded");
+static bvar::Adder<int64_t> s_traffic_record_dropped("asr_proxy_traffic_record_dropped");
+
+static const char s_padding[8] = { 0 };
+
+TrafficRecorder::TrafficRecorder() {
+}
+
+TrafficRecorder::~TrafficRecorder() {
+    stop();
+}
+
+bool TrafficRecorder::init(const Config& conf) {
+    _conf = conf;
+    _dir = _conf.get_traffic_record_dir();
+    if (_dir.empty()) {
+        AIP_LOG_NOTICE("traffic recording disabled.");
+        return true;
+    }
+
+    _segment_bytes = _conf.get_traffic_record_segment_mb() * 1024LL * 1024LL;
+    _max_segments = _conf.get_traffic_record_max_segments();
+    if (_segment_bytes <= 0) {
+        AIP_LOG_FATAL("invalid traffic record segment size %d MB",
+                      _conf.get_traffic_record_segment_mb());
+        return false;
+    }
+
+    // every request of this proxy is sent upstream with the same parameters
+    std::stringstream params;
+    params << "format=" << _conf.get_audio_format() << "&rate=16000&dev_pid="
+           << _conf.get_audio_type();
+    _params = params.str();
+
+    mkdir(_dir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH);
+    if (!FileUtil::is_dir(_dir.c_str())) {
+        AIP_LOG_FATAL("failed to create traffic record dir %s", _dir.c_str());
+        return false;
+    }
+
+    load_existing_segments();
+
+    try {
+        _stop = false;
+        _writer_thrd = std::thread(std::bind(&TrafficRecorder::write_loop, this));
+    } catch (std::runtime_error& err) {
+        _stop = true;
+        AIP_LOG_FATAL("TrafficRecorder::write_loop failed: %s", err.what());
+        return false;
+    }
+
+    AIP_LOG_NOTICE("traffic recording: dir %s, segment %d MB, keep %d segments.",
+                   _dir.c_str(), _conf.get_traffic_record_segment_mb(), _max_segments);
+    return true;
+}
+
+void TrafficRecorder::stop() {
+    {
+        std::lock_guard<std::mutex> lc(_mutex);
+        if (_stop) {
+            return;
+        }
+        _stop = true;
+    }
+    _cond.notify_all();
+
+    if (_writer_thrd.joinable()) {
+        _writer_thrd.join();
+    }
+}
+
+void TrafficRecorder::record(const std::string& audio, int64_t arrival_us) {
+    if (_dir.empty()) {
+        return;
+    }
+
+    Record* record = new Record();
+    record->audio = audio;
+    record->arrival_us = arrival_us;
+
+    {
+        std::lock_guard<std::mutex> lc(_mutex);
+        if (_stop || _pending_bytes + (int64_t) audio.size() > max_pending_bytes) {
+            s_traffic_record_dropped << 1;
+            delete record;
+            return;
+        }
+        _pending.push_back(record);
+        _pending_bytes += audio.size();
+    }
+    _cond.notify_one();
+}
+
+void TrafficRecorder::write_loop() {
+    std::deque<Record*> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return _stop || !_pending.empty(); });
+            if (_pending.empty()) {
+                break;
+            }
+            batch.swap(_pending);
+            _pending_bytes = 0;
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            write_record(*batch[i]);
+            delete batch[i];
+        }
+        batch.clear();
+
+        // flush once the queue drains so a live segment can be replayed
+        if (_segment != NULL) {
+            fflush(_segment);
+        }
+    }
+
+    close_segment();
+}
+
+void TrafficRecorder::write_record(const Record& record) {
+    TrafficRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TRAFFIC_RECORD_MAGIC;
+    header.params_len = _params.size();
+    header.audio_len = record.audio.size();
+    header.arrival_us = record.arrival_us;
+    size_t size = traffic_record_size(header.params_len, header.audio_len);
+
+    if (_segment != NULL && _segment_size + (int64_t) size > _segment_bytes) {
+        close_segment();
+    }
+    if (_segment == NULL && !open_segment(record.arrival_us)) {
+        s_traffic_record_dropped << 1;
+        return;
+    }
+
+    size_t padding = size - sizeof(header) - header.params_len - header.audio_len;
+    if (fwrite(&header, sizeof(header), 1, _segment) != 1
+        || fwrite(_params.data(), 1, _params.size(), _segment) != _params.size()
+        || fwrite(record.audio.data(), 1, record.audio.size(), _segment) != record.audio.size()
+        || fwrite(s_padding, 1, padding, _segment) != padding) {
+        AIP_LOG_WARNING("failed to write traffic record: %s", strerror(errno));
+        s_traffic_record_dropped << 1;
+        close_segment();
+        return;
+    }
+
+    _segment_size += size;
+    s_traffic_recorded << 1;
+}
+
+bool TrafficRecorder::open_segment(int64_t now_us) {
+    static unsigned s_seq = 0;
+    char name[64];
+    snprintf(name, sizeof(name), TRAFFIC_SEGMENT_PREFIX "%013lld_%04u" TRAFFIC_SEGMENT_SUFFIX,
+             (long long) (now_us / 1000), s_seq++ % 10000);
+    std::string path = _dir + "/" + name;
+
+    _segment = fopen(path.c_str(), "wb");
+    if (_segment == NULL) {
+        AIP_LOG_WARNING("failed to open traffic segment %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    // large stdio buffer, segments are written sequentially
+    setvbuf(_segment, NULL, _IOFBF, 1024 * 1024);
+
+    TrafficSegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAFFIC_SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = TRAFFIC_SEGMENT_VERSION;
+    header.header_size = sizeof(header);
+    header.create_time_us = now_us;
+    if (fwrite(&header, sizeof(header), 1, _segment) != 1) {
+        AIP_LOG_WARNING("failed to write traffic segment %s", path.c_str());
+        fclose(_segment);
+        _segment = NULL;
+        unlink(path.c_str());
+        return false;
+    }
+
+    _segment_size = sizeof(header);
+    _segments.push_back(name);
+    AIP_LOG_NOTICE("traffic segment %s opened.", path.c_str());
+    remove_old_segments();
+    return true;
+}
+
+void TrafficRecorder::close_segment() {
+    if (_segment != NULL) {
+        fclose(_segment);
+        _segment = NULL;
+        _segment_size = 0;
+    }
+}
+
+void TrafficRecorder::load_existing_segments() {
+    DIR* dir = opendir(_dir.c_str());
+    if (dir == NULL) {
+        return;
+    }
+
+    std::vector<std::string> names;
+    struct dirent* entry = NULL;
+    size_t prefix_len = strlen(TRAFFIC_SEGMENT_PREFIX);
+    size_t suffix_len = strlen(TRAFFIC_SEGMENT_SUFFIX);
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name = entry->d_name;
+        if (name.size() > prefix_len + suffix_len
+            && name.compare(0, prefix_len, TRAFFIC_SEGMENT_PREFIX) == 0
+            && name.compare(name.size() - suffix_len, suffix_len, TRAFFIC_SEGMENT_SUFFIX) == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+
+    // names start with a zero padded timestamp, so name order is creation order
+    std::sort(names.begin(), names.end());
+    _segments.assign(names.begin(), names.end());
+    remove_old_segments();
+}
+
+void TrafficRecorder::remove_old_segments() {
+    if (_max_segments <= 0) {
+        return;
+    }
+    while ((int) _segments.size() > _max_segments) {
+        std::string path = _dir + "/" + _segments.front();
+        unlink(path.c_str());
+        AIP_LOG_NOTICE("traffic segment %s removed.", path.c_str());
+        _segments.pop_front();
+    }
+}
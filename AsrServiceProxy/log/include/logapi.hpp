@@ -20,6 +20,15 @@ extern "C" {
 #endif
 #endif
 
+/* lets the compiler check the arguments of a printf style log call */
+#ifndef LOG_PRINTF_FORMAT
+#ifdef __GNUC__
+#define LOG_PRINTF_FORMAT(fmt_index, args_index) __attribute__((format(printf, fmt_index, args_index)))
+#else
+#define LOG_PRINTF_FORMAT(fmt_index, args_index)
+#endif
+#endif
+
 typedef enum __LogLevel {
     NOT_SET    =    0x00,
     DEBUG     =    0x01,
@@ -31,6 +40,38 @@ typedef enum __LogLevel {
     NOTIFY    =    0x40,
 } LogLevel;
 
+/*
+ * one log line as handed to a batch receiver, valid during the call only
+ */
+typedef struct {
+    LogLevel _level;
+    const char* _module;
+    const char* _title;
+    const char* _log;
+    size_t _log_len;
+    unsigned long _thrd_id;
+    long long _time_us;         /* wall clock of the log call */
+    const char* _ctx;           /* request fields "key=value key=value", 0 if none */
+    size_t _ctx_len;
+} log_record_t;
+
+/*
+ * returns the fields of the request the calling thread serves, as
+ * "key=value key=value" without spaces in the values, or 0 outside of a
+ * request; *len is the length. Called on every text log, so it has to be
+ * cheap, e.g. a look into bthread-local storage.
+ */
+typedef const char* (LOGAPI* log_context_callback_t)(size_t* len);
+
+/*
+ * how the file and mmap sinks write a line: the default log4cpp layout
+ * with the request fields after the text, or one JSON object per line
+ */
+typedef enum __LogLineFormat {
+    LOG_FORMAT_TEXT           =    0,
+    LOG_FORMAT_JSON           =    1,
+} LogLineFormat;
+
 typedef struct {
     typedef int (LOGAPI* receive_log_callback_t)(LogLevel level, const char* module,
                                          const char* log_title,
@@ -39,10 +80,76 @@ typedef struct {
 
     void* _usr_data;
 
+    /*
+     * optional, when set the dispatcher hands over all records of one
+     * wakeup at once instead of calling _receive_log for each
+     */
+    typedef int (LOGAPI* receive_batch_callback_t)(const log_record_t* records, size_t count,
+                                                   void* usr_data);
+    receive_batch_callback_t _receive_batch;
+
+    /*
+     * optional, called when the queue runs empty (force 0) and when the
+     * dispatcher stops (force 1), returns the ms until buffered output is
+     * due or -1 if nothing is buffered
+     */
+    typedef long (LOGAPI* flush_callback_t)(int force, void* usr_data);
+    flush_callback_t _flush;
+
 } log_receiver_t;
 
 typedef void (*log_callback_t)(LogLevel, const char*);
 
+/*
+ * longest formatted log line, log_log and friends truncate beyond it
+ */
+#define LOG_MAX_LINE 4096
+
+/*
+ * what append_log does when a dispatcher queue is full
+ */
+typedef enum __LogOverflowPolicy {
+    LOG_OVERFLOW_BLOCK        =    0,   /* wait up to the block timeout, then drop */
+    LOG_OVERFLOW_DROP_NEWEST  =    1,   /* drop the log that does not fit */
+    LOG_OVERFLOW_DROP_LOW     =    2,   /* drop DEBUG/INFO once the queue is 3/4 full, then drop newest */
+    LOG_OVERFLOW_SPILL        =    3,   /* move to a bounded secondary buffer, drop when that is full */
+} LogOverflowPolicy;
+
+typedef struct {
+    unsigned long long _dropped;          /* all logs dropped on overflow */
+    unsigned long long _dropped_low;      /* DEBUG/INFO dropped early by LOG_OVERFLOW_DROP_LOW */
+    unsigned long long _block_timeouts;   /* LOG_OVERFLOW_BLOCK waits that ended in a drop */
+    unsigned long long _spilled;          /* logs that went through the secondary buffer */
+} log_overflow_stats_t;
+
+typedef struct {
+    unsigned long long _records;          /* lines written by the mmap sink */
+    unsigned long long _bytes;
+    unsigned long long _rotations;        /* segments swapped in */
+    unsigned long long _sync_segments;    /* made by the dispatcher, the background thread was late */
+    unsigned long long _dropped;          /* lines lost while no segment could be made */
+} log_mmap_sink_stats_t;
+
+typedef struct {
+    unsigned long long _files;            /* segments compressed */
+    unsigned long long _bytes_in;
+    unsigned long long _bytes_out;
+    unsigned long long _removed;          /* archives removed to stay under the byte budget */
+    unsigned long long _errors;
+} log_archive_stats_t;
+
+typedef struct {
+    unsigned long long _suppressed;       /* lines over the rate limit of their call site */
+    unsigned long long _folded;           /* repeated lines folded into a summary */
+} log_rate_stats_t;
+
+typedef struct {
+    unsigned long long _records;          /* lines written by the native file sink */
+    unsigned long long _bytes;
+    unsigned long long _writes;           /* writev calls */
+    unsigned long long _write_errors;
+} log_file_sink_stats_t;
+
 /************************************************************************/
 /* API _declaration                                                      */
 /************************************************************************/
@@ -57,25 +164,135 @@ int LOGAPI is_log_level_enabled(LogLevel level);
 
 log_callback_t LOGAPI log_set_callback(log_callback_t);
 
+/*
+ * waits up to timeout_ms until everything logged so far reached the receivers
+ */
+void LOGAPI log_flush(int timeout_ms);
+
+LogOverflowPolicy LOGAPI log_set_overflow_policy(LogOverflowPolicy policy, int block_timeout_us);
+
+LogOverflowPolicy LOGAPI log_get_overflow_policy();
+
+void LOGAPI log_get_overflow_stats(log_overflow_stats_t* stats);
+
+/*
+ * attaches the fields the callback returns to every text log, 0 turns it
+ * off. Returns the previous callback.
+ */
+log_context_callback_t LOGAPI log_set_context_callback(log_context_callback_t callback);
+
+LogLineFormat LOGAPI log_set_line_format(LogLineFormat format);
+
+/*
+ * storm control per call site, see lograte.hpp. Each call site passes at
+ * most lines_per_window lines of the given levels (a mask of LogLevel)
+ * per window, 0 lifts the limit. With fold_duplicates a line equal to the
+ * previous one of its call site is counted instead and reported as
+ * "message repeated N times in T ms". Both are off by default, FATAL and
+ * NOTIFY are never limited.
+ */
+void LOGAPI log_set_rate_limit(int levels, int lines_per_window);
+
+void LOGAPI log_set_rate_window(int window_ms, int fold_duplicates);
+
+void LOGAPI log_get_rate_stats(log_rate_stats_t* stats);
+
+/*
+ * the same check for log paths that do not format through log_log, e.g.
+ * binary logging: 0 if the line from site has to be dropped. text may be
+ * 0 to apply the rate limit only.
+ */
+int LOGAPI log_rate_admit(LogLevel level, const void* site, const char* module,
+                          const char* log_title, const void* text, size_t len);
+
+/*
+ * native file sink, a batch receiver that formats each wakeup's records
+ * like the default log4cpp layout and writes them with one writev once
+ * flush_bytes are buffered or the oldest buffered line is flush_ms old
+ */
+int LOGAPI log_file_sink_open(const char* path, int flush_bytes, int flush_ms);
+
+void LOGAPI log_file_sink_close();
+
+void LOGAPI log_get_file_sink_stats(log_file_sink_stats_t* stats);
+
+/*
+ * rolling file sink writing into memory mapped segments of segment_mb,
+ * see logmmapsink.hpp. A full segment, or with daily one from the day
+ * before, is renamed to path.<yyyymmdd-hhmmss> in the background.
+ */
+int LOGAPI log_mmap_sink_open(const char* path, int segment_mb, int daily);
+
+void LOGAPI log_mmap_sink_close();
+
+void LOGAPI log_get_mmap_sink_stats(log_mmap_sink_stats_t* stats);
+
+/*
+ * gzips the rotated segments path.<yyyymmdd-hhmmss> of the mmap sink on a
+ * low priority thread reading at most rate_kb per second (0 unlimited),
+ * and removes the oldest archives once they take more than keep_mb (0
+ * keeps all). level is the zlib level, see logarchive.hpp.
+ */
+int LOGAPI log_archive_open(const char* path, int level, int rate_kb, int keep_mb);
+
+void LOGAPI log_archive_close();
+
+void LOGAPI log_get_archive_stats(log_archive_stats_t* stats);
+
+/*
+ * on SIGSEGV, SIGBUS and SIGABRT flushes what the file sinks buffered and
+ * writes the logs still queued and the stack to path before the process
+ * goes down, see logcrash.hpp. Returns 1 if the handlers are installed.
+ */
+int LOGAPI log_crash_handler_install(const char* path);
+
+void LOGAPI log_crash_handler_uninstall();
+
+/*
+ * deferred binary logging into path, see logbinary.hpp. While it is open
+ * is_log_binary() is 1 and the AIP_LOG_* macros queue format ids and raw
+ * arguments instead of text. flush_bytes and flush_ms as for the file sink.
+ */
+int LOGAPI log_binary_open(const char* path, int flush_bytes, int flush_ms);
+
+void LOGAPI log_binary_close();
+
+int LOGAPI is_log_binary();
+
+/*
+ * returns the id of a new format for one call site, the strings are copied
+ */
+unsigned int LOGAPI log_binary_register(LogLevel level, const char* module, const char* log_title,
+                                        const char* file, int line, const char* fmt);
+
+void LOGAPI log_binary_append(LogLevel level, unsigned int fmt_id, const void* args, size_t len);
+
 void LOGAPI log_log(LogLevel level, const char* module, const char* log_title,
-                     const char* log, ...);
+                     const char* log, ...) LOG_PRINTF_FORMAT(4, 5);
 
 /************************************************************************/
 /* _wrapper for _log_log                                                   */
 /************************************************************************/
-void LOGAPI log_debug(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_debug(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
-void LOGAPI log_info(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_info(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
-void LOGAPI log_notice(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_notice(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
-void LOGAPI log_warning(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_warning(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
-void LOGAPI log_error(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_error(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
-void LOGAPI log_fatal(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_fatal(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
-void LOGAPI log_notify(const char* module, const char* log_title, const char* log, ...);
+void LOGAPI log_notify(const char* module, const char* log_title, const char* log, ...)
+    LOG_PRINTF_FORMAT(3, 4);
 
 int LOGAPI register_log_receiver(log_receiver_t* receiver, const char* title,
                                   int dedicated_thread);
@@ -0,0 +1,67 @@
+#ifndef LOG_LOGARCHIVE_HPP
+#define LOG_LOGARCHIVE_HPP
+
+#include "logapi.hpp"
+#include <critsec.hpp>
+#include <event.hpp>
+#include <pthread.h>
+#include <deque>
+#include <string>
+
+/*
+ * Compresses rotated log segments to gzip on one background thread and
+ * keeps the compressed ones under a byte budget, oldest removed first.
+ * The thread runs at the lowest CPU and idle I/O priority and reads at
+ * most rate_kb per second, so it neither takes CPU from request threads
+ * nor competes with log shipping for the disk. A file is written to
+ * <segment>.gz.tmp and renamed once complete, the segment is removed
+ * after that; work cut short by close is picked up by the next open.
+ */
+class CLogArchiver {
+public:
+    CLogArchiver();
+    virtual ~CLogArchiver();
+
+public:
+    // path is the log file whose rotated segments path.* are archived
+    int open(const char* path, int level, int rate_kb, long long keep_bytes);
+    void close();
+
+    // queues a rotated segment with the open archiver, if there is one
+    static void add(const std::string& segment);
+
+private:
+    CLogArchiver(const CLogArchiver&);
+    CLogArchiver& operator=(const CLogArchiver&);
+
+    static void* archive_thrd(void* param);
+
+    void run();
+
+    // what earlier runs left: segments not compressed yet and stale temporaries
+    void scan();
+
+    // 0 if it failed or was cut short by close
+    int compress(const std::string& segment);
+    void enforce_retention();
+
+    // sleeps while the bytes read so far are ahead of the rate, 0 once closing
+    int throttle(long long start_ms, long long bytes);
+
+private:
+    std::string _path;
+    std::string _dir;
+    std::string _prefix;            // file name of _path plus the dot
+    int _n_level;
+    long long _n_rate_bytes;        // per second, 0 is unlimited
+    long long _n_keep_bytes;
+
+    CCritSec _lock;
+    CEvent _ev_work;
+    std::deque<std::string> _queue;
+    int _b_quit;
+    pthread_t _p_thread;
+    int _b_thread;
+};
+
+#endif // LOG_LOGARCHIVE_HPP
@@ -0,0 +1,166 @@
+#ifndef LOG_LOGBINARY_HPP
+#define LOG_LOGBINARY_HPP
+
+#include "logapi.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/*
+ * Deferred binary logging. A call site registers its format once, after
+ * that a log call only queues the format id and the raw arguments, the
+ * text is produced offline by logdecode. The file starts with a
+ * LogBinaryFileHeader followed by frames, each a LogBinaryFrame and its
+ * body. A format frame is written before the first record using it, so
+ * every file decodes on its own.
+ */
+#define LOG_BINARY_MAGIC "AIPBLOG1"
+#define LOG_BINARY_VERSION 1
+
+// argument bytes of one record, longer strings are cut to fit
+#define LOG_BINARY_MAX_ARGS 1024
+
+// strings of a format frame are cut to this
+#define LOG_BINARY_MAX_STRING 512
+
+enum LogBinaryFrameType {
+    LOG_BINARY_FORMAT = 1,      // u32 id, u32 line, file, module, title, format as u16 length + bytes
+    LOG_BINARY_RECORD = 2,      // u32 id, u64 thread id, i64 time us, the arguments
+};
+
+enum LogBinaryArgType {
+    LOG_BINARY_ARG_INT = 1,     // i64
+    LOG_BINARY_ARG_UINT = 2,    // u64
+    LOG_BINARY_ARG_DOUBLE = 3,  // double
+    LOG_BINARY_ARG_STRING = 4,  // u16 length + bytes
+    LOG_BINARY_ARG_POINTER = 5, // u64
+};
+
+struct LogBinaryFileHeader {
+    char _magic[8];
+    uint32_t _version;
+    uint32_t _reserved;
+};
+
+struct LogBinaryFrame {
+    uint8_t _type;
+    uint8_t _level;
+    uint16_t _reserved;
+    uint32_t _size;             // of the body that follows
+};
+
+/*
+ * the arguments of one call, tagged with their type so the decoder does
+ * not depend on the format string being right
+ */
+class CLogBinaryArgs {
+public:
+    CLogBinaryArgs() : _len(0) {}
+
+    const char* data() const { return _buf; }
+    size_t size() const { return _len; }
+
+    void put(bool v) { put_int(v); }
+    void put(char v) { put_int(v); }
+    void put(signed char v) { put_int(v); }
+    void put(unsigned char v) { put_uint(v); }
+    void put(short v) { put_int(v); }
+    void put(unsigned short v) { put_uint(v); }
+    void put(int v) { put_int(v); }
+    void put(unsigned int v) { put_uint(v); }
+    void put(long v) { put_int(v); }
+    void put(unsigned long v) { put_uint(v); }
+    void put(long long v) { put_int(v); }
+    void put(unsigned long long v) { put_uint(v); }
+    void put(float v) { put_double(v); }
+    void put(double v) { put_double(v); }
+    void put(long double v) { put_double((double) v); }
+    void put(const char* v) { put_string(v); }
+    void put(char* v) { put_string(v); }
+
+    template <typename T>
+    void put(T* v) {
+        put_value(LOG_BINARY_ARG_POINTER, (uint64_t) (uintptr_t) v);
+    }
+
+private:
+    void put_int(long long v) { put_value(LOG_BINARY_ARG_INT, v); }
+    void put_uint(unsigned long long v) { put_value(LOG_BINARY_ARG_UINT, v); }
+    void put_double(double v) { put_value(LOG_BINARY_ARG_DOUBLE, v); }
+
+    template <typename T>
+    void put_value(uint8_t type, T v) {
+        if (_len + 1 + sizeof(v) > sizeof(_buf)) {
+            return;
+        }
+
+        _buf[_len++] = type;
+        memcpy(_buf + _len, &v, sizeof(v));
+        _len += sizeof(v);
+    }
+
+    void put_string(const char* v) {
+        if (_len + 3 > sizeof(_buf)) {
+            return;
+        }
+
+        size_t len = v ? strlen(v) : 0;
+
+        if (len > sizeof(_buf) - _len - 3) {
+            len = sizeof(_buf) - _len - 3;
+        }
+
+        uint16_t n = (uint16_t) len;
+        _buf[_len++] = LOG_BINARY_ARG_STRING;
+        memcpy(_buf + _len, &n, sizeof(n));
+        _len += sizeof(n);
+        memcpy(_buf + _len, v, len);
+        _len += len;
+    }
+
+private:
+    char _buf[LOG_BINARY_MAX_ARGS];
+    size_t _len;
+};
+
+inline void log_binary_encode(CLogBinaryArgs&) {
+}
+
+template <typename T, typename... Rest>
+inline void log_binary_encode(CLogBinaryArgs& args, T v, Rest... rest) {
+    args.put(v);
+    log_binary_encode(args, rest...);
+}
+
+/*
+ * one binary log call, site holds the id of the call site's format, 0
+ * until the first call registers it
+ */
+template <typename... Args>
+inline void log_binary(LogLevel level, std::atomic<unsigned int>* site, const char* module,
+                       const char* log_title, const char* file, int line, const char* fmt,
+                       Args... args) {
+    if (!is_log_level_enabled(level)) {
+        return;
+    }
+
+    unsigned int id = site->load(std::memory_order_acquire);
+
+    if (id == 0) {
+        // two threads may both register, the site then just keeps the later id
+        id = log_binary_register(level, module, log_title, file, line, fmt);
+        site->store(id, std::memory_order_release);
+    }
+
+    CLogBinaryArgs encoded;
+    log_binary_encode(encoded, args...);
+
+    // the same arguments at the same site are a repeated line
+    if (!log_rate_admit(level, fmt, module, log_title, encoded.data(), encoded.size())) {
+        return;
+    }
+
+    log_binary_append(level, id, encoded.data(), encoded.size());
+}
+
+#endif // LOG_LOGBINARY_HPP
@@ -0,0 +1,35 @@
+#ifndef LOG_LOGCRASH_HPP
+#define LOG_LOGCRASH_HPP
+
+#include "logapi.hpp"
+#include <signal.h>
+
+class LogItem;
+
+/*
+ * Last words on SIGSEGV, SIGBUS and SIGABRT. The handler writes what the
+ * file sinks buffered to their files, then every log still queued at a
+ * dispatcher and the stack of the crashing thread to the crash file, and
+ * hands the signal on to the handler installed before, or the default
+ * action. It only calls open(), read() and write() on memory set aside
+ * by install: naming the frames needs dladdr and the heap, whose locks a
+ * heap corruption or abort() may hold, so the stack goes out as raw
+ * addresses followed by the executable mappings of /proc/self/maps, for
+ * addr2line to resolve offline. Logging itself does not change.
+ *
+ * The alternate stack a stack overflow needs is set up for the thread
+ * that installs the handler only.
+ */
+class CLogCrashHandler {
+public:
+    static int install(const char* path);
+    static void uninstall();
+
+private:
+    static void on_signal(int sig, siginfo_t* info, void* ctx);
+    static void write_queued(const LogItem* li, void* arg);
+    static void write_stack();
+    static void write_maps();
+};
+
+#endif // LOG_LOGCRASH_HPP
@@ -0,0 +1,41 @@
+#ifndef LOG_LOGEPOCH_HPP
+#define LOG_LOGEPOCH_HPP
+
+/*
+ * Epoch based reclamation for the receiver registry. Readers bracket the
+ * use of a published snapshot with CLogEpochGuard, which only stores the
+ * current epoch in a per thread record. A writer swaps the snapshot and
+ * then either retires the old one, freed once every reader that could
+ * have seen it has left, or calls synchronize() when it has to know that
+ * nobody uses it any more, e.g. before the owner of a receiver frees it.
+ */
+class CLogEpoch {
+public:
+    static void enter();
+    static void leave();
+
+    /*
+     * waits until the readers inside a guard when it was called have left.
+     * The calling thread's own guard is not waited for.
+     */
+    static void synchronize();
+
+    // deleter(p) runs once no reader can still see p, the caller's guard included
+    static void retire(void* p, void (*deleter)(void*));
+};
+
+class CLogEpochGuard {
+public:
+    CLogEpochGuard() {
+        CLogEpoch::enter();
+    }
+    ~CLogEpochGuard() {
+        CLogEpoch::leave();
+    }
+
+private:
+    CLogEpochGuard(const CLogEpochGuard&);
+    CLogEpochGuard& operator=(const CLogEpochGuard&);
+};
+
+#endif // LOG_LOGEPOCH_HPP
@@ -0,0 +1,86 @@
+#ifndef LOG_LOGFILESINK_HPP
+#define LOG_LOGFILESINK_HPP
+
+#include "logapi.hpp"
+#include <vector>
+
+/*
+ * the longest record a sink formats, a chunk with less room left is
+ * handed to the next writev as it is
+ */
+#define LOG_SINK_LINE_MAX (LOG_MAX_LINE + 512)
+
+/*
+ * Writes logs to a file without log4cpp. It registers as a batch receiver,
+ * formats each wakeup's records straight into 64k chunks and hands all
+ * full chunks to a single writev, so a burst costs one syscall per
+ * flush_bytes instead of one per line. Lines are written once flush_bytes
+ * are buffered, the oldest is flush_ms old, or log_flush() is called.
+ */
+class CLogFileSink {
+public:
+    CLogFileSink();
+    virtual ~CLogFileSink();
+
+public:
+    int open(const char* path, size_t flush_bytes, int flush_ms);
+    void close();
+
+    /*
+     * for the crash handler: writes what the open sinks buffered with
+     * plain write() calls, leaving the buffers as they are
+     */
+    static void crash_write_all();
+
+protected:
+    /*
+     * hooks for sinks with another file layout: on_open runs before the
+     * first record, format_record writes one record into buf, cap is
+     * always at least LOG_SINK_LINE_MAX
+     */
+    virtual int on_open();
+    virtual size_t format_record(char* buf, size_t cap, const log_record_t* rec);
+
+    // which dispatcher feeds the sink
+    virtual int attach();
+    virtual void detach();
+
+protected:
+    int _fd;
+    log_receiver_t _receiver;
+
+private:
+    CLogFileSink(const CLogFileSink&);
+    CLogFileSink& operator=(const CLogFileSink&);
+
+    static int LOGAPI receive_batch_thunk(const log_record_t* records, size_t count,
+                                          void* usr_data);
+    static long LOGAPI flush_thunk(int force, void* usr_data);
+
+    void on_receive_batch(const log_record_t* records, size_t count);
+    long on_flush(int force);
+
+    // room for one more line, a new chunk if the current one is too full
+    struct Chunk;
+    Chunk* writable_chunk();
+    void write_pending();
+    void crash_write();
+
+private:
+    struct Chunk {
+        size_t _len;
+        char _data[64 << 10];
+    };
+
+    int _b_registered;
+
+    size_t _flush_bytes;
+    int _flush_ms;
+
+    std::vector<Chunk*> _chunks;
+    std::vector<Chunk*> _free_chunks;
+    size_t _pending_bytes;
+    long long _pending_since_ms;
+};
+
+#endif // LOG_LOGFILESINK_HPP
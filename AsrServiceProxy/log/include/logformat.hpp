@@ -0,0 +1,35 @@
+#ifndef LOG_LOGFORMAT_HPP
+#define LOG_LOGFORMAT_HPP
+
+#include "logapi.hpp"
+
+/*
+ * names as log4cpp prints them for the levels the log4cpp receiver maps to
+ */
+const char* log_level_name(LogLevel level);
+
+/*
+ * the text of one log as receivers print it: thread id, module and title,
+ * each padded to a multiple of 4, then the log itself. Truncated to fit
+ * cap including the terminating 0, returns the length.
+ */
+size_t log_format_body(char* buf, size_t cap, unsigned long thrd_id, const char* module,
+                       const char* title, const char* log);
+
+/*
+ * a whole line in the default log4cpp layout "%d\t[%t]\t%p\t%m%n", for
+ * sinks that bypass log4cpp, the request fields follow the text after a
+ * tab. Returns the length, the newline included.
+ */
+size_t log_format_line(char* buf, size_t cap, const log_record_t* rec);
+
+/*
+ * the same as one JSON object: time, thread, level, module, title, msg
+ * and the request fields as string members
+ */
+size_t log_format_json(char* buf, size_t cap, const log_record_t* rec);
+
+// one of the two, as log_set_line_format() chose
+size_t log_format_record(char* buf, size_t cap, const log_record_t* rec);
+
+#endif // LOG_LOGFORMAT_HPP
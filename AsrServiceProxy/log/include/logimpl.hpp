@@ -2,6 +2,10 @@
 #define LOG_LOGIMPL_HPP
 
 #include "logapi.hpp"
+#include "logqueue.hpp"
+#include "logpool.hpp"
+#include "logroute.hpp"
+#include "logepoch.hpp"
 #include <semaphore.hpp>
 #include <event.hpp>
 #include <critsec.hpp>
@@ -9,24 +13,41 @@
 #include "process.h"
 #endif
 #include <regex.h>
+#include <deque>
 #include <string>
 #include <vector>
 #include <atomic>
 
+/*
+ * one log record, allocated by CLogItemPool with the message stored right
+ * behind the item
+ */
 class LogItem {
+    friend class CLogItemPool;
+    friend struct LogItemCache;
 public:
-    LogItem();
+    LogItem(int size_class, size_t capacity);
 public:
     LogLevel _e_level;
-    std::string _str_module;
-    std::string _str_title;
-    std::string _str_log;
+    const char* _module;        // interned by CLogStrings
+    const char* _title;         // interned by CLogStrings
+    char* _log;
+    size_t _n_log_len;
+    const char* _ctx;           // request fields behind the text, 0 if none
+    size_t _n_ctx_len;
     long _n_thrd_id;
+    long long _n_time_us;
+    long long _n_mono_us;       // orders the items of all producers
 private:
     std::atomic_int _n_ref;
+    int _n_size_class;          // -1 for a one-off heap item
+    size_t _n_capacity;
+    LogItem* _next;             // free list link while pooled
 public:
     void add_ref();
     void release();
+
+    size_t capacity() const { return _n_capacity; }
 };
 
 class LogReceiver {
@@ -40,10 +61,32 @@ public:
 
     std::string _str_title;
     regex_t _re_title;
+    // "*" takes every title, it is no valid regex
+    int _b_match_all;
+    int _b_re_valid;
+
+    // records of the current wakeup for a batch receiver
+    std::vector<log_record_t> _batch;
 public:
     int match(LogItem* lit);
 };
 
+/*
+ * the receivers of a thread as published, never changed afterwards:
+ * registering copies the set, changes the copy and swaps it in. Read
+ * under a CLogEpochGuard only.
+ */
+struct LogReceiverSet {
+    std::vector<LogReceiver*> _recvs;
+};
+
+/*
+ * the producer rings of a dispatcher, published the same way
+ */
+struct LogRingSet {
+    std::vector<CLogRing*> _rings;
+};
+
 class CLogThread {
 public:
     CLogThread();
@@ -61,7 +104,9 @@ public:
     int match(LogItem* li);
 private:
     CCritSec _lock_logs;
+    // serializes writers of _recv_set
     CCritSec _lock_recvs;
+    // serializes receiver calls made inline while no dispatcher runs
     CCritSec _lock_disp;
     CSemaphore _log_sync;
     CEvent _ev_quit;
@@ -83,12 +128,134 @@ protected:
 
     void do_dispatch(LogItem* item);
 
+    /*
+     * pops one batch into _inflight and delivers it, 0 if there was nothing
+     */
+    size_t dispatch_batch();
+
+    // the current receivers, only under a CLogEpochGuard
+    LogReceiverSet* receivers() const {
+        return _recv_set.load(std::memory_order_seq_cst);
+    }
+
+public:
+    /*
+     * waits until the logs queued so far are delivered, so a receiver can
+     * be removed without losing them
+     */
+    virtual void flush(long timeout_ms);
+
+    /*
+     * waits until the urgent lane is delivered and the receivers flushed,
+     * what a FATAL log does, without waiting for the other lanes
+     */
+    void flush_urgent(long timeout_ms);
+
+    /*
+     * any thread, for the crash handler: calls fn on every log queued and
+     * not delivered yet, without locks, see CLogQueue::visit
+     */
+    virtual void visit_queued(void (*fn)(const LogItem* li, void* arg), void* arg);
+protected:
+    void wait_flushed(long long deadline_ms);
+
+    /*
+     * takes the urgent lane first, then merges the producer rings, the
+     * shared queue and the spill buffer by _n_mono_us, so logs of all
+     * threads come out in order within their lane
+     */
+    size_t pop_batch(LogItem** items, size_t max_items);
+
+    /*
+     * 1 if li was queued, 0 if the overflow policy dropped it
+     */
+    int enqueue(LogItem* li);
+    int push_blocking(CLogRing* ring, LogItem* li);
+    int spill(LogItem* li);
+    void wake_dispatcher();
+
+    /*
+     * the calling thread's ring, made on its first log, 0 if the thread
+     * has no room for another ring and has to use the shared queue
+     */
+    CLogRing* producer_ring();
+    int push(CLogRing* ring, LogItem* li) {
+        return ring ? ring->push(li) : _logs.push(li);
+    }
+
+    // nothing queued in any lane, ring, the shared queue or the spill buffer
+    int queues_empty();
+
+    // dispatcher only, drops the rings of exited producers once drained
+    void reclaim_rings(const LogRingSet* set);
+
+    // dispatcher only, the next spilled item, moved out of _spill in bulk
+    LogItem* spill_peek();
+
     int call_receiver(LogReceiver* recv, LogItem* item);
+    void call_batch_receiver(LogReceiver* recv);
+
+    /*
+     * runs the _flush hooks, dispatcher thread only, returns the ms until
+     * the earliest one wants to be called again, -1 if none does
+     */
+    long flush_receivers(int force);
 
 protected:
-    std::vector<LogItem*> _logs;
-    std::vector<LogReceiver*> _log_receivers;
+    // producers without a ring of their own
+    CLogQueue _logs;
+    // ERROR and FATAL of all producers, delivered before the others
+    CLogQueue _urgent;
+    // dispatcher only, the last batch was full before the urgent lane ran empty
+    int _b_urgent_left;
+    std::atomic<LogReceiverSet*> _recv_set;
+
+    // serializes writers of _ring_set
+    CCritSec _lock_rings;
+    std::atomic<LogRingSet*> _ring_set;
+    // tells this dispatcher's rings apart in the producers' ring caches
+    unsigned long _n_id;
+
+    /*
+     * dispatcher only: the oldest item of each source for the merge, and
+     * spilled items taken out of _spill but not delivered yet
+     */
+    struct MergeHead {
+        long long _mono_us;
+        size_t _source;
+        LogItem* _item;
+    };
+    std::vector<MergeHead> _merge;
+    std::vector<LogItem*> _spill_taken;
+    size_t _n_spill_taken_pos;
+
+    /*
+     * the batch in delivery, items [_n_inflight_next, _n_inflight_count)
+     * have not reached every receiver yet; kept for the crash handler
+     */
+    std::vector<LogItem*> _inflight;
+    std::atomic<size_t> _n_inflight_next;
+    std::atomic<size_t> _n_inflight_count;
+
+    /*
+     * flush() asks the dispatcher to force the receivers' buffered output
+     * out once it is done with the batch in hand and the urgent lane is
+     * empty, the dispatcher then copies _n_flush_req to _n_flush_done
+     */
+    std::atomic<unsigned int> _n_flush_req;
+    std::atomic<unsigned int> _n_flush_done;
     std::atomic_int _n_thrd_started;
+    /*
+     * set while the dispatcher is about to sleep on _log_sync, producers
+     * only signal the semaphore then
+     */
+    std::atomic_int _n_waiting;
+
+    CCritSec _lock_spill;
+    std::deque<LogItem*> _spill;
+    size_t _spill_bytes;
+    // spilled and not yet delivered, _spill_taken included
+    std::atomic_int _n_spilled;
 };
 
 class CLogImpl : public CLogThread {
@@ -102,21 +269,59 @@ public:
     static CLogImpl* instance(int create = 1);
     static void release();
 
+public:
+    /*
+     * the dedicated threads as published, swapped like LogReceiverSet, so
+     * producers fan out without a lock. _lock_thrds serializes writers.
+     */
+    struct LogThreadSet {
+        std::vector<CLogThread*> _thrds;
+        unsigned int _n_route_gen;
+    };
+
 protected:
     CCritSec _lock_thrds;
-    std::vector<CLogThread*> _thrds;
+    std::atomic<LogThreadSet*> _thrd_set;
+
+    /*
+     * which dedicated threads take a title, bit i for _thrds[i] of the set
+     * with the generation in the top bits. Every new set has a new
+     * generation, so older routes no longer match and are redone on use.
+     */
+    CLogTitleMap _routes;
+
+    /*
+     * carries binary records to the binary sink only, kept until the end
+     * once created so a late producer never sees it go away
+     */
+    CLogThread* _binary_thrd;
 
 public:
     void append_log(LogLevel level, const char* module, const char* log_title,
                      const char* log);
 
+    // the record is fmt_id followed by the encoded arguments
+    void append_binary(LogLevel level, unsigned int fmt_id, const void* args, size_t len);
+    int register_binary_receiver(log_receiver_t* recv);
+    int unregister_binary_receiver(log_receiver_t* recv);
+
     int register_receiver(log_receiver_t* recv, const char* title, int b_dedicated_thread);
     virtual int unregister_receiver(log_receiver_t* recv);
     
     virtual int stop();
+    virtual void flush(long timeout_ms);
+
+    // the dedicated threads' logs, then the shared thread's, binary records are not text
+    virtual void visit_queued(void (*fn)(const LogItem* li, void* arg), void* arg);
 protected:
     virtual int register_receiver(LogReceiver* lr);
     virtual void append_log(LogItem* li);
+
+    // the dedicated threads of set whose receivers match li's title, as a bit set
+    uint64_t route(const LogThreadSet* set, LogItem* li);
+
+    // publishes set in place of the current one, which is returned
+    LogThreadSet* swap_threads(LogThreadSet* set);
 };
 
 #endif // LOG_LOGIMPL_HPP
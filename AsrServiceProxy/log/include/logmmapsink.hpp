@@ -0,0 +1,96 @@
+#ifndef LOG_LOGMMAPSINK_HPP
+#define LOG_LOGMMAPSINK_HPP
+
+#include "logapi.hpp"
+#include <critsec.hpp>
+#include <event.hpp>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/*
+ * Rolling log file written through memory mapped segments. Each segment
+ * is a file pre-sized with fallocate and mapped before it is needed, the
+ * dispatcher formats lines straight into the mapping and, once the
+ * segment is full or the day changed, swaps in the next one. Everything
+ * that touches the file system - allocating and mapping the next segment,
+ * truncating the full one to its length and renaming it to
+ * <path>.<yyyymmdd-hhmmss> - runs on a background thread, so the
+ * dispatcher does not wait for the disk. The segment being written is
+ * <path>, at its full size until it is rotated or the sink closes.
+ * Rotated segments go to the CLogArchiver, if one is open.
+ */
+class CLogMmapSink {
+public:
+    CLogMmapSink();
+    virtual ~CLogMmapSink();
+
+public:
+    int open(const char* path, size_t segment_bytes, int daily);
+    void close();
+
+protected:
+    struct Segment {
+        int _fd;
+        char* _base;
+        size_t _size;
+        size_t _len;
+        long long _start_s;         // wall clock the segment became current
+        long long _day_end_us;      // next local midnight after _start_s
+        std::string _file;          // where it is now, background thread only
+    };
+
+private:
+    CLogMmapSink(const CLogMmapSink&);
+    CLogMmapSink& operator=(const CLogMmapSink&);
+
+    static int LOGAPI receive_batch_thunk(const log_record_t* records, size_t count,
+                                          void* usr_data);
+    static void* background_thrd(void* param);
+
+    void on_receive_batch(const log_record_t* records, size_t count);
+
+    // the current segment with room for one more line, 0 if there is none
+    Segment* writable_segment(long long time_us);
+    void activate(Segment* seg);
+
+    // a new mapped segment under a temporary name, 0 if the disk is full
+    Segment* make_segment();
+    void unmap(Segment* seg);
+    void retire(Segment* seg);
+    void promote(Segment* seg);
+    std::string archive_name(long long start_s);
+    void background();
+
+private:
+    std::string _path;
+    size_t _segment_bytes;
+    int _b_daily;
+
+    log_receiver_t _receiver;
+    int _b_registered;
+
+    // dispatcher only
+    Segment* _cur;
+    long long _n_retry_ms;
+
+    /*
+     * shared with the background thread: the next segment once it is
+     * ready, and the file work of swaps, done in order
+     */
+    struct Job {
+        int _b_retire;              // else promote, rename it to _path
+        Segment* _seg;
+    };
+
+    CCritSec _lock;
+    CEvent _ev_work;
+    Segment* _next;
+    std::vector<Job> _jobs;
+    unsigned int _n_seq;
+    int _b_quit;
+    pthread_t _p_thread;
+    int _b_thread;
+};
+
+#endif // LOG_LOGMMAPSINK_HPP
@@ -0,0 +1,39 @@
+#ifndef LOG_LOGPOOL_HPP
+#define LOG_LOGPOOL_HPP
+
+#include <stddef.h>
+
+class LogItem;
+
+/*
+ * Recycles log items so a log call does not touch the heap once the pool is
+ * warm. Items come in two size classes with the message stored inline;
+ * longer messages get a one-off heap item. Each thread keeps a small free
+ * list of its own and trades whole batches with a shared depot, so the
+ * depot lock is taken once per batch, not per log.
+ */
+class CLogItemPool {
+public:
+    // an item with room for len bytes of message plus the terminating 0, ref count 1
+    static LogItem* alloc(size_t len);
+    static void free(LogItem* li);
+
+    /*
+     * puts up to count items for messages of len bytes into the depot, so a
+     * burst after startup does not have to go to the heap either
+     */
+    static void reserve(size_t len, size_t count);
+};
+
+/*
+ * Interns module and title names. The returned pointer stays valid for the
+ * life of the process and equal names share it, so records carry the
+ * pointer instead of a copy. A per-thread cache keyed by the caller's
+ * pointer keeps the shared table off the hot path for string literals.
+ */
+class CLogStrings {
+public:
+    static const char* intern(const char* str);
+};
+
+#endif // LOG_LOGPOOL_HPP
@@ -0,0 +1,122 @@
+#ifndef LOG_LOGQUEUE_HPP
+#define LOG_LOGQUEUE_HPP
+
+#include <stddef.h>
+#include <atomic>
+
+class LogItem;
+
+/*
+ * Bounded lock-free queue of log items, many producers and one consumer.
+ * Each cell carries a sequence number telling producers whether it is free
+ * and the consumer whether it is published (D. Vyukov's bounded queue), so
+ * push is one CAS on the tail and pop touches no shared counter at all.
+ */
+class CLogQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit CLogQueue(size_t capacity);
+    ~CLogQueue();
+
+public:
+    // 0 if the queue is full, the item is not taken then
+    int push(LogItem* li);
+
+    // consumer only, moves up to max_items published items into items
+    size_t pop_batch(LogItem** items, size_t max_items);
+
+    // consumer only, the oldest published item or 0, pop() removes it
+    LogItem* peek() const;
+    void pop();
+
+    // consumer only
+    int empty() const;
+
+    size_t size() const;
+    size_t capacity() const { return _mask + 1; }
+
+    /*
+     * any thread, for the crash handler: calls fn on the published items
+     * not popped yet, oldest first, without taking them. Best effort, the
+     * consumer may be releasing them meanwhile.
+     */
+    void visit(void (*fn)(const LogItem* li, void* arg), void* arg) const;
+
+private:
+    CLogQueue(const CLogQueue&);
+    CLogQueue& operator=(const CLogQueue&);
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        LogItem* item;
+    };
+
+    Cell* _cells;
+    size_t _mask;
+    // keep producers and the consumer on separate cache lines
+    char _pad0[64];
+    std::atomic<size_t> _tail;
+    char _pad1[64];
+    std::atomic<size_t> _head;
+    char _pad2[64];
+};
+
+/*
+ * Bounded ring with one producer and one consumer. Every producer thread
+ * gets one per dispatcher, so a push writes only lines of its own thread;
+ * each side reads the other's position again only when the ring looks
+ * full or empty. The producer and the dispatcher's ring set both hold a
+ * reference, whichever lets go last frees it.
+ */
+class CLogRing {
+public:
+    // capacity is rounded up to a power of two, the reference count starts at 1
+    explicit CLogRing(size_t capacity);
+    ~CLogRing();
+
+public:
+    // producer only, 0 if the ring is full
+    int push(LogItem* li);
+
+    // consumer only, the oldest item or 0, pop() removes it
+    LogItem* peek();
+    void pop();
+
+    int empty() const;
+    size_t size() const;
+    size_t capacity() const { return _mask + 1; }
+
+    // any thread, for the crash handler, see CLogQueue::visit
+    void visit(void (*fn)(const LogItem* li, void* arg), void* arg) const;
+
+    void add_ref();
+    void release();
+
+    // the producer thread is gone, nothing more is pushed
+    void close() { _b_closed.store(1, std::memory_order_release); }
+    int closed() const { return _b_closed.load(std::memory_order_acquire); }
+
+    // the dispatcher is gone, the producer should let go of the ring
+    void detach() { _b_detached.store(1, std::memory_order_release); }
+    int detached() const { return _b_detached.load(std::memory_order_acquire); }
+
+private:
+    CLogRing(const CLogRing&);
+    CLogRing& operator=(const CLogRing&);
+
+    LogItem** _items;
+    size_t _mask;
+    std::atomic_int _n_ref;
+    std::atomic_int _b_closed;
+    std::atomic_int _b_detached;
+
+    char _pad0[64];
+    std::atomic<size_t> _tail;
+    size_t _head_cache;         // producer's last look at _head
+    char _pad1[64];
+    std::atomic<size_t> _head;
+    size_t _tail_cache;         // consumer's last look at _tail
+    char _pad2[64];
+};
+
+#endif // LOG_LOGQUEUE_HPP
@@ -0,0 +1,39 @@
+#ifndef LOG_LOGRATE_HPP
+#define LOG_LOGRATE_HPP
+
+#include "logapi.hpp"
+#include <stddef.h>
+
+/*
+ * Storm control per call site, a site being the format string of the
+ * call. Within each window a site passes at most the limit of its level,
+ * the rest is counted and reported as one summary line when the window
+ * ends. A line equal to the site's previous one is folded the same way
+ * into "message repeated N times in T ms". FATAL and NOTIFY always pass.
+ *
+ * limit() runs before the text is formatted, so a suppressed line costs
+ * no vsnprintf; fold() runs on the formatted text. Summaries go out
+ * through append_log and are not limited themselves.
+ */
+class CLogRateLimiter {
+public:
+    /*
+     * 0 if the site is over its limit and the line has to be dropped.
+     * slot is for fold(), -1 if the site is not tracked.
+     */
+    static int limit(LogLevel level, const void* site, const char* module,
+                     const char* log_title, int* slot);
+
+    // 0 if the text repeats the previous line of the site and was folded
+    static int fold(int slot, const void* text, size_t len);
+
+    /*
+     * emits the summaries of windows that ended, with force all pending
+     * ones, e.g. before a flush
+     */
+    static void sweep(int force);
+
+    static int enabled();
+};
+
+#endif // LOG_LOGRATE_HPP
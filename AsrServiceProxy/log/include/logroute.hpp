@@ -0,0 +1,43 @@
+#ifndef LOG_LOGROUTE_HPP
+#define LOG_LOGROUTE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define LOG_TITLE_MAP_SLOTS 4096
+
+/*
+ * Maps a title interned by CLogStrings to a non-zero 64 bit value. The
+ * pointer is the key, so a lookup hashes an address and compares
+ * pointers, no string work and no lock. Entries are only ever added or
+ * overwritten; to invalidate, callers fold a generation into the value.
+ * Sized for the titles of one process, once full new titles are simply
+ * not cached.
+ */
+class CLogTitleMap {
+public:
+    CLogTitleMap();
+
+public:
+    // 1 and the value if title is in the map
+    int find(const char* title, uint64_t* value) const;
+
+    // adds or overwrites, 0 if the map is full
+    int insert(const char* title, uint64_t value);
+
+private:
+    CLogTitleMap(const CLogTitleMap&);
+    CLogTitleMap& operator=(const CLogTitleMap&);
+
+    static size_t slot_of(const char* title);
+
+    struct Slot {
+        std::atomic<const char*> _title;
+        std::atomic<uint64_t> _value;   // 0 until the inserting thread stored it
+    };
+
+    Slot _slots[LOG_TITLE_MAP_SLOTS];
+};
+
+#endif // LOG_LOGROUTE_HPP
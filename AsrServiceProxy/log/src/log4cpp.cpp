@@ -3,6 +3,8 @@
 #include <log4cpp/HierarchyMaintainer.hh>
 #include <fstream>
 #include "logapi.hpp"
+#include "include/logformat.hpp"
+#include "include/logroute.hpp"
 
 #ifdef WIN32
 #include <io.h>
@@ -17,23 +19,6 @@ extern log_callback_t g_callback;
 }
 #endif
 
-void align_string(std::string& msg, int align) {
-    if (align <= 0) {
-        return;
-    }
-
-    if (align > 8) {
-        align = 8;
-    }
-
-    int len = msg.length();
-    int append = align - (len % align);
-
-    while (append --) {
-        msg += " ";
-    }
-}
-
 class CLogReceiver_log4cpp {
     class CReceiver : public CLogReceiver {
     public:
@@ -68,6 +53,7 @@ public:
     }
 private:
     CReceiver* _receiver;
+    CLogTitleMap _categories;
 public:
     int attach_to_log() {
         if (!_receiver) {
@@ -78,6 +64,8 @@ public:
     }
     int detach_from_log() {
         if (_receiver) {
+            // deliver queued logs while the receiver is still whole
+            log_flush(3000);
             delete _receiver;
             _receiver = 0;
         }
@@ -90,41 +78,45 @@ public:
                                         const char* log, unsigned long thrd_id) {
         log_callback_t callback = g_callback;
 
-        char lbuf[32];
-        std::string msg;
-
-        snprintf(lbuf, 32, "%ld", thrd_id);
-        msg += lbuf;
-
-        msg += " ";
-        align_string(msg, 4);
-        msg += module;
-
-        msg += " ";
-        align_string(msg, 4);
-        msg += log_title;
-
-        msg += " ";
-        align_string(msg, 4);
-        msg += log;
+        // built in a per thread buffer instead of a string per line
+        static __thread char msg[LOG_MAX_LINE + 256];
+        log_format_body(msg, sizeof(msg), thrd_id, module, log_title, log);
 
         if (callback) {
-            callback(level, msg.c_str());
+            callback(level, msg);
         } else {
-            log4cpp::Category* cate =
-                log4cpp::HierarchyMaintainer::getDefaultMaintainer().getExistingInstance(log_title);
-
-            if (!cate) {
-                cate = &log4cpp::Category::getRoot();
-            }
+            log4cpp::Category* cate = category(log_title);
 
-            cate->log(from_log_level(level), msg.c_str());
+            // the text is formatted already, a '%' in it must not be read as a format
+            cate->log(from_log_level(level), "%s", msg);
         }
 
         return 0;
     }
 
 private:
+    /*
+     * the category of a title, looked up in log4cpp once. Titles come
+     * interned from the log items, categories live until log4cpp shuts down.
+     */
+    log4cpp::Category* category(const char* log_title) {
+        uint64_t cached = 0;
+
+        if (_categories.find(log_title, &cached)) {
+            return reinterpret_cast<log4cpp::Category*>(cached);
+        }
+
+        log4cpp::Category* cate =
+            log4cpp::HierarchyMaintainer::getDefaultMaintainer().getExistingInstance(log_title);
+
+        if (!cate) {
+            cate = &log4cpp::Category::getRoot();
+        }
+
+        _categories.insert(log_title, reinterpret_cast<uintptr_t>(cate));
+        return cate;
+    }
+
     log4cpp::Priority::Value from_log_level(LogLevel ll) {
         switch (ll) {
         case NOT_SET:
@@ -1,4 +1,5 @@
 #include "logapi.hpp"
+#include "include/lograte.hpp"
 #include <stdio.h>
 #include <stdarg.h>
 #ifdef WIN32
@@ -90,12 +91,31 @@ void LOGAPI report_log(LogLevel level, const char* module, const char* log_title
 void LOGAPI v_log_log(LogLevel level, const char* module, const char* log_title,
                       const char* log, va_list lst) {
     if (is_log_level_enabled(level)) {
-        char* buf = (char*) calloc(4096, sizeof(char));
+        /*
+         * the text is copied into a log item before report_log returns, so
+         * one buffer per thread is enough, also for a receiver that logs
+         */
+#ifdef WIN32
+        static __declspec(thread) char buf[LOG_MAX_LINE];
+#else
+        static __thread char buf[LOG_MAX_LINE];
+#endif
+
+        int slot = -1;
+
+        // a line over its call site's limit is dropped before it is formatted
+        if (!CLogRateLimiter::limit(level, log, module, log_title, &slot)) {
+            return;
+        }
+
+        int len = vsnprintf(&buf[0], LOG_MAX_LINE, log, lst);
+
+        if (len >= LOG_MAX_LINE) {
+            len = LOG_MAX_LINE - 1;
+        }
 
-        if (buf) {
-            vsnprintf(&buf[0], 4096, log, lst);
+        if (len >= 0 && CLogRateLimiter::fold(slot, &buf[0], len)) {
             report_log(level, module, log_title, &buf[0]);
-            free(buf);
         }
     }
 }
@@ -0,0 +1,445 @@
+#include "include/logarchive.hpp"
+#include <aip_time.hpp>
+#include <scopedlock.hpp>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// bytes read and deflated per step, the rate is checked after each
+#define LOG_ARCHIVE_CHUNK (256 << 10)
+
+// ioprio_set(2), glibc has no wrapper
+#define LOG_IOPRIO_WHO_PROCESS 1
+#define LOG_IOPRIO_CLASS_IDLE 3
+#define LOG_IOPRIO_CLASS_SHIFT 13
+
+static CCritSec s_archiver_lock;
+static CLogArchiver* s_archiver = 0;
+
+static std::atomic<unsigned long long> s_files(0);
+static std::atomic<unsigned long long> s_bytes_in(0);
+static std::atomic<unsigned long long> s_bytes_out(0);
+static std::atomic<unsigned long long> s_removed(0);
+static std::atomic<unsigned long long> s_errors(0);
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int LOGAPI log_archive_open(const char* path, int level, int rate_kb, int keep_mb) {
+    log_archive_close();
+
+    CLogArchiver* archiver = new CLogArchiver();
+
+    if (!archiver->open(path, level, rate_kb, (long long) (keep_mb > 0 ? keep_mb : 0) << 20)) {
+        delete archiver;
+        return 0;
+    }
+
+    CScopedLock lc(&s_archiver_lock);
+    s_archiver = archiver;
+    return 1;
+}
+
+void LOGAPI log_archive_close() {
+    CLogArchiver* archiver = 0;
+    {
+        CScopedLock lc(&s_archiver_lock);
+        archiver = s_archiver;
+        s_archiver = 0;
+    }
+
+    if (archiver) {
+        archiver->close();
+        delete archiver;
+    }
+}
+
+void LOGAPI log_get_archive_stats(log_archive_stats_t* stats) {
+    stats->_files = s_files.load(std::memory_order_relaxed);
+    stats->_bytes_in = s_bytes_in.load(std::memory_order_relaxed);
+    stats->_bytes_out = s_bytes_out.load(std::memory_order_relaxed);
+    stats->_removed = s_removed.load(std::memory_order_relaxed);
+    stats->_errors = s_errors.load(std::memory_order_relaxed);
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
+static int ends_with(const std::string& str, const char* suffix) {
+    size_t len = strlen(suffix);
+    return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+/*
+ * a name the mmap sink gives a rotated segment, the prefix stripped:
+ * yyyymmdd-hhmmss, maybe followed by .n
+ */
+static int is_segment_stamp(const char* s) {
+    for (int i = 0; i < 15; i++) {
+        if (i == 8 ? s[i] != '-' : (s[i] < '0' || s[i] > '9')) {
+            return 0;
+        }
+    }
+
+    s += 15;
+
+    if (*s == '.') {
+        s++;
+
+        if (!*s) {
+            return 0;
+        }
+
+        while (*s >= '0' && *s <= '9') {
+            s++;
+        }
+    }
+
+    return *s == 0;
+}
+
+static int write_all(int fd, const unsigned char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return 0;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+void CLogArchiver::add(const std::string& segment) {
+    CScopedLock lc(&s_archiver_lock);
+
+    if (s_archiver) {
+        {
+            CScopedLock lq(&s_archiver->_lock);
+            s_archiver->_queue.push_back(segment);
+        }
+        s_archiver->_ev_work.set_event();
+    }
+}
+
+CLogArchiver::CLogArchiver()
+    : _n_level(Z_DEFAULT_COMPRESSION)
+    , _n_rate_bytes(0)
+    , _n_keep_bytes(0)
+    , _ev_work(0, 0)
+    , _b_quit(0)
+    , _p_thread(0)
+    , _b_thread(0) {
+}
+
+CLogArchiver::~CLogArchiver() {
+    close();
+}
+
+int CLogArchiver::open(const char* path, int level, int rate_kb, long long keep_bytes) {
+    _path = path;
+
+    size_t slash = _path.rfind('/');
+    _dir = slash == std::string::npos ? "." : _path.substr(0, slash + 1);
+    _prefix = (slash == std::string::npos ? _path : _path.substr(slash + 1)) + ".";
+    _n_level = level >= 1 && level <= 9 ? level : Z_DEFAULT_COMPRESSION;
+    _n_rate_bytes = rate_kb > 0 ? (long long) rate_kb << 10 : 0;
+    _n_keep_bytes = keep_bytes;
+
+    if (pthread_create(&_p_thread, NULL, &CLogArchiver::archive_thrd, this) != 0) {
+        return 0;
+    }
+
+    _b_thread = 1;
+    return 1;
+}
+
+void CLogArchiver::close() {
+    if (!_b_thread) {
+        return;
+    }
+
+    {
+        CScopedLock lc(&_lock);
+        _b_quit = 1;
+        _lock.signal();
+    }
+    _ev_work.set_event();
+    pthread_join(_p_thread, NULL);
+    _b_thread = 0;
+}
+
+void* CLogArchiver::archive_thrd(void* param) {
+    reinterpret_cast<CLogArchiver*>(param)->run();
+    return 0;
+}
+
+void CLogArchiver::run() {
+    // only this thread, the rest of the process keeps its priorities
+    pid_t tid = (pid_t) syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, LOG_IOPRIO_WHO_PROCESS, tid,
+            LOG_IOPRIO_CLASS_IDLE << LOG_IOPRIO_CLASS_SHIFT);
+
+    scan();
+    enforce_retention();
+
+    for (;;) {
+        std::string segment;
+        {
+            CScopedLock lc(&_lock);
+
+            if (_b_quit) {
+                break;
+            }
+
+            if (!_queue.empty()) {
+                segment = _queue.front();
+                _queue.pop_front();
+            }
+        }
+
+        if (segment.empty()) {
+            _ev_work.wait(60000);
+            continue;
+        }
+
+        if (compress(segment)) {
+            enforce_retention();
+        }
+    }
+}
+
+void CLogArchiver::scan() {
+    DIR* dir = opendir(_dir.c_str());
+
+    if (!dir) {
+        return;
+    }
+
+    std::vector<std::pair<long long, std::string> > found;
+    struct dirent* ent = 0;
+
+    while ((ent = readdir(dir)) != 0) {
+        std::string name = ent->d_name;
+
+        if (name.compare(0, _prefix.size(), _prefix) != 0) {
+            continue;
+        }
+
+        std::string file = _dir + name;
+
+        if (ends_with(name, ".gz.tmp")) {
+            ::unlink(file.c_str());
+            continue;
+        }
+
+        struct stat st;
+
+        if (is_segment_stamp(name.c_str() + _prefix.size()) && ::stat(file.c_str(), &st) == 0) {
+            found.push_back(std::make_pair((long long) st.st_mtime, file));
+        }
+    }
+
+    closedir(dir);
+
+    // oldest first, like they were rotated
+    std::sort(found.begin(), found.end());
+    CScopedLock lc(&_lock);
+
+    for (size_t i = 0; i < found.size(); i++) {
+        _queue.push_back(found[i].second);
+    }
+}
+
+int CLogArchiver::throttle(long long start_ms, long long bytes) {
+    long long due_ms = _n_rate_bytes > 0 ? start_ms + bytes * 1000 / _n_rate_bytes : 0;
+    CScopedLock lc(&_lock);
+
+    // close signals _lock to cut the wait short
+    for (long long now_ms = monotonic_time_ms(); !_b_quit && now_ms < due_ms;
+            now_ms = monotonic_time_ms()) {
+        _lock.timewait((int) (due_ms - now_ms));
+    }
+
+    return !_b_quit;
+}
+
+int CLogArchiver::compress(const std::string& segment) {
+    int in = ::open(segment.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in < 0) {
+        // removed by hand or by an earlier run
+        return 0;
+    }
+
+    std::string gz = segment + ".gz";
+    std::string tmp = gz + ".tmp";
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (out < 0) {
+        printf("LOG open %s failed: %s\n", tmp.c_str(), strerror(errno));
+        s_errors.fetch_add(1, std::memory_order_relaxed);
+        ::close(in);
+        return 0;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    // 16 + window bits writes a gzip header, zcat and log shippers read it as is
+    if (deflateInit2(&zs, _n_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        s_errors.fetch_add(1, std::memory_order_relaxed);
+        ::close(in);
+        ::close(out);
+        ::unlink(tmp.c_str());
+        return 0;
+    }
+
+    std::vector<unsigned char> in_buf(LOG_ARCHIVE_CHUNK);
+    std::vector<unsigned char> out_buf(LOG_ARCHIVE_CHUNK);
+    long long start_ms = monotonic_time_ms();
+    long long bytes_in = 0;
+    long long bytes_out = 0;
+    int ok = 1;
+    int flush = Z_NO_FLUSH;
+
+    while (ok && flush != Z_FINISH) {
+        ssize_t n = ::read(in, &in_buf[0], in_buf.size());
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            ok = 0;
+            break;
+        }
+
+        // the segment is read once, keep it from pushing hot pages out of the cache
+        posix_fadvise(in, bytes_in, n, POSIX_FADV_DONTNEED);
+        bytes_in += n;
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = &in_buf[0];
+        zs.avail_in = (uInt) n;
+
+        do {
+            zs.next_out = &out_buf[0];
+            zs.avail_out = (uInt) out_buf.size();
+
+            if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+                ok = 0;
+                break;
+            }
+
+            size_t len = out_buf.size() - zs.avail_out;
+
+            if (!write_all(out, &out_buf[0], len)) {
+                ok = 0;
+                break;
+            }
+
+            bytes_out += len;
+        } while (zs.avail_out == 0);
+
+        if (ok && !throttle(start_ms, bytes_in)) {
+            ok = 0;
+        }
+    }
+
+    deflateEnd(&zs);
+    ::close(in);
+
+    // the segment goes away below, its compressed copy has to be on disk first
+    if (ok && fdatasync(out) != 0) {
+        ok = 0;
+    }
+
+    ::close(out);
+
+    if (!ok || ::rename(tmp.c_str(), gz.c_str()) != 0) {
+        if (throttle(0, 0)) {
+            printf("LOG compress %s failed: %s\n", segment.c_str(), strerror(errno));
+            s_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ::unlink(tmp.c_str());
+        return 0;
+    }
+
+    ::unlink(segment.c_str());
+    s_files.fetch_add(1, std::memory_order_relaxed);
+    s_bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+    s_bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+    return 1;
+}
+
+void CLogArchiver::enforce_retention() {
+    if (_n_keep_bytes <= 0) {
+        return;
+    }
+
+    DIR* dir = opendir(_dir.c_str());
+
+    if (!dir) {
+        return;
+    }
+
+    struct Archive {
+        long long _mtime;
+        std::string _file;
+        long long _size;
+
+        bool operator<(const Archive& other) const {
+            return _mtime != other._mtime ? _mtime < other._mtime : _file < other._file;
+        }
+    };
+
+    std::vector<Archive> archives;
+    long long total = 0;
+    struct dirent* ent = 0;
+
+    while ((ent = readdir(dir)) != 0) {
+        std::string name = ent->d_name;
+        struct stat st;
+
+        if (name.compare(0, _prefix.size(), _prefix) != 0 || !ends_with(name, ".gz")
+                || ::stat((_dir + name).c_str(), &st) != 0) {
+            continue;
+        }
+
+        Archive a = { (long long) st.st_mtime, _dir + name, (long long) st.st_size };
+        archives.push_back(a);
+        total += a._size;
+    }
+
+    closedir(dir);
+    std::sort(archives.begin(), archives.end());
+
+    // the newest archive stays even when it alone is over the budget
+    for (size_t i = 0; i + 1 < archives.size() && total > _n_keep_bytes; i++) {
+        if (::unlink(archives[i]._file.c_str()) == 0) {
+            total -= archives[i]._size;
+            s_removed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
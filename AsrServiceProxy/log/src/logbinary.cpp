@@ -0,0 +1,209 @@
+#include "include/logbinary.hpp"
+#include "include/logfilesink.hpp"
+#include "include/logimpl.hpp"
+#include <scopedlock.hpp>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct LogBinaryFormat {
+    LogLevel _level;
+    int _line;
+    std::string _module;
+    std::string _title;
+    std::string _file;
+    std::string _fmt;
+};
+
+/*
+ * formats by id - 1, never shrinks, so a pointer handed out stays valid
+ */
+struct LogBinaryFormats {
+    CCritSec _lock;
+    std::vector<LogBinaryFormat*> _formats;
+};
+
+LogBinaryFormats* formats() {
+    static LogBinaryFormats* s_formats = new LogBinaryFormats();
+    return s_formats;
+}
+
+const LogBinaryFormat* find_format(unsigned int id) {
+    LogBinaryFormats* all = formats();
+    CScopedLock lc(&all->_lock);
+
+    return id > 0 && id <= all->_formats.size() ? all->_formats[id - 1] : 0;
+}
+
+void put_string(char* buf, size_t* pos, const std::string& str) {
+    uint16_t len = (uint16_t) (str.size() < LOG_BINARY_MAX_STRING ? str.size() : LOG_BINARY_MAX_STRING);
+    memcpy(buf + *pos, &len, sizeof(len));
+    *pos += sizeof(len);
+    memcpy(buf + *pos, str.data(), len);
+    *pos += len;
+}
+
+}  // namespace
+
+/*
+ * The native file sink with binary frames instead of text lines. It is fed
+ * by the binary dispatcher of CLogImpl, whose records hold a format id and
+ * the encoded arguments.
+ */
+class CLogBinarySink : public CLogFileSink {
+public:
+    virtual ~CLogBinarySink() {
+        close();
+    }
+
+protected:
+    virtual int on_open() {
+        LogBinaryFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header._magic, LOG_BINARY_MAGIC, sizeof(header._magic));
+        header._version = LOG_BINARY_VERSION;
+
+        // a new header restarts the format table of the decoder, also in an appended file
+        _emitted.clear();
+        return ::write(_fd, &header, sizeof(header)) == (ssize_t) sizeof(header);
+    }
+
+    virtual size_t format_record(char* buf, size_t cap, const log_record_t* rec) {
+        unsigned int id = 0;
+
+        if (rec->_log_len < sizeof(id)) {
+            return 0;
+        }
+
+        memcpy(&id, rec->_log, sizeof(id));
+        size_t pos = 0;
+
+        if (id >= _emitted.size() || !_emitted[id]) {
+            const LogBinaryFormat* fmt = find_format(id);
+
+            if (!fmt) {
+                return 0;
+            }
+
+            pos = format_definition(buf, id, fmt);
+
+            if (id >= _emitted.size()) {
+                _emitted.resize(id + 1, 0);
+            }
+
+            _emitted[id] = 1;
+        }
+
+        // the arguments are at most LOG_BINARY_MAX_ARGS, the whole frame fits cap
+        size_t args_len = rec->_log_len - sizeof(id);
+        LogBinaryFrame frame;
+        frame._type = LOG_BINARY_RECORD;
+        frame._level = (uint8_t) rec->_level;
+        frame._reserved = 0;
+        frame._size = (uint32_t) (sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t) + args_len);
+
+        uint64_t thrd_id = rec->_thrd_id;
+        int64_t time_us = rec->_time_us;
+
+        memcpy(buf + pos, &frame, sizeof(frame));
+        pos += sizeof(frame);
+        memcpy(buf + pos, &id, sizeof(id));
+        pos += sizeof(id);
+        memcpy(buf + pos, &thrd_id, sizeof(thrd_id));
+        pos += sizeof(thrd_id);
+        memcpy(buf + pos, &time_us, sizeof(time_us));
+        pos += sizeof(time_us);
+        memcpy(buf + pos, rec->_log + sizeof(id), args_len);
+        pos += args_len;
+
+        (void) cap;
+        return pos;
+    }
+
+    virtual int attach() {
+        return 0 == CLogImpl::instance()->register_binary_receiver(&_receiver);
+    }
+
+    virtual void detach() {
+        CLogImpl::instance()->unregister_binary_receiver(&_receiver);
+    }
+
+private:
+    size_t format_definition(char* buf, unsigned int id, const LogBinaryFormat* fmt) {
+        size_t pos = sizeof(LogBinaryFrame);
+        uint32_t id32 = id;
+        uint32_t line = fmt->_line;
+
+        memcpy(buf + pos, &id32, sizeof(id32));
+        pos += sizeof(id32);
+        memcpy(buf + pos, &line, sizeof(line));
+        pos += sizeof(line);
+        put_string(buf, &pos, fmt->_file);
+        put_string(buf, &pos, fmt->_module);
+        put_string(buf, &pos, fmt->_title);
+        put_string(buf, &pos, fmt->_fmt);
+
+        LogBinaryFrame frame;
+        frame._type = LOG_BINARY_FORMAT;
+        frame._level = (uint8_t) fmt->_level;
+        frame._reserved = 0;
+        frame._size = (uint32_t) (pos - sizeof(frame));
+        memcpy(buf, &frame, sizeof(frame));
+        return pos;
+    }
+
+private:
+    // format ids whose definition is in the current file
+    std::vector<char> _emitted;
+};
+
+static CLogBinarySink* s_binary_sink = 0;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+unsigned int LOGAPI log_binary_register(LogLevel level, const char* module, const char* log_title,
+                                        const char* file, int line, const char* fmt) {
+    LogBinaryFormat* format = new LogBinaryFormat();
+    format->_level = level;
+    format->_line = line;
+    format->_module = module ? module : "";
+    format->_title = log_title ? log_title : "";
+    format->_file = file ? file : "";
+    format->_fmt = fmt ? fmt : "";
+
+    LogBinaryFormats* all = formats();
+    CScopedLock lc(&all->_lock);
+    all->_formats.push_back(format);
+    return (unsigned int) all->_formats.size();
+}
+
+int LOGAPI log_binary_open(const char* path, int flush_bytes, int flush_ms) {
+    log_binary_close();
+
+    CLogBinarySink* sink = new CLogBinarySink();
+
+    if (!sink->open(path, flush_bytes > 0 ? flush_bytes : 0, flush_ms)) {
+        delete sink;
+        return 0;
+    }
+
+    s_binary_sink = sink;
+    return 1;
+}
+
+void LOGAPI log_binary_close() {
+    if (s_binary_sink) {
+        s_binary_sink->close();
+        delete s_binary_sink;
+        s_binary_sink = 0;
+    }
+}
+
+#if defined(__cplusplus)
+};
+#endif
@@ -0,0 +1,309 @@
+#include "include/logcrash.hpp"
+#include "include/logfilesink.hpp"
+#include "include/logformat.hpp"
+#include "include/logimpl.hpp"
+#include <boost/stacktrace.hpp>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_CRASH_FRAMES 64
+#define LOG_CRASH_ALT_STACK (64 << 10)
+
+static const int s_signals[] = { SIGSEGV, SIGBUS, SIGABRT };
+#define LOG_CRASH_SIGNALS ((int) (sizeof(s_signals) / sizeof(s_signals[0])))
+
+static struct sigaction s_old_actions[LOG_CRASH_SIGNALS];
+static int s_b_installed = 0;
+static int s_fd = -1;
+static void* s_alt_stack = 0;
+
+// the thread dumping, a second crash elsewhere waits for it to end the process
+static std::atomic<long> s_crash_tid(0);
+
+// set aside by install, nothing is allocated once a signal came
+static char s_line[LOG_SINK_LINE_MAX];
+static void* s_frames[LOG_CRASH_FRAMES];
+static char s_maps[4096];
+
+/*
+ * async-signal-safe pieces of a line in s_line
+ */
+static size_t append_string(size_t pos, const char* str) {
+    while (str && *str && pos < sizeof(s_line) - 1) {
+        s_line[pos++] = *str++;
+    }
+
+    return pos;
+}
+
+static size_t append_number(size_t pos, unsigned long long n, int base) {
+    char digits[24];
+    int len = 0;
+
+    do {
+        digits[len++] = "0123456789abcdef"[n % base];
+        n /= base;
+    } while (n);
+
+    while (len && pos < sizeof(s_line) - 1) {
+        s_line[pos++] = digits[--len];
+    }
+
+    return pos;
+}
+
+static void write_all(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = ::write(s_fd, data, len);
+
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        data += written;
+        len -= written;
+    }
+}
+
+static void write_line(size_t pos) {
+    s_line[pos++] = '\n';
+    write_all(s_line, pos);
+}
+
+static const char* signal_name(int sig) {
+    switch (sig) {
+    case SIGSEGV:
+        return "SIGSEGV";
+
+    case SIGBUS:
+        return "SIGBUS";
+
+    case SIGABRT:
+        return "SIGABRT";
+
+    default:
+        return "signal";
+    }
+}
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int LOGAPI log_crash_handler_install(const char* path) {
+    return CLogCrashHandler::install(path);
+}
+
+void LOGAPI log_crash_handler_uninstall() {
+    CLogCrashHandler::uninstall();
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
+int CLogCrashHandler::install(const char* path) {
+    uninstall();
+
+    s_fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (s_fd < 0) {
+        printf("LOG open %s failed: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    s_alt_stack = mmap(0, LOG_CRASH_ALT_STACK, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (s_alt_stack != MAP_FAILED) {
+        stack_t ss;
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_sp = s_alt_stack;
+        ss.ss_size = LOG_CRASH_ALT_STACK;
+        sigaltstack(&ss, 0);
+    } else {
+        s_alt_stack = 0;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &CLogCrashHandler::on_signal;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+
+    for (int i = 0; i < LOG_CRASH_SIGNALS; i++) {
+        sigaction(s_signals[i], &sa, &s_old_actions[i]);
+    }
+
+    s_b_installed = 1;
+    return 1;
+}
+
+void CLogCrashHandler::uninstall() {
+    if (s_b_installed) {
+        for (int i = 0; i < LOG_CRASH_SIGNALS; i++) {
+            sigaction(s_signals[i], &s_old_actions[i], 0);
+        }
+
+        s_b_installed = 0;
+    }
+
+    if (s_alt_stack) {
+        stack_t ss;
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, 0);
+        munmap(s_alt_stack, LOG_CRASH_ALT_STACK);
+        s_alt_stack = 0;
+    }
+
+    if (s_fd >= 0) {
+        ::close(s_fd);
+        s_fd = -1;
+    }
+}
+
+void CLogCrashHandler::on_signal(int sig, siginfo_t* info, void* ctx) {
+    long tid = syscall(SYS_gettid);
+    long dumping = 0;
+
+    if (!s_crash_tid.compare_exchange_strong(dumping, tid) && dumping != tid) {
+        // another thread is dumping and ends the process when done
+        for (;;) {
+            pause();
+        }
+    }
+
+    // dumping is the thread itself if it crashed again while dumping, skip to the end then
+    if (dumping == 0) {
+        size_t pos = append_string(0, "==== ");
+        pos = append_string(pos, signal_name(sig));
+        pos = append_string(pos, " in thread ");
+        pos = append_number(pos, tid, 10);
+
+        if (sig != SIGABRT) {
+            pos = append_string(pos, ", address 0x");
+            pos = append_number(pos, (unsigned long long) (uintptr_t) info->si_addr, 16);
+        }
+
+        write_line(pos);
+
+        CLogFileSink::crash_write_all();
+
+        CLogImpl* impl = CLogImpl::instance(0);
+
+        if (impl) {
+            write_line(append_string(0, "---- logs not delivered"));
+            impl->visit_queued(&CLogCrashHandler::write_queued, 0);
+        }
+
+        write_stack();
+        fsync(s_fd);
+    }
+
+    // the previous action takes the signal once the handler returns
+    for (int i = 0; i < LOG_CRASH_SIGNALS; i++) {
+        if (s_signals[i] == sig) {
+            sigaction(sig, &s_old_actions[i], 0);
+        }
+    }
+
+    raise(sig);
+}
+
+void CLogCrashHandler::write_queued(const LogItem* li, void* arg) {
+    size_t pos = append_number(0, li->_n_time_us / 1000000, 10);
+    // the leading 1 keeps the zeros of the microseconds and becomes the dot
+    pos = append_number(pos, li->_n_time_us % 1000000 + 1000000, 10);
+    s_line[pos - 7] = '.';
+    pos = append_string(pos, "\t[");
+    pos = append_number(pos, li->_n_thrd_id, 10);
+    pos = append_string(pos, "]\t");
+    pos = append_string(pos, log_level_name(li->_e_level));
+    pos = append_string(pos, "\t");
+    pos = append_string(pos, li->_module);
+    pos = append_string(pos, " ");
+    pos = append_string(pos, li->_title);
+    pos = append_string(pos, " ");
+    pos = append_string(pos, li->_log);
+
+    // the request fields, as log_format_line puts them
+    if (li->_ctx) {
+        pos = append_string(pos, "\t");
+        pos = append_string(pos, li->_ctx);
+    }
+
+    write_line(pos);
+}
+
+void CLogCrashHandler::write_stack() {
+    write_line(append_string(0, "---- stack"));
+
+    // safe_dump_to only walks the stack, the frames end with a null
+    size_t frames = boost::stacktrace::safe_dump_to(1, s_frames, sizeof(s_frames));
+
+    for (size_t i = 0; i < frames && s_frames[i]; i++) {
+        size_t pos = append_string(0, "#");
+        pos = append_number(pos, i, 10);
+        pos = append_string(pos, " 0x");
+        pos = append_number(pos, (unsigned long long) (uintptr_t) s_frames[i], 16);
+        write_line(pos);
+    }
+
+    write_maps();
+}
+
+void CLogCrashHandler::write_maps() {
+    write_line(append_string(0, "---- maps"));
+
+    int fd = ::open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return;
+    }
+
+    // "start-end perms offset dev inode path", only the lines with code
+    size_t pos = 0;
+    ssize_t got;
+
+    while ((got = ::read(fd, s_maps, sizeof(s_maps))) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        for (ssize_t i = 0; i < got; i++) {
+            if (s_maps[i] != '\n') {
+                if (pos < sizeof(s_line) - 1) {
+                    s_line[pos++] = s_maps[i];
+                }
+
+                continue;
+            }
+
+            const char* perms = (const char*) memchr(s_line, ' ', pos);
+
+            if (perms && perms + 3 < s_line + pos && perms[3] == 'x') {
+                write_line(pos);
+            }
+
+            pos = 0;
+        }
+    }
+
+    ::close(fd);
+}
@@ -0,0 +1,195 @@
+#include "include/logepoch.hpp"
+#include <scopedlock.hpp>
+#include <stdint.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
+#include <atomic>
+#include <vector>
+
+namespace {
+
+/*
+ * one per thread that ever read a snapshot, kept in a list that only
+ * grows, a record is reused by a later thread once its owner exited
+ */
+struct EpochRecord {
+    std::atomic<uint64_t> _epoch;   // 0 outside a guard
+    std::atomic_int _in_use;
+    int _depth;                     // nested guards, owner only
+    EpochRecord* _next;
+};
+
+struct Retired {
+    void* _p;
+    void (*_deleter)(void*);
+    uint64_t _epoch;
+};
+
+struct RetireList {
+    CCritSec _lock;
+    std::vector<Retired> _items;
+};
+
+std::atomic<uint64_t> s_epoch(1);
+std::atomic<EpochRecord*> s_records(0);
+
+RetireList* retired() {
+    static RetireList* s_retired = new RetireList();
+    return s_retired;
+}
+
+EpochRecord* acquire_record() {
+    for (EpochRecord* rec = s_records.load(std::memory_order_acquire); rec; rec = rec->_next) {
+        int in_use = 0;
+
+        if (rec->_in_use.compare_exchange_strong(in_use, 1)) {
+            return rec;
+        }
+    }
+
+    EpochRecord* rec = new EpochRecord();
+    rec->_epoch = 0;
+    rec->_in_use = 1;
+    rec->_depth = 0;
+    rec->_next = s_records.load(std::memory_order_relaxed);
+
+    while (!s_records.compare_exchange_weak(rec->_next, rec)) {
+    }
+
+    return rec;
+}
+
+__thread EpochRecord* s_record = 0;
+__thread int s_exiting = 0;
+
+/*
+ * gives the record back when the thread exits. The pointer itself is a
+ * plain __thread, so a guard in a later destructor still works, it just
+ * takes a record that is never given back.
+ */
+struct EpochRecordReleaser {
+    ~EpochRecordReleaser() {
+        s_exiting = 1;
+
+        if (s_record) {
+            s_record->_epoch = 0;
+            s_record->_depth = 0;
+            s_record->_in_use = 0;
+            s_record = 0;
+        }
+    }
+};
+
+EpochRecord* my_record() {
+    if (!s_record) {
+        s_record = acquire_record();
+
+        if (!s_exiting) {
+            static thread_local EpochRecordReleaser s_releaser;
+            (void) s_releaser;
+        }
+    }
+
+    return s_record;
+}
+
+/*
+ * the lowest epoch a reader entered with, not counting skip, ~0 if nobody
+ * is inside a guard
+ */
+uint64_t oldest_reader(const EpochRecord* skip) {
+    uint64_t oldest = ~0ULL;
+
+    for (EpochRecord* rec = s_records.load(std::memory_order_acquire); rec; rec = rec->_next) {
+        uint64_t epoch = rec->_epoch.load(std::memory_order_seq_cst);
+
+        if (rec != skip && epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    return oldest;
+}
+
+void reclaim() {
+    std::vector<Retired> ready;
+    RetireList* list = retired();
+    {
+        CScopedLock lc(&list->_lock);
+        uint64_t oldest = oldest_reader(0);
+        size_t kept = 0;
+
+        for (size_t i = 0; i < list->_items.size(); i++) {
+            if (list->_items[i]._epoch < oldest) {
+                ready.push_back(list->_items[i]);
+            } else {
+                list->_items[kept++] = list->_items[i];
+            }
+        }
+
+        list->_items.resize(kept);
+    }
+
+    // outside the lock, a deleter may retire more
+    for (size_t i = 0; i < ready.size(); i++) {
+        ready[i]._deleter(ready[i]._p);
+    }
+}
+
+}  // namespace
+
+void CLogEpoch::enter() {
+    EpochRecord* rec = my_record();
+
+    if (rec->_depth++ == 0) {
+        /*
+         * seq_cst store and fence: either a writer scanning the records sees
+         * this epoch, or the loads of the snapshot below see its swap
+         */
+        rec->_epoch.store(s_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void CLogEpoch::leave() {
+    EpochRecord* rec = my_record();
+
+    if (--rec->_depth == 0) {
+        rec->_epoch.store(0, std::memory_order_release);
+    }
+}
+
+void CLogEpoch::synchronize() {
+    // readers that enter from now on get a later epoch and see the new snapshot
+    uint64_t epoch = s_epoch.fetch_add(1);
+    EpochRecord* self = my_record();
+
+    for (int spins = 0; oldest_reader(self) <= epoch; spins++) {
+#ifdef WIN32
+        Sleep(spins < 16 ? 0 : 1);
+#else
+        if (spins < 16) {
+            sched_yield();
+        } else {
+            usleep(100);
+        }
+#endif
+    }
+
+    reclaim();
+}
+
+void CLogEpoch::retire(void* p, void (*deleter)(void*)) {
+    Retired item = { p, deleter, s_epoch.fetch_add(1) };
+    RetireList* list = retired();
+    {
+        CScopedLock lc(&list->_lock);
+        list->_items.push_back(item);
+    }
+
+    reclaim();
+}
@@ -0,0 +1,319 @@
+#include "include/logfilesink.hpp"
+#include "include/logformat.hpp"
+#include <aip_time.hpp>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// chunks kept for reuse after a write
+#define LOG_SINK_FREE_CHUNKS 16
+
+// open sinks the crash handler knows of, the text and the binary one
+#define LOG_SINK_CRASH_SLOTS 4
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static CLogFileSink* s_file_sink = 0;
+static std::atomic<CLogFileSink*> s_crash_sinks[LOG_SINK_CRASH_SLOTS];
+
+// kept outside the sink, /vars may read them while the sink is closed
+static std::atomic<unsigned long long> s_records(0);
+static std::atomic<unsigned long long> s_bytes(0);
+static std::atomic<unsigned long long> s_writes(0);
+static std::atomic<unsigned long long> s_write_errors(0);
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int LOGAPI log_file_sink_open(const char* path, int flush_bytes, int flush_ms) {
+    log_file_sink_close();
+
+    CLogFileSink* sink = new CLogFileSink();
+
+    if (!sink->open(path, flush_bytes > 0 ? flush_bytes : 0, flush_ms)) {
+        delete sink;
+        return 0;
+    }
+
+    s_file_sink = sink;
+    return 1;
+}
+
+void LOGAPI log_file_sink_close() {
+    if (s_file_sink) {
+        s_file_sink->close();
+        delete s_file_sink;
+        s_file_sink = 0;
+    }
+}
+
+void LOGAPI log_get_file_sink_stats(log_file_sink_stats_t* stats) {
+    stats->_records = s_records.load(std::memory_order_relaxed);
+    stats->_bytes = s_bytes.load(std::memory_order_relaxed);
+    stats->_writes = s_writes.load(std::memory_order_relaxed);
+    stats->_write_errors = s_write_errors.load(std::memory_order_relaxed);
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
+CLogFileSink::CLogFileSink()
+    : _fd(-1)
+    , _b_registered(0)
+    , _flush_bytes(0)
+    , _flush_ms(0)
+    , _pending_bytes(0)
+    , _pending_since_ms(0) {
+    memset(&_receiver, 0, sizeof(log_receiver_t));
+}
+
+CLogFileSink::~CLogFileSink() {
+    close();
+
+    for (size_t i = 0; i < _chunks.size(); i++) {
+        delete _chunks[i];
+    }
+
+    for (size_t i = 0; i < _free_chunks.size(); i++) {
+        delete _free_chunks[i];
+    }
+}
+
+int CLogFileSink::open(const char* path, size_t flush_bytes, int flush_ms) {
+    _fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (_fd < 0) {
+        printf("LOG open %s failed: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    _flush_bytes = flush_bytes;
+    _flush_ms = flush_ms;
+
+    _receiver._usr_data = this;
+    _receiver._receive_batch = &CLogFileSink::receive_batch_thunk;
+    _receiver._flush = &CLogFileSink::flush_thunk;
+
+    if (!on_open() || !attach()) {
+        ::close(_fd);
+        _fd = -1;
+        return 0;
+    }
+
+    _b_registered = 1;
+
+    for (int i = 0; i < LOG_SINK_CRASH_SLOTS; i++) {
+        CLogFileSink* none = 0;
+
+        if (s_crash_sinks[i].compare_exchange_strong(none, this)) {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+void CLogFileSink::close() {
+    for (int i = 0; i < LOG_SINK_CRASH_SLOTS; i++) {
+        CLogFileSink* self = this;
+        s_crash_sinks[i].compare_exchange_strong(self, 0);
+    }
+
+    if (_b_registered) {
+        // deliver queued logs while the sink is still registered
+        log_flush(3000);
+        detach();
+        _b_registered = 0;
+    }
+
+    if (_fd >= 0) {
+        write_pending();
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+int CLogFileSink::on_open() {
+    return 1;
+}
+
+size_t CLogFileSink::format_record(char* buf, size_t cap, const log_record_t* rec) {
+    return log_format_record(buf, cap, rec);
+}
+
+int CLogFileSink::attach() {
+    return 0 == ::register_log_receiver(&_receiver, "*", 0);
+}
+
+void CLogFileSink::detach() {
+    ::unregister_log_receiver(&_receiver);
+}
+
+int LOGAPI CLogFileSink::receive_batch_thunk(const log_record_t* records, size_t count,
+                                             void* usr_data) {
+    reinterpret_cast<CLogFileSink*>(usr_data)->on_receive_batch(records, count);
+    return 0;
+}
+
+long LOGAPI CLogFileSink::flush_thunk(int force, void* usr_data) {
+    return reinterpret_cast<CLogFileSink*>(usr_data)->on_flush(force);
+}
+
+CLogFileSink::Chunk* CLogFileSink::writable_chunk() {
+    if (!_chunks.empty() && sizeof(_chunks.back()->_data) - _chunks.back()->_len >= LOG_SINK_LINE_MAX) {
+        return _chunks.back();
+    }
+
+    Chunk* chunk = 0;
+
+    if (!_free_chunks.empty()) {
+        chunk = _free_chunks.back();
+        _free_chunks.pop_back();
+    } else {
+        chunk = new Chunk();
+    }
+
+    chunk->_len = 0;
+    _chunks.push_back(chunk);
+    return chunk;
+}
+
+void CLogFileSink::on_receive_batch(const log_record_t* records, size_t count) {
+    if (_pending_bytes == 0) {
+        _pending_since_ms = monotonic_time_ms();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        Chunk* chunk = writable_chunk();
+        size_t len = format_record(chunk->_data + chunk->_len,
+                                   sizeof(chunk->_data) - chunk->_len, &records[i]);
+        chunk->_len += len;
+        _pending_bytes += len;
+    }
+
+    s_records.fetch_add(count, std::memory_order_relaxed);
+
+    if (_pending_bytes >= _flush_bytes
+            || monotonic_time_ms() - _pending_since_ms >= _flush_ms) {
+        write_pending();
+    }
+}
+
+long CLogFileSink::on_flush(int force) {
+    if (_pending_bytes == 0) {
+        return -1;
+    }
+
+    long long age_ms = monotonic_time_ms() - _pending_since_ms;
+
+    if (force || age_ms >= _flush_ms) {
+        write_pending();
+        return -1;
+    }
+
+    return (long) (_flush_ms - age_ms);
+}
+
+void CLogFileSink::write_pending() {
+    if (_pending_bytes == 0) {
+        return;
+    }
+
+    struct iovec iov[IOV_MAX];
+    size_t next = 0;
+
+    while (next < _chunks.size()) {
+        int n = 0;
+
+        while (next + n < _chunks.size() && n < IOV_MAX) {
+            iov[n].iov_base = _chunks[next + n]->_data;
+            iov[n].iov_len = _chunks[next + n]->_len;
+            n++;
+        }
+
+        // a short write leaves the rest of the iovecs for another round
+        int first = 0;
+
+        while (first < n) {
+            ssize_t written = ::writev(_fd, &iov[first], n - first);
+            s_writes.fetch_add(1, std::memory_order_relaxed);
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                // drop what is left of these chunks, logging must not stall on a bad disk
+                s_write_errors.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+
+            s_bytes.fetch_add(written, std::memory_order_relaxed);
+
+            while (first < n && (size_t) written >= iov[first].iov_len) {
+                written -= iov[first].iov_len;
+                first++;
+            }
+
+            if (first < n) {
+                iov[first].iov_base = (char*) iov[first].iov_base + written;
+                iov[first].iov_len -= written;
+            }
+        }
+
+        next += n;
+    }
+
+    for (size_t i = 0; i < _chunks.size(); i++) {
+        if (_free_chunks.size() < LOG_SINK_FREE_CHUNKS) {
+            _free_chunks.push_back(_chunks[i]);
+        } else {
+            delete _chunks[i];
+        }
+    }
+
+    _chunks.clear();
+    _pending_bytes = 0;
+}
+
+void CLogFileSink::crash_write_all() {
+    for (int i = 0; i < LOG_SINK_CRASH_SLOTS; i++) {
+        CLogFileSink* sink = s_crash_sinks[i].load();
+
+        if (sink) {
+            sink->crash_write();
+        }
+    }
+}
+
+void CLogFileSink::crash_write() {
+    // the dispatcher may be in the middle of a batch, take the lengths as they are
+    for (size_t i = 0; i < _chunks.size() && _fd >= 0; i++) {
+        const char* data = _chunks[i]->_data;
+        size_t len = _chunks[i]->_len;
+
+        while (len > 0) {
+            ssize_t written = ::write(_fd, data, len);
+
+            if (written <= 0) {
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                return;
+            }
+
+            data += written;
+            len -= written;
+        }
+    }
+}
@@ -0,0 +1,294 @@
+#include "include/logformat.hpp"
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static std::atomic_int s_line_format(LOG_FORMAT_TEXT);
+
+/*
+ * most bytes of a JSON line the request fields and closing tokens may take,
+ * fields that do not fit are left out whole
+ */
+#define LOG_JSON_TAIL 1024
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+LogLineFormat LOGAPI log_set_line_format(LogLineFormat format) {
+    return (LogLineFormat) s_line_format.exchange(format);
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
+/*
+ * appends str to the line at *pos, truncating at cap - 1
+ */
+static void append_string(char* buf, size_t* pos, size_t cap, const char* str) {
+    size_t len = strlen(str);
+
+    if (*pos + len > cap - 1) {
+        len = cap - 1 - *pos;
+    }
+
+    memcpy(buf + *pos, str, len);
+    *pos += len;
+    buf[*pos] = 0;
+}
+
+/*
+ * pads the line with spaces to the next multiple of align, a full align
+ * when it is aligned already
+ */
+static void align_string(char* buf, size_t* pos, size_t cap, int align) {
+    if (align <= 0) {
+        return;
+    }
+
+    if (align > 8) {
+        align = 8;
+    }
+
+    int append = align - (*pos % align);
+
+    while (append -- && *pos < cap - 1) {
+        buf[(*pos)++] = ' ';
+    }
+
+    buf[*pos] = 0;
+}
+
+const char* log_level_name(LogLevel level) {
+    switch (level) {
+    case DEBUG:
+        return "DEBUG";
+
+    case INFO:
+        return "INFO";
+
+    case NOTICE:
+        return "NOTICE";
+
+    case WARNING:
+        return "WARN";
+
+    case ERROR:
+        return "ERROR";
+
+    case FATAL:
+        return "FATAL";
+
+    case NOTIFY:
+        return "CRIT";
+
+    default:
+        return "NOTSET";
+    }
+}
+
+size_t log_format_body(char* buf, size_t cap, unsigned long thrd_id, const char* module,
+                       const char* title, const char* log) {
+    size_t pos = snprintf(buf, cap < 32 ? cap : 32, "%ld", thrd_id);
+
+    if (pos > cap - 1) {
+        pos = cap - 1;
+    }
+
+    append_string(buf, &pos, cap, " ");
+    align_string(buf, &pos, cap, 4);
+    append_string(buf, &pos, cap, module);
+
+    append_string(buf, &pos, cap, " ");
+    align_string(buf, &pos, cap, 4);
+    append_string(buf, &pos, cap, title);
+
+    append_string(buf, &pos, cap, " ");
+    align_string(buf, &pos, cap, 4);
+    append_string(buf, &pos, cap, log);
+
+    return pos;
+}
+
+/*
+ * localtime_r per line would dominate a batch, the date part only
+ * changes once a second
+ */
+static const char* format_date(long long time_us) {
+    static __thread time_t s_sec = -1;
+    static __thread char s_date[32];
+
+    time_t sec = (time_t) (time_us / 1000000);
+
+    if (sec != s_sec) {
+        struct tm tm_now;
+        localtime_r(&sec, &tm_now);
+        strftime(s_date, sizeof(s_date), "%Y-%m-%d %H:%M:%S", &tm_now);
+        s_sec = sec;
+    }
+
+    return s_date;
+}
+
+/*
+ * bytes str takes escaped as the inside of a JSON string, see append_json
+ */
+static size_t json_length(const char* str, size_t len) {
+    size_t n = 0;
+
+    for (size_t i = 0; i != len && str[i]; i++) {
+        unsigned char c = str[i];
+
+        if (c == '"' || c == '\\' || c == '\n' || c == '\t') {
+            n += 2;
+        } else if (c < 0x20) {
+            n += 6;
+        } else {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * appends str as the inside of a JSON string, len bytes or up to its 0
+ * for len -1, truncating at cap - 1 between escapes and UTF-8 sequences
+ */
+static void append_json(char* buf, size_t* pos, size_t cap, const char* str, size_t len) {
+    size_t start = *pos;
+    size_t i = 0;
+
+    for (; i != len && str[i] && *pos + 6 < cap; i++) {
+        unsigned char c = str[i];
+
+        if (c == '"' || c == '\\') {
+            buf[(*pos)++] = '\\';
+            buf[(*pos)++] = c;
+        } else if (c == '\n') {
+            buf[(*pos)++] = '\\';
+            buf[(*pos)++] = 'n';
+        } else if (c == '\t') {
+            buf[(*pos)++] = '\\';
+            buf[(*pos)++] = 't';
+        } else if (c < 0x20) {
+            *pos += snprintf(buf + *pos, cap - *pos, "\\u%04x", c);
+        } else {
+            buf[(*pos)++] = c;
+        }
+    }
+
+    // cut short, drop a multibyte character that did not fit whole
+    if (i != len && str[i]) {
+        size_t lead = *pos;
+
+        while (lead > start && ((unsigned char) buf[lead - 1] & 0xC0) == 0x80) {
+            lead--;
+        }
+
+        if (lead > start && (unsigned char) buf[lead - 1] >= 0xC0) {
+            unsigned char c = buf[lead - 1];
+            size_t want = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+
+            if (*pos - (lead - 1) < want) {
+                *pos = lead - 1;
+            }
+        }
+    }
+
+    buf[*pos] = 0;
+}
+
+size_t log_format_line(char* buf, size_t cap, const log_record_t* rec) {
+    // leave room for the newline
+    size_t pos = snprintf(buf, cap - 1, "%s,%03d\t[%lu]\t%s\t", format_date(rec->_time_us),
+                          (int) (rec->_time_us / 1000 % 1000), rec->_thrd_id,
+                          log_level_name(rec->_level));
+
+    if (pos > cap - 2) {
+        pos = cap - 2;
+    }
+
+    pos += log_format_body(buf + pos, cap - 1 - pos, rec->_thrd_id, rec->_module,
+                           rec->_title, rec->_log);
+
+    if (rec->_ctx) {
+        append_string(buf, &pos, cap - 1, "\t");
+        append_string(buf, &pos, cap - 1, rec->_ctx);
+    }
+
+    buf[pos++] = '\n';
+    buf[pos] = 0;
+    return pos;
+}
+
+size_t log_format_json(char* buf, size_t cap, const log_record_t* rec) {
+    /*
+     * the closing quote of msg, the request fields and the brace go first,
+     * so a long message is what gets cut and the line stays one object
+     */
+    char tail[LOG_JSON_TAIL];
+    size_t tail_cap = cap / 2 < sizeof(tail) ? cap / 2 : sizeof(tail);
+    size_t tail_len = 0;
+
+    append_string(tail, &tail_len, tail_cap, "\"");
+
+    // the request fields as string members, "key=value" separated by spaces
+    const char* field = rec->_ctx;
+    const char* fields_end = field ? field + rec->_ctx_len : 0;
+
+    while (field && field < fields_end) {
+        const char* next = (const char*) memchr(field, ' ', fields_end - field);
+        const char* value_end = next ? next : fields_end;
+        const char* eq = (const char*) memchr(field, '=', value_end - field);
+
+        // ,"key":"value" and the brace after it
+        if (eq && eq > field && tail_len + 7 + json_length(field, eq - field)
+                + json_length(eq + 1, value_end - eq - 1) < tail_cap) {
+            append_string(tail, &tail_len, tail_cap, ",\"");
+            append_json(tail, &tail_len, tail_cap, field, eq - field);
+            append_string(tail, &tail_len, tail_cap, "\":\"");
+            append_json(tail, &tail_len, tail_cap, eq + 1, value_end - eq - 1);
+            append_string(tail, &tail_len, tail_cap, "\"");
+        }
+
+        field = next ? next + 1 : 0;
+    }
+
+    tail[tail_len++] = '}';
+
+    // leave room for the tail and the newline
+    size_t end = cap - tail_len - 1;
+    // and for the keys up to msg while writing module and title
+    size_t head_end = end - 24;
+    size_t pos = snprintf(buf, head_end, "{\"time\":\"%s,%03d\",\"thread\":%lu,\"level\":\"%s\","
+                          "\"module\":\"", format_date(rec->_time_us),
+                          (int) (rec->_time_us / 1000 % 1000), rec->_thrd_id,
+                          log_level_name(rec->_level));
+
+    if (pos > head_end - 1) {
+        pos = head_end - 1;
+    }
+
+    append_json(buf, &pos, head_end, rec->_module, (size_t) -1);
+    append_string(buf, &pos, end, "\",\"title\":\"");
+    append_json(buf, &pos, head_end, rec->_title, (size_t) -1);
+    append_string(buf, &pos, end, "\",\"msg\":\"");
+    append_json(buf, &pos, end, rec->_log, rec->_log_len);
+
+    memcpy(buf + pos, tail, tail_len);
+    pos += tail_len;
+    buf[pos++] = '\n';
+    buf[pos] = 0;
+    return pos;
+}
+
+size_t log_format_record(char* buf, size_t cap, const log_record_t* rec) {
+    if (s_line_format.load(std::memory_order_relaxed) == LOG_FORMAT_JSON) {
+        return log_format_json(buf, cap, rec);
+    }
+
+    return log_format_line(buf, cap, rec);
+}
@@ -1,12 +1,101 @@
 #include "include/logimpl.hpp"
+#include "include/lograte.hpp"
 #include <scopedlock.hpp>
+#include <aip_time.hpp>
+#include <algorithm>
 #ifdef WIN32
 #include <atlconv.h>
 #else
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #endif
 
+/*
+ * log items a producer thread can have queued at one dispatcher before
+ * the overflow policy applies, what the shared queue of producers without
+ * a ring holds, and how many items a dispatcher takes per wakeup
+ */
+#define LOG_RING_CAPACITY (1 << 12)
+#define LOG_QUEUE_CAPACITY (1 << 16)
+#define LOG_DISPATCH_BATCH 256
+
+/*
+ * rings one producer thread keeps, one per dispatcher it logs to
+ */
+#define LOG_RING_CACHE 8
+
+/*
+ * ERROR and FATAL go through a lane of their own that the dispatcher
+ * drains before anything else, so a burst of NOTICE lines does not hold
+ * them back. A FATAL log waits up to LOG_FATAL_FLUSH_MS for the lane to
+ * be delivered and the receivers flushed.
+ */
+#define LOG_URGENT_LEVELS (ERROR | FATAL)
+#define LOG_URGENT_CAPACITY (1 << 12)
+#define LOG_FATAL_FLUSH_MS 50
+
+/*
+ * LOG_OVERFLOW_DROP_LOW starts dropping DEBUG/INFO at this depth of a
+ * queue, LOG_OVERFLOW_SPILL holds at most this much log text aside
+ */
+#define LOG_QUEUE_HIGH_WATERMARK(capacity) ((capacity) / 4 * 3)
+#define LOG_SPILL_MAX_BYTES (64 << 20)
+
+static std::atomic_int s_overflow_policy(LOG_OVERFLOW_DROP_LOW);
+static std::atomic_int s_block_timeout_us(10000);
+
+static std::atomic<unsigned long long> s_dropped(0);
+static std::atomic<unsigned long long> s_dropped_low(0);
+static std::atomic<unsigned long long> s_block_timeouts(0);
+static std::atomic<unsigned long long> s_spilled(0);
+
+static std::atomic_int s_binary_on(0);
+
+static std::atomic<log_context_callback_t> s_context_callback(0);
+
+static std::atomic<unsigned long> s_next_thread_id(1);
+
+/*
+ * the rings of the calling producer thread, by dispatcher. Closed when
+ * the thread exits, the dispatcher then drains and drops them.
+ */
+struct LogRingCache {
+    struct Slot {
+        unsigned long _owner;
+        CLogRing* _ring;
+    };
+
+    Slot _slots[LOG_RING_CACHE];
+    int _b_exiting;
+
+    LogRingCache() : _b_exiting(0) {
+        memset(_slots, 0, sizeof(_slots));
+    }
+    ~LogRingCache() {
+        // logs from later destructors go to the shared queues
+        _b_exiting = 1;
+
+        for (int i = 0; i < LOG_RING_CACHE; i++) {
+            if (_slots[i]._ring) {
+                _slots[i]._ring->close();
+                _slots[i]._ring->release();
+                _slots[i]._ring = 0;
+            }
+        }
+    }
+};
+
+static thread_local LogRingCache s_ring_cache;
+
+/*
+ * a route is the bit set of dedicated threads in the low bits and the
+ * generation it was made under in the rest, so it is one atomic value
+ */
+#define LOG_ROUTE_THREADS 40
+#define LOG_ROUTE_THREAD_MASK ((1ULL << LOG_ROUTE_THREADS) - 1)
+#define LOG_ROUTE_GEN_MAX ((1U << (64 - LOG_ROUTE_THREADS)) - 1)
+
 CLogImpl* CLogImpl::_s_instance = 0;
 
 #if defined(__cplusplus)
@@ -34,6 +123,7 @@ int log_term() {
             printf("CLogImpl::instance() is NULL!\n");
             return 0;
         }
+        CLogRateLimiter::sweep(1);
         n_ret = CLogImpl::instance()->stop();
         CLogImpl::release();
     }
@@ -50,38 +140,94 @@ void append_log(LogLevel level, const char* module, const char* log_title,
     CLogImpl::instance()->append_log(level, module, log_title, log);
 }
 
-#if defined(__cplusplus)
-};
-#endif
+void LOGAPI log_flush(int timeout_ms) {
+    if (is_log_valid()) {
+        // pending "repeated" and "suppressed" summaries are part of what was logged
+        CLogRateLimiter::sweep(1);
+        CLogImpl::instance()->flush(timeout_ms);
+    }
+}
 
-LogItem::LogItem()
-    : _n_ref(1) {
+LogOverflowPolicy LOGAPI log_set_overflow_policy(LogOverflowPolicy policy, int block_timeout_us) {
+    if (block_timeout_us >= 0) {
+        s_block_timeout_us = block_timeout_us;
+    }
+    return (LogOverflowPolicy) s_overflow_policy.exchange(policy);
+}
 
+int LOGAPI is_log_binary() {
+    return s_binary_on.load(std::memory_order_relaxed);
 }
 
+void LOGAPI log_binary_append(LogLevel level, unsigned int fmt_id, const void* args, size_t len) {
+    // acquire pairs with register_binary_receiver, _binary_thrd is set by then
+    if (s_binary_on.load(std::memory_order_acquire) && is_log_level_enabled(level)) {
+        CLogImpl::instance()->append_binary(level, fmt_id, args, len);
+    }
+}
+
+LogOverflowPolicy LOGAPI log_get_overflow_policy() {
+    return (LogOverflowPolicy) s_overflow_policy.load();
+}
+
+log_context_callback_t LOGAPI log_set_context_callback(log_context_callback_t callback) {
+    return s_context_callback.exchange(callback);
+}
+
+void LOGAPI log_get_overflow_stats(log_overflow_stats_t* stats) {
+    stats->_dropped = s_dropped.load(std::memory_order_relaxed);
+    stats->_dropped_low = s_dropped_low.load(std::memory_order_relaxed);
+    stats->_block_timeouts = s_block_timeouts.load(std::memory_order_relaxed);
+    stats->_spilled = s_spilled.load(std::memory_order_relaxed);
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
 void LogItem::add_ref() {
     _n_ref++;
 }
 
 void LogItem::release() {
     if (--_n_ref == 0) {
-        delete this;
+        CLogItemPool::free(this);
     }
 }
 
 LogReceiver::LogReceiver()
     : _b_dedicated_thread(0)
-    , _str_title("*") {
+    , _str_title("*")
+    , _b_match_all(1)
+    , _b_re_valid(0) {
     memset(&_recv, 0, sizeof(log_receiver_t));
     memset(&_re_title, 0, sizeof(regex_t));
 }
 
 LogReceiver::~LogReceiver() {
-    regfree(&_re_title);
+    if (_b_re_valid) {
+        regfree(&_re_title);
+    }
+}
+
+static void fill_record(log_record_t* rec, LogItem* li) {
+    rec->_level = li->_e_level;
+    rec->_module = li->_module;
+    rec->_title = li->_title;
+    rec->_log = li->_log;
+    rec->_log_len = li->_n_log_len;
+    rec->_thrd_id = li->_n_thrd_id;
+    rec->_time_us = li->_n_time_us;
+    rec->_ctx = li->_ctx;
+    rec->_ctx_len = li->_n_ctx_len;
 }
 
 int LogReceiver::match(LogItem* li) {
-    return 0 == regexec(&this->_re_title, li->_str_title.c_str(), 0, 0, 0);
+    if (_b_match_all) {
+        return 1;
+    }
+
+    return _b_re_valid && 0 == regexec(&this->_re_title, li->_title, 0, 0, 0);
 }
 
 CLogThread::CLogThread()
@@ -94,24 +240,69 @@ CLogThread::CLogThread()
     , _ev_stopped(false, true)
     , _log_sync(0, 0x7fffffff)
     , _b_started(0)
-    , _n_thrd_started(0) {
+    , _logs(LOG_QUEUE_CAPACITY)
+    , _urgent(LOG_URGENT_CAPACITY)
+    , _b_urgent_left(0)
+    , _recv_set(new LogReceiverSet())
+    , _ring_set(new LogRingSet())
+    , _n_id(s_next_thread_id++)
+    , _n_spill_taken_pos(0)
+    , _inflight(LOG_DISPATCH_BATCH)
+    , _n_inflight_next(0)
+    , _n_inflight_count(0)
+    , _n_flush_req(0)
+    , _n_flush_done(0)
+    , _n_thrd_started(0)
+    , _n_waiting(0)
+    , _spill_bytes(0)
+    , _n_spilled(0) {
 
 }
 
 CLogThread::~CLogThread() {
     stop();
 
-    CScopedLock lc(&_lock_recvs);
+    LogReceiverSet* set = _recv_set.exchange(0);
+
+    for (size_t i = 0; i < set->_recvs.size(); i++) {
+        delete set->_recvs[i];
+    }
+
+    delete set;
 
-    while (_log_receivers.begin() != _log_receivers.end()) {
-        delete *_log_receivers.begin();
-        _log_receivers.erase(_log_receivers.begin());
+    // a producer still holding one of the rings lets go on its next log or exit
+    LogRingSet* rings = _ring_set.exchange(0);
+
+    for (size_t i = 0; i < rings->_rings.size(); i++) {
+        rings->_rings[i]->detach();
+        rings->_rings[i]->release();
     }
+
+    delete rings;
+}
+
+static void delete_ring_set(void* p) {
+    delete static_cast<LogRingSet*>(p);
+}
+
+static void release_ring(void* p) {
+    static_cast<CLogRing*>(p)->release();
+}
+
+static void delete_receiver_set(void* p) {
+    delete static_cast<LogReceiverSet*>(p);
+}
+
+static void delete_receiver(void* p) {
+    delete static_cast<LogReceiver*>(p);
 }
 
 int CLogThread::check_recv(LogReceiver* recv) {
-    for (std::vector<LogReceiver*>::const_iterator it = _log_receivers.begin();
-            it != _log_receivers.end();
+    CLogEpochGuard guard;
+    const LogReceiverSet* set = receivers();
+
+    for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+            it != set->_recvs.end();
             it ++) {
         if (0 == memcmp(&recv->_recv, &(*it)->_recv, sizeof(log_receiver_t))) {
             return 1;
@@ -123,26 +314,40 @@ int CLogThread::check_recv(LogReceiver* recv) {
 
 int CLogThread::register_receiver(LogReceiver* lr) {
     CScopedLock lc(&_lock_recvs);
-    CScopedLock lc2(&_lock_disp);
 
     if (check_recv(lr)) {
         return 1;
     }
 
-    _log_receivers.insert(_log_receivers.begin(), lr);
+    LogReceiverSet* old = _recv_set.load();
+    LogReceiverSet* set = new LogReceiverSet(*old);
+    set->_recvs.insert(set->_recvs.begin(), lr);
+    _recv_set.store(set);
+
+    // the dispatcher may still walk the old set, it goes once it is done
+    CLogEpoch::retire(old, &delete_receiver_set);
     return 0;
 }
 
 int CLogThread::unregister_receiver(log_receiver_t* recv) {
     CScopedLock lc(&_lock_recvs);
-    CScopedLock lc2(&_lock_disp);
-
-    for (std::vector<LogReceiver*>::iterator it = _log_receivers.begin();
-            it != _log_receivers.end();
-            it ++) {
-        if (0 == memcmp(recv, &(*it)->_recv, sizeof(log_receiver_t))) {
-            delete *it;
-            _log_receivers.erase(it);
+    LogReceiverSet* old = _recv_set.load();
+
+    for (size_t i = 0; i < old->_recvs.size(); i++) {
+        LogReceiver* lr = old->_recvs[i];
+
+        if (0 == memcmp(recv, &lr->_recv, sizeof(log_receiver_t))) {
+            LogReceiverSet* set = new LogReceiverSet(*old);
+            set->_recvs.erase(set->_recvs.begin() + i);
+            _recv_set.store(set);
+
+            /*
+             * the caller frees what the receiver uses once this returns, so
+             * wait out a delivery to it in progress on another thread
+             */
+            CLogEpoch::synchronize();
+            CLogEpoch::retire(old, &delete_receiver_set);
+            CLogEpoch::retire(lr, &delete_receiver);
             return 1;
         }
     }
@@ -166,62 +371,479 @@ void* CLogThread::log_dispatcher_thrd(void* arg) {
 void CLogThread::dispatch() {
     _b_started = true;
 #ifdef WIN32
-    HANDLE h_notifies[] = {_log_sync, _ev_quit};
     _interlocked_increment(&_n_thrd_started);
 #else
     _n_thrd_started = 1;
 #endif
 
     printf("LOG start do dispatch\n");
-#ifdef WIN32
-
-    while (WAIT_OBJECT_0 == ::WaitForMultipleObjects(2, &h_notifies[0], 0, INFINITE)) {
-#else
 
     while (!_ev_quit.wait(0)) {
-        if (!_log_sync.wait(1000)) {
-            continue;
+        /*
+         * read before the batch: a flush asked for by now has its urgent
+         * log in the lane already, and the batch takes the lane first
+         */
+        unsigned int flush_req = _n_flush_req.load();
+        size_t count = dispatch_batch();
+
+        if (flush_req != _n_flush_done.load(std::memory_order_relaxed) && !_b_urgent_left) {
+            flush_receivers(1);
+            _n_flush_done = flush_req;
         }
 
-#endif
-        LogItem* li = 0;
-        {
-            CScopedLock lc(&_lock_logs);
+        if (count == 0) {
+            // the queue ran empty, a good time to write out buffered batches
+            long due_ms = flush_receivers(0);
+
+            /*
+             * announce the sleep before the last look at the queue, a producer
+             * either sees _n_waiting and signals or pushed before that look
+             */
+            _n_waiting = 1;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
 
-            if (_logs.size() > 0) {
-                li = _logs.front();
-                _logs.erase(_logs.begin());
+            if (queues_empty() && _n_flush_req == _n_flush_done) {
+                _log_sync.wait(due_ms > 0 && due_ms < 1000 ? due_ms : 1000);
             }
-        }
 
-        if (li) {
-            do_dispatch(li);
-            li->release();
+            _n_waiting = 0;
         }
     }
+
+    /*
+     * deliver what was queued before the quit, e.g. the last fatal log
+     */
+    while (dispatch_batch() > 0) {
+    }
+    flush_receivers(1);
+    _n_flush_done = _n_flush_req.load();
     printf("LOG stop dispatching\n");
 
     _ev_stopped.set_event();
 }
 
 void CLogThread::do_dispatch(LogItem* item) {
+    // no dispatcher thread, producers deliver themselves one at a time
     CScopedLock lc(&_lock_disp);
-    for (std::vector<LogReceiver*>::const_iterator it = _log_receivers.begin();
-            it != _log_receivers.end();
+    CLogEpochGuard guard;
+    const LogReceiverSet* set = receivers();
+
+    for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+            it != set->_recvs.end();
             it ++) {
-        if (call_receiver(*it, item)) {
+        LogReceiver* recv = *it;
+
+        if (recv->_recv._receive_batch) {
+            // no dispatcher to flush later, write through
+            recv->_batch.resize(1);
+            fill_record(&recv->_batch[0], item);
+            call_batch_receiver(recv);
+
+            if (recv->_recv._flush) {
+                recv->_recv._flush(1, recv->_recv._usr_data);
+            }
+        } else if (call_receiver(recv, item)) {
             return;
         }
     }
 }
 
+size_t CLogThread::dispatch_batch() {
+    LogItem** items = &_inflight[0];
+    size_t count = pop_batch(items, LOG_DISPATCH_BATCH);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    _n_inflight_next.store(0, std::memory_order_relaxed);
+    _n_inflight_count.store(count, std::memory_order_release);
+
+    // one set for the whole batch, unregistering waits for it to be delivered
+    CLogEpochGuard guard;
+    const LogReceiverSet* set = receivers();
+
+    // batch receivers only get the records at the end, nothing is delivered before
+    bool batched = false;
+
+    for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+            it != set->_recvs.end();
+            it ++) {
+        batched = batched || (*it)->_recv._receive_batch != NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+                it != set->_recvs.end();
+                it ++) {
+            LogReceiver* recv = *it;
+
+            if (recv->_recv._receive_batch) {
+                recv->_batch.resize(recv->_batch.size() + 1);
+                fill_record(&recv->_batch.back(), items[i]);
+            } else if (call_receiver(recv, items[i])) {
+                break;
+            }
+        }
+
+        if (!batched) {
+            _n_inflight_next.store(i + 1, std::memory_order_release);
+        }
+    }
+
+    // the records point into the items, release them only after the batches
+    for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+            it != set->_recvs.end();
+            it ++) {
+        call_batch_receiver(*it);
+    }
+
+    _n_inflight_count.store(0, std::memory_order_release);
+
+    for (size_t i = 0; i < count; i++) {
+        items[i]->release();
+    }
+
+    return count;
+}
+
+long CLogThread::flush_receivers(int force) {
+    CLogEpochGuard guard;
+    const LogReceiverSet* set = receivers();
+    long due_ms = -1;
+
+    for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+            it != set->_recvs.end();
+            it ++) {
+        LogReceiver* recv = *it;
+
+        if (recv->_recv._flush) {
+            long ms = recv->_recv._flush(force, recv->_recv._usr_data);
+
+            if (ms >= 0 && (due_ms < 0 || ms < due_ms)) {
+                due_ms = ms;
+            }
+        }
+    }
+
+    return due_ms;
+}
+
+void CLogThread::flush(long timeout_ms) {
+#ifndef WIN32
+    if (!_n_thrd_started || !_p_thread || pthread_equal(_p_thread, pthread_self())) {
+        return;
+    }
+
+    long long deadline_ms = monotonic_time_ms() + timeout_ms;
+
+    while (!queues_empty() && monotonic_time_ms() < deadline_ms) {
+        wake_dispatcher();
+        usleep(1000);
+    }
+
+    wait_flushed(deadline_ms);
+#endif
+}
+
+void CLogThread::flush_urgent(long timeout_ms) {
+#ifndef WIN32
+    // a receiver logging FATAL from the dispatcher cannot wait for it
+    if (!_n_thrd_started || !_p_thread || pthread_equal(_p_thread, pthread_self())) {
+        return;
+    }
+
+    wait_flushed(monotonic_time_ms() + timeout_ms);
+#endif
+}
+
+void CLogThread::wait_flushed(long long deadline_ms) {
+#ifndef WIN32
+    // the dispatcher finishes the batch in delivery, then pushes buffered output out
+    unsigned int ticket = ++_n_flush_req;
+    wake_dispatcher();
+
+    for (int spins = 0; (int) (_n_flush_done.load() - ticket) < 0 && _n_thrd_started
+            && monotonic_time_ms() < deadline_ms; spins++) {
+        if (spins < 16) {
+            sched_yield();
+        } else {
+            wake_dispatcher();
+            usleep(spins < 64 ? 50 : 1000);
+        }
+    }
+#endif
+}
+
+void CLogThread::visit_queued(void (*fn)(const LogItem* li, void* arg), void* arg) {
+    // what the dispatcher took and has not delivered yet is the oldest
+    size_t count = _n_inflight_count.load(std::memory_order_acquire);
+
+    for (size_t i = _n_inflight_next.load(std::memory_order_acquire); i < count; i++) {
+        fn(_inflight[i], arg);
+    }
+
+    _urgent.visit(fn, arg);
+
+    // no epoch guard, the crashing thread may hold one already
+    const LogRingSet* set = _ring_set.load();
+
+    for (size_t i = 0; set && i < set->_rings.size(); i++) {
+        set->_rings[i]->visit(fn, arg);
+    }
+
+    _logs.visit(fn, arg);
+
+    for (size_t i = _n_spill_taken_pos; i < _spill_taken.size(); i++) {
+        fn(_spill_taken[i], arg);
+    }
+
+    for (std::deque<LogItem*>::const_iterator it = _spill.begin(); it != _spill.end(); it++) {
+        fn(*it, arg);
+    }
+}
+
+size_t CLogThread::pop_batch(LogItem** items, size_t max_items) {
+    CLogEpochGuard guard;
+    const LogRingSet* set = _ring_set.load();
+    size_t rings = set->_rings.size();
+
+    size_t count = 0;
+
+    // the urgent lane goes first, it is in order by itself
+    while (count < max_items) {
+        LogItem* li = _urgent.peek();
+
+        if (!li) {
+            break;
+        }
+
+        items[count++] = li;
+        _urgent.pop();
+    }
+
+    _b_urgent_left = count == max_items;
+
+    // sources are the rings, then the shared queue, then the spill buffer
+    _merge.clear();
+
+    for (size_t i = 0; i <= rings + 1; i++) {
+        LogItem* li = i < rings ? set->_rings[i]->peek() : i == rings ? _logs.peek() : spill_peek();
+
+        if (li) {
+            MergeHead head = { li->_n_mono_us, i, li };
+            _merge.push_back(head);
+        }
+    }
+
+    // a min heap on the time, the source breaks ties so a ring stays in order
+    struct Later {
+        bool operator()(const MergeHead& a, const MergeHead& b) const {
+            return a._mono_us != b._mono_us ? a._mono_us > b._mono_us : a._source > b._source;
+        }
+    };
+
+    std::make_heap(_merge.begin(), _merge.end(), Later());
+
+    while (count < max_items && !_merge.empty()) {
+        std::pop_heap(_merge.begin(), _merge.end(), Later());
+        MergeHead& head = _merge.back();
+        LogItem* next = 0;
+
+        items[count++] = head._item;
+
+        if (head._source < rings) {
+            set->_rings[head._source]->pop();
+            next = set->_rings[head._source]->peek();
+        } else if (head._source == rings) {
+            _logs.pop();
+            next = _logs.peek();
+        } else {
+            _n_spill_taken_pos++;
+            _n_spilled--;
+            next = spill_peek();
+        }
+
+        if (next) {
+            head._mono_us = next->_n_mono_us;
+            head._item = next;
+            std::push_heap(_merge.begin(), _merge.end(), Later());
+        } else {
+            _merge.pop_back();
+        }
+    }
+
+    if (count < max_items) {
+        reclaim_rings(set);
+    }
+
+    return count;
+}
+
+LogItem* CLogThread::spill_peek() {
+    if (_n_spill_taken_pos == _spill_taken.size()) {
+        _spill_taken.clear();
+        _n_spill_taken_pos = 0;
+
+        if (_n_spilled == 0) {
+            return 0;
+        }
+
+        CScopedLock lc(&_lock_spill);
+
+        while (_spill_taken.size() < LOG_DISPATCH_BATCH && !_spill.empty()) {
+            LogItem* li = _spill.front();
+            _spill.pop_front();
+            _spill_bytes -= sizeof(LogItem) + li->capacity();
+            _spill_taken.push_back(li);
+        }
+
+        if (_spill_taken.empty()) {
+            return 0;
+        }
+    }
+
+    return _spill_taken[_n_spill_taken_pos];
+}
+
+void CLogThread::reclaim_rings(const LogRingSet* set) {
+    std::vector<CLogRing*> drained;
+
+    for (size_t i = 0; i < set->_rings.size(); i++) {
+        CLogRing* ring = set->_rings[i];
+
+        // closed first, a ring seen closed has all its pushes visible
+        if (ring->closed() && ring->empty()) {
+            drained.push_back(ring);
+        }
+    }
+
+    if (drained.empty()) {
+        return;
+    }
+
+    CScopedLock lc(&_lock_rings);
+    LogRingSet* old = _ring_set.load();
+    LogRingSet* now = new LogRingSet();
+
+    for (size_t i = 0; i < old->_rings.size(); i++) {
+        if (std::find(drained.begin(), drained.end(), old->_rings[i]) == drained.end()) {
+            now->_rings.push_back(old->_rings[i]);
+        }
+    }
+
+    _ring_set.store(now);
+    CLogEpoch::retire(old, &delete_ring_set);
+
+    // flush() may still be looking at them
+    for (size_t i = 0; i < drained.size(); i++) {
+        CLogEpoch::retire(drained[i], &release_ring);
+    }
+}
+
+int CLogThread::queues_empty() {
+    if (_urgent.size() > 0 || _logs.size() > 0 || _n_spilled > 0) {
+        return 0;
+    }
+
+    CLogEpochGuard guard;
+    const LogRingSet* set = _ring_set.load();
+
+    for (size_t i = 0; i < set->_rings.size(); i++) {
+        if (!set->_rings[i]->empty()) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+CLogRing* CLogThread::producer_ring() {
+    LogRingCache& cache = s_ring_cache;
+
+    if (cache._b_exiting) {
+        return 0;
+    }
+
+    LogRingCache::Slot* free_slot = 0;
+
+    for (int i = 0; i < LOG_RING_CACHE; i++) {
+        LogRingCache::Slot& slot = cache._slots[i];
+
+        if (slot._ring && slot._owner == _n_id) {
+            return slot._ring;
+        }
+
+        // the dispatcher of this ring is gone
+        if (slot._ring && slot._ring->detached()) {
+            slot._ring->release();
+            slot._ring = 0;
+        }
+
+        if (!slot._ring && !free_slot) {
+            free_slot = &slot;
+        }
+    }
+
+    if (!free_slot) {
+        return 0;
+    }
+
+    // one reference for this thread, one for the ring set
+    CLogRing* ring = new CLogRing(LOG_RING_CAPACITY);
+    ring->add_ref();
+    {
+        CScopedLock lc(&_lock_rings);
+        LogRingSet* old = _ring_set.load();
+        LogRingSet* set = new LogRingSet(*old);
+        set->_rings.push_back(ring);
+        _ring_set.store(set);
+        CLogEpoch::retire(old, &delete_ring_set);
+    }
+
+    free_slot->_owner = _n_id;
+    free_slot->_ring = ring;
+    return ring;
+}
+
+void CLogThread::call_batch_receiver(LogReceiver* recv) {
+    if (recv->_batch.empty()) {
+        return;
+    }
+
+#ifdef WIN32
+
+    __try {
+#endif
+        recv->_recv._receive_batch(&recv->_batch[0], recv->_batch.size(), recv->_recv._usr_data);
+#ifdef WIN32
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+    }
+
+#endif
+    recv->_batch.clear();
+}
+
 int CLogThread::call_receiver(LogReceiver* recv, LogItem* item) {
+    const char* log = item->_log;
+
+    // a receiver of single logs gets the request fields as part of the text
+    if (item->_ctx) {
+#ifdef WIN32
+        static __declspec(thread) char text[LOG_MAX_LINE + 256];
+#else
+        static __thread char text[LOG_MAX_LINE + 256];
+#endif
+        snprintf(text, sizeof(text), "%s\t%s", item->_log, item->_ctx);
+        log = text;
+    }
+
 #ifdef WIN32
 
     __try {
 #endif
-        return recv->_recv._receive_log(item->_e_level, item->_str_module.c_str(),
-                                        item->_str_title.c_str(), item->_str_log.c_str(), item->_n_thrd_id,
+        return recv->_recv._receive_log(item->_e_level, item->_module,
+                                        item->_title, log, item->_n_thrd_id,
                                         recv->_recv._usr_data);
 #ifdef WIN32
     } __except (EXCEPTION_EXECUTE_HANDLER) {
@@ -323,9 +945,18 @@ int CLogThread::stop() {
         }
     }
 
-    while (_logs.begin() != _logs.end()) {
-        (*_logs.begin())->release();
-        _logs.erase(_logs.begin());
+    /*
+     * nothing consumes the queue any more, later logs are dispatched inline
+     */
+    _n_thrd_started = 0;
+
+    LogItem* items[LOG_DISPATCH_BATCH];
+    size_t count = 0;
+
+    while ((count = pop_batch(items, LOG_DISPATCH_BATCH)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            items[i]->release();
+        }
     }
 
     while (_log_sync.wait(0)) {
@@ -336,35 +967,128 @@ int CLogThread::stop() {
 }
 
 void CLogThread::append_log(LogItem* li) {
-    unsigned long remains = 0;
+    if (!_n_thrd_started) {
+        do_dispatch(li);
+        return;
+    }
 
-    if (_n_thrd_started) {
-        CScopedLock lc(&_lock_logs);
-        li->add_ref();
-        _logs.push_back(li);
+    li->add_ref();
 
-        remains = _log_sync.signal();
-    } else {
-        do_dispatch(li);
+    if (!enqueue(li)) {
+        li->release();
+        s_dropped.fetch_add(1, std::memory_order_relaxed);
     }
 
+    wake_dispatcher();
+
+    if (li->_e_level == FATAL) {
+        flush_urgent(LOG_FATAL_FLUSH_MS);
+    }
+}
+
+int CLogThread::enqueue(LogItem* li) {
+    // ahead of everything queued, the normal lanes take it if the lane is full
+    if ((li->_e_level & LOG_URGENT_LEVELS) && _urgent.push(li)) {
+        return 1;
+    }
+
+    int policy = s_overflow_policy.load(std::memory_order_relaxed);
+
     /*
-    * avoid invoke blast
-    */
-    if (remains != 0) {
+     * once logs are spilled the newer ones follow them, to keep the order
+     */
+    if (policy == LOG_OVERFLOW_SPILL && _n_spilled > 0) {
+        return spill(li);
+    }
+
+    CLogRing* ring = producer_ring();
+
+    if (policy == LOG_OVERFLOW_DROP_LOW && (li->_e_level & (DEBUG | INFO))) {
+        size_t depth = ring ? ring->size() : _logs.size();
+        size_t capacity = ring ? ring->capacity() : _logs.capacity();
+
+        if (depth >= LOG_QUEUE_HIGH_WATERMARK(capacity)) {
+            s_dropped_low.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    if (push(ring, li)) {
+        return 1;
+    }
+
+    switch (policy) {
+    case LOG_OVERFLOW_BLOCK:
+        return push_blocking(ring, li);
+
+    case LOG_OVERFLOW_SPILL:
+        return spill(li);
+
+    default:
+        return 0;
+    }
+}
+
+int CLogThread::push_blocking(CLogRing* ring, LogItem* li) {
+    long long deadline_us = monotonic_time_us() + s_block_timeout_us.load(std::memory_order_relaxed);
+
+    for (int spins = 0; ; spins++) {
+        /*
+         * yield first, the dispatcher usually frees room quickly
+         */
 #ifdef WIN32
-        Sleep(remains);
+        Sleep(spins < 16 ? 0 : 1);
 #else
-        usleep(remains);
+        if (spins < 16) {
+            sched_yield();
+        } else {
+            usleep(50);
+        }
 #endif
+
+        if (push(ring, li)) {
+            return 1;
+        }
+
+        if (monotonic_time_us() >= deadline_us) {
+            s_block_timeouts.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+    }
+}
+
+int CLogThread::spill(LogItem* li) {
+    size_t bytes = sizeof(LogItem) + li->capacity();
+    CScopedLock lc(&_lock_spill);
+
+    if (_spill_bytes + bytes > LOG_SPILL_MAX_BYTES) {
+        return 0;
+    }
+
+    _spill.push_back(li);
+    _spill_bytes += bytes;
+    _n_spilled++;
+    s_spilled.fetch_add(1, std::memory_order_relaxed);
+    return 1;
+}
+
+void CLogThread::wake_dispatcher() {
+    /*
+     * pairs with the fence in dispatch()
+     */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (_n_waiting.exchange(0)) {
+        _log_sync.signal();
     }
 }
 
 int CLogThread::match(LogItem* li) {
-    CScopedLock lc(&_lock_recvs);
+    CLogEpochGuard guard;
+    const LogReceiverSet* set = receivers();
 
-    for (std::vector<LogReceiver*>::const_iterator it = _log_receivers.begin();
-            it != _log_receivers.end();
+    for (std::vector<LogReceiver*>::const_iterator it = set->_recvs.begin();
+            it != set->_recvs.end();
             it ++) {
         if ((*it)->match(li)) {
             return 1;
@@ -375,12 +1099,15 @@ int CLogThread::match(LogItem* li) {
 }
 
 
-CLogImpl::CLogImpl() {
-
+CLogImpl::CLogImpl()
+    : _thrd_set(new LogThreadSet())
+    , _binary_thrd(0) {
+    _thrd_set.load()->_n_route_gen = 1;
 }
 
 CLogImpl::~CLogImpl() {
-
+    delete _thrd_set.exchange(0);
+    delete _binary_thrd;
 }
 
 CLogImpl* CLogImpl::instance(int create) {
@@ -400,37 +1127,83 @@ void CLogImpl::release() {
 
 void CLogImpl::append_log(LogLevel level, const char* module, const char* log_title,
                               const char* log) {
-    LogItem* li = new LogItem();
+    size_t len = strlen(log);
+    log_context_callback_t context = s_context_callback.load(std::memory_order_relaxed);
+    size_t ctx_len = 0;
+    const char* ctx = context ? context(&ctx_len) : 0;
+
+    // the fields go right behind the text, after its terminating 0
+    LogItem* li = CLogItemPool::alloc(ctx ? len + 1 + ctx_len : len);
+
+    if (!li) {
+        return;
+    }
+
 #ifdef WIN32
     li->_n_thrd_id = GetCurrentThreadId();
 #else
     li->_n_thrd_id = (long)pthread_self();
 #endif
     li->_e_level = level;
-    li->_str_module = module;
-    li->_str_title = log_title;
-    li->_str_log = log;
+    li->_n_time_us = gettimeofday_us();
+    li->_n_mono_us = monotonic_time_us();
+    li->_module = CLogStrings::intern(module);
+    li->_title = CLogStrings::intern(log_title);
+    memcpy(li->_log, log, len + 1);
+    li->_n_log_len = len;
+
+    if (ctx) {
+        char* fields = li->_log + len + 1;
+        memcpy(fields, ctx, ctx_len);
+        fields[ctx_len] = 0;
+        li->_ctx = fields;
+        li->_n_ctx_len = ctx_len;
+    }
 
     append_log(li);
     li->release();
 }
 
-int CLogImpl::register_receiver(log_receiver_t* recv, const char* title,
-                                      int b_dedicated_thread) {
+static void delete_thread_set(void* p) {
+    delete static_cast<CLogImpl::LogThreadSet*>(p);
+}
 
-    printf("LOG register_receiver %s,%d\n", title, b_dedicated_thread);
+static LogReceiver* new_receiver(log_receiver_t* recv, const char* title,
+                                 int b_dedicated_thread) {
     LogReceiver* lr = new LogReceiver();
 
     lr->_b_dedicated_thread = b_dedicated_thread;
     lr->_recv = *recv;
 
+    if (lr->_recv._receive_batch) {
+        lr->_batch.reserve(LOG_DISPATCH_BATCH);
+    }
+
     if (title && *title != 0) {
         lr->_str_title = title;
     } else {
         lr->_str_title = "*";
     }
 
-    regcomp(&lr->_re_title, lr->_str_title.c_str(), REG_EXTENDED | REG_ICASE);
+    lr->_b_match_all = lr->_str_title == "*";
+
+    if (!lr->_b_match_all) {
+        lr->_b_re_valid = 0 == regcomp(&lr->_re_title, lr->_str_title.c_str(),
+                                       REG_EXTENDED | REG_ICASE);
+
+        if (!lr->_b_re_valid) {
+            printf("LOG invalid receiver title %s\n", lr->_str_title.c_str());
+        }
+    }
+
+    return lr;
+}
+
+int CLogImpl::register_receiver(log_receiver_t* recv, const char* title,
+                                      int b_dedicated_thread) {
+
+    printf("LOG register_receiver %s,%d\n", title, b_dedicated_thread);
+    LogReceiver* lr = new_receiver(recv, title, b_dedicated_thread);
 
     if (0 == register_receiver(lr)) {
         return 0;
@@ -442,10 +1215,11 @@ int CLogImpl::register_receiver(log_receiver_t* recv, const char* title,
 
 int CLogImpl::register_receiver(LogReceiver* lr) {
     CScopedLock lc(&_lock_thrds);
+    const LogThreadSet* current = _thrd_set.load();
 
     printf("LOG register_receiver\n");
-    for (std::vector<CLogThread*>::const_iterator it = _thrds.begin();
-            it != _thrds.end();
+    for (std::vector<CLogThread*>::const_iterator it = current->_thrds.begin();
+            it != current->_thrds.end();
             it ++) {
         CLogThread* th = *it;
 
@@ -458,7 +1232,11 @@ int CLogImpl::register_receiver(LogReceiver* lr) {
         CLogThread* th = new CLogThread();
         th->register_receiver(lr);
         th->start();
-        _thrds.push_back(th);
+
+        LogThreadSet* set = new LogThreadSet(*current);
+        set->_thrds.push_back(th);
+        LogThreadSet* old = swap_threads(set);
+        CLogEpoch::retire(old, &delete_thread_set);
         return 0;
     } else {
         return CLogThread::register_receiver(lr);
@@ -468,25 +1246,35 @@ int CLogImpl::register_receiver(LogReceiver* lr) {
 int CLogImpl::unregister_receiver(log_receiver_t* recv) {
     CScopedLock lc(&_lock_thrds);
     printf("LOG unregister_receiver\n");
-    for (std::vector<CLogThread*>::iterator it = _thrds.begin();
-            it != _thrds.end();
+
+    const LogThreadSet* current = _thrd_set.load();
+    LogThreadSet* set = new LogThreadSet();
+    std::vector<CLogThread*> removed;
+
+    for (std::vector<CLogThread*>::const_iterator it = current->_thrds.begin();
+            it != current->_thrds.end();
             it ++) {
-        do {
-            CLogThread* th = *it;
+        CLogThread* th = *it;
 
-            if (th->unregister_receiver(recv)) {
-                th->stop();
-                it = _thrds.erase(it);
-                delete th;
+        if (th->unregister_receiver(recv)) {
+            removed.push_back(th);
+        } else {
+            set->_thrds.push_back(th);
+        }
+    }
 
-                if (it != _thrds.end()) {
-                    continue;
-                }
-            }
-        } while (0);
+    if (removed.empty()) {
+        delete set;
+    } else {
+        LogThreadSet* old = swap_threads(set);
 
-        if (it == _thrds.end()) {
-            break;
+        // producers may still be queueing into the removed threads
+        CLogEpoch::synchronize();
+        delete old;
+
+        for (size_t i = 0; i < removed.size(); i++) {
+            removed[i]->stop();
+            delete removed[i];
         }
     }
 
@@ -494,33 +1282,173 @@ int CLogImpl::unregister_receiver(log_receiver_t* recv) {
 }
 
 void CLogImpl::append_log(LogItem* li) {
-    CScopedLock lc(&_lock_thrds);
+    CLogEpochGuard guard;
+    const LogThreadSet* set = _thrd_set.load();
+
+    if (set->_thrds.size() > LOG_ROUTE_THREADS) {
+        // too many to route by bit set, match each one
+        for (std::vector<CLogThread*>::const_iterator it = set->_thrds.begin();
+                it != set->_thrds.end();
+                it ++) {
+            CLogThread* th = *it;
 
-    for (std::vector<CLogThread*>::const_iterator it = _thrds.begin();
-            it != _thrds.end();
-            it ++) {
-        CLogThread* th = *it;
+            if (th->match(li)) {
+                th->append_log(li);
+            }
+        }
+    } else {
+        uint64_t threads = route(set, li);
 
-        if (th->match(li)) {
-            th->append_log(li);
+        for (size_t i = 0; threads; i++, threads >>= 1) {
+            if (threads & 1) {
+                set->_thrds[i]->append_log(li);
+            }
         }
     }
 
     CLogThread::append_log(li);
 }
 
+uint64_t CLogImpl::route(const LogThreadSet* set, LogItem* li) {
+    uint64_t gen = set->_n_route_gen;
+    uint64_t route = 0;
+
+    if (_routes.find(li->_title, &route) && (route >> LOG_ROUTE_THREADS) == gen) {
+        return route & LOG_ROUTE_THREAD_MASK;
+    }
+
+    // first log of the title since the receivers changed, run the regexes once
+    route = 0;
+
+    for (size_t i = 0; i < set->_thrds.size(); i++) {
+        if (set->_thrds[i]->match(li)) {
+            route |= 1ULL << i;
+        }
+    }
+
+    _routes.insert(li->_title, (gen << LOG_ROUTE_THREADS) | route);
+    return route;
+}
+
+CLogImpl::LogThreadSet* CLogImpl::swap_threads(LogThreadSet* set) {
+    LogThreadSet* old = _thrd_set.load();
+
+    /*
+     * the generation wraps after 2^24 changes, a route cached that long
+     * ago would pass for current again, no process registers that often
+     */
+    set->_n_route_gen = old->_n_route_gen < LOG_ROUTE_GEN_MAX ? old->_n_route_gen + 1 : 1;
+    _thrd_set.store(set);
+    return old;
+}
+
+int CLogImpl::register_binary_receiver(log_receiver_t* recv) {
+    CScopedLock lc(&_lock_thrds);
+
+    if (!_binary_thrd) {
+        _binary_thrd = new CLogThread();
+    }
+
+    LogReceiver* lr = new_receiver(recv, "*", 1);
+
+    if (0 != _binary_thrd->register_receiver(lr)) {
+        delete lr;
+        return 1;
+    }
+
+    _binary_thrd->start();
+    s_binary_on = 1;
+    return 0;
+}
+
+int CLogImpl::unregister_binary_receiver(log_receiver_t* recv) {
+    CScopedLock lc(&_lock_thrds);
+
+    if (!_binary_thrd) {
+        return 0;
+    }
+
+    s_binary_on = 0;
+    int ret = _binary_thrd->unregister_receiver(recv);
+    // records still arriving are dispatched inline to no receiver
+    _binary_thrd->stop();
+    return ret;
+}
+
+void CLogImpl::append_binary(LogLevel level, unsigned int fmt_id, const void* args, size_t len) {
+    LogItem* li = CLogItemPool::alloc(sizeof(fmt_id) + len);
+
+    if (!li) {
+        return;
+    }
+
+#ifdef WIN32
+    li->_n_thrd_id = GetCurrentThreadId();
+#else
+    li->_n_thrd_id = (long)pthread_self();
+#endif
+    li->_e_level = level;
+    li->_n_time_us = gettimeofday_us();
+    li->_n_mono_us = monotonic_time_us();
+    li->_module = "";
+    li->_title = "";
+    memcpy(li->_log, &fmt_id, sizeof(fmt_id));
+    memcpy(li->_log + sizeof(fmt_id), args, len);
+    li->_n_log_len = sizeof(fmt_id) + len;
+    li->_log[li->_n_log_len] = 0;
+
+    _binary_thrd->append_log(li);
+    li->release();
+}
+
+void CLogImpl::flush(long timeout_ms) {
+    CScopedLock lc(&_lock_thrds);
+
+    if (_binary_thrd) {
+        _binary_thrd->flush(timeout_ms);
+    }
+
+    const LogThreadSet* set = _thrd_set.load();
+
+    for (std::vector<CLogThread*>::const_iterator it = set->_thrds.begin();
+            it != set->_thrds.end();
+            it ++) {
+        (*it)->flush(timeout_ms);
+    }
+
+    CLogThread::flush(timeout_ms);
+}
+
+void CLogImpl::visit_queued(void (*fn)(const LogItem* li, void* arg), void* arg) {
+    const LogThreadSet* set = _thrd_set.load();
+
+    for (size_t i = 0; set && i < set->_thrds.size(); i++) {
+        set->_thrds[i]->visit_queued(fn, arg);
+    }
+
+    CLogThread::visit_queued(fn, arg);
+}
+
 int CLogImpl::stop() {
     CScopedLock lc(&_lock_thrds);
+    LogThreadSet* old = swap_threads(new LogThreadSet());
 
-    for (std::vector<CLogThread*>::const_iterator it = _thrds.begin();
-            it != _thrds.end();
+    CLogEpoch::synchronize();
+
+    for (std::vector<CLogThread*>::const_iterator it = old->_thrds.begin();
+            it != old->_thrds.end();
             it ++) {
         CLogThread* th = *it;
         th->stop();
         delete th;
     }
 
-    _thrds.clear();
+    delete old;
+
+    if (_binary_thrd) {
+        s_binary_on = 0;
+        _binary_thrd->stop();
+    }
 
     return CLogThread::stop();
 }
@@ -0,0 +1,450 @@
+#include "include/logmmapsink.hpp"
+#include "include/logarchive.hpp"
+#include "include/logfilesink.hpp"
+#include "include/logformat.hpp"
+#include <aip_time.hpp>
+#include <scopedlock.hpp>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * segments are at least this big, a line never spans two of them
+ */
+#define LOG_MMAP_MIN_SEGMENT (1 << 20)
+
+// after the disk was full, how long the dispatcher waits before it tries again
+#define LOG_MMAP_RETRY_MS 1000
+
+static CLogMmapSink* s_mmap_sink = 0;
+
+static std::atomic<unsigned long long> s_records(0);
+static std::atomic<unsigned long long> s_bytes(0);
+static std::atomic<unsigned long long> s_rotations(0);
+static std::atomic<unsigned long long> s_sync_segments(0);
+static std::atomic<unsigned long long> s_dropped(0);
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int LOGAPI log_mmap_sink_open(const char* path, int segment_mb, int daily) {
+    log_mmap_sink_close();
+
+    CLogMmapSink* sink = new CLogMmapSink();
+
+    if (!sink->open(path, (size_t) (segment_mb > 0 ? segment_mb : 0) << 20, daily)) {
+        delete sink;
+        return 0;
+    }
+
+    s_mmap_sink = sink;
+    return 1;
+}
+
+void LOGAPI log_mmap_sink_close() {
+    if (s_mmap_sink) {
+        s_mmap_sink->close();
+        delete s_mmap_sink;
+        s_mmap_sink = 0;
+    }
+}
+
+void LOGAPI log_get_mmap_sink_stats(log_mmap_sink_stats_t* stats) {
+    stats->_records = s_records.load(std::memory_order_relaxed);
+    stats->_bytes = s_bytes.load(std::memory_order_relaxed);
+    stats->_rotations = s_rotations.load(std::memory_order_relaxed);
+    stats->_sync_segments = s_sync_segments.load(std::memory_order_relaxed);
+    stats->_dropped = s_dropped.load(std::memory_order_relaxed);
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
+/*
+ * the length of a segment left behind by a process that died, its end
+ * is still zero filled
+ */
+static off_t used_length(int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return 0;
+    }
+
+    char buf[64 << 10];
+    off_t end = st.st_size;
+
+    while (end > 0) {
+        off_t start = end > (off_t) sizeof(buf) ? end - (off_t) sizeof(buf) : 0;
+        ssize_t n = pread(fd, buf, end - start, start);
+
+        if (n != end - start) {
+            return st.st_size;
+        }
+
+        while (n > 0 && buf[n - 1] == 0) {
+            n--;
+        }
+
+        if (n > 0) {
+            return start + n;
+        }
+
+        end = start;
+    }
+
+    return 0;
+}
+
+CLogMmapSink::CLogMmapSink()
+    : _segment_bytes(0)
+    , _b_daily(0)
+    , _b_registered(0)
+    , _cur(0)
+    , _n_retry_ms(0)
+    , _ev_work(0, 0)
+    , _next(0)
+    , _n_seq(0)
+    , _b_quit(0)
+    , _p_thread(0)
+    , _b_thread(0) {
+    memset(&_receiver, 0, sizeof(log_receiver_t));
+}
+
+CLogMmapSink::~CLogMmapSink() {
+    close();
+}
+
+int CLogMmapSink::open(const char* path, size_t segment_bytes, int daily) {
+    _path = path;
+    _segment_bytes = segment_bytes > LOG_MMAP_MIN_SEGMENT ? segment_bytes : LOG_MMAP_MIN_SEGMENT;
+    _b_daily = daily;
+
+    // what the last run left, cut to its lines and archived like any segment
+    int fd = ::open(path, O_RDWR | O_CLOEXEC);
+
+    if (fd >= 0) {
+        struct stat st;
+        Segment* old = new Segment();
+        old->_fd = fd;
+        old->_base = 0;
+        old->_size = 0;
+        old->_len = used_length(fd);
+        old->_start_s = fstat(fd, &st) == 0 ? st.st_mtime : time(NULL);
+        old->_day_end_us = 0;
+        old->_file = _path;
+        retire(old);
+    }
+
+    Segment* seg = make_segment();
+
+    if (!seg) {
+        return 0;
+    }
+
+    activate(seg);
+    promote(seg);
+    _cur = seg;
+
+    if (pthread_create(&_p_thread, NULL, &CLogMmapSink::background_thrd, this) != 0) {
+        close();
+        return 0;
+    }
+
+    _b_thread = 1;
+
+    _receiver._usr_data = this;
+    _receiver._receive_batch = &CLogMmapSink::receive_batch_thunk;
+
+    if (0 != ::register_log_receiver(&_receiver, "*", 0)) {
+        close();
+        return 0;
+    }
+
+    _b_registered = 1;
+    return 1;
+}
+
+void CLogMmapSink::close() {
+    if (_b_registered) {
+        // deliver queued logs while the sink is still registered
+        log_flush(3000);
+        ::unregister_log_receiver(&_receiver);
+        _b_registered = 0;
+    }
+
+    // the background thread finishes the renames it was given
+    if (_b_thread) {
+        {
+            CScopedLock lc(&_lock);
+            _b_quit = 1;
+        }
+        _ev_work.set_event();
+        pthread_join(_p_thread, NULL);
+        _b_thread = 0;
+    }
+
+    if (_next) {
+        unmap(_next);
+        ::unlink(_next->_file.c_str());
+        delete _next;
+        _next = 0;
+    }
+
+    // the current segment stays at _path, cut to what was written
+    if (_cur) {
+        unmap(_cur);
+        delete _cur;
+        _cur = 0;
+    }
+}
+
+int LOGAPI CLogMmapSink::receive_batch_thunk(const log_record_t* records, size_t count,
+                                             void* usr_data) {
+    reinterpret_cast<CLogMmapSink*>(usr_data)->on_receive_batch(records, count);
+    return 0;
+}
+
+void* CLogMmapSink::background_thrd(void* param) {
+    reinterpret_cast<CLogMmapSink*>(param)->background();
+    return 0;
+}
+
+void CLogMmapSink::on_receive_batch(const log_record_t* records, size_t count) {
+    size_t bytes = 0;
+    size_t written = 0;
+
+    for (; written < count; written++) {
+        Segment* seg = writable_segment(records[written]._time_us);
+
+        if (!seg) {
+            s_dropped.fetch_add(count - written, std::memory_order_relaxed);
+            break;
+        }
+
+        size_t len = log_format_record(seg->_base + seg->_len, seg->_size - seg->_len,
+                                       &records[written]);
+        seg->_len += len;
+        bytes += len;
+    }
+
+    s_records.fetch_add(written, std::memory_order_relaxed);
+    s_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+CLogMmapSink::Segment* CLogMmapSink::writable_segment(long long time_us) {
+    int room = _cur && _cur->_size - _cur->_len >= LOG_SINK_LINE_MAX;
+
+    if (room && (!_b_daily || time_us < _cur->_day_end_us)) {
+        return _cur;
+    }
+
+    Segment* seg = 0;
+    {
+        CScopedLock lc(&_lock);
+        seg = _next;
+        _next = 0;
+    }
+
+    // the background thread fell behind, only then the dispatcher makes one
+    if (!seg && monotonic_time_ms() >= _n_retry_ms) {
+        seg = make_segment();
+        s_sync_segments.fetch_add(1, std::memory_order_relaxed);
+
+        if (!seg) {
+            _n_retry_ms = monotonic_time_ms() + LOG_MMAP_RETRY_MS;
+        }
+    }
+
+    if (!seg) {
+        return room ? _cur : 0;
+    }
+
+    activate(seg);
+    {
+        CScopedLock lc(&_lock);
+
+        if (_cur) {
+            Job job = { 1, _cur };
+            _jobs.push_back(job);
+        }
+
+        Job job = { 0, seg };
+        _jobs.push_back(job);
+    }
+    _ev_work.set_event();
+
+    _cur = seg;
+    s_rotations.fetch_add(1, std::memory_order_relaxed);
+    return _cur;
+}
+
+void CLogMmapSink::activate(Segment* seg) {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_mday++;
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+
+    seg->_start_s = now;
+    seg->_day_end_us = (long long) mktime(&tm) * 1000000LL;
+}
+
+CLogMmapSink::Segment* CLogMmapSink::make_segment() {
+    char suffix[32];
+    {
+        CScopedLock lc(&_lock);
+        snprintf(suffix, sizeof(suffix), ".next%u", _n_seq++);
+    }
+
+    std::string file = _path + suffix;
+    int fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        printf("LOG open %s failed: %s\n", file.c_str(), strerror(errno));
+        return 0;
+    }
+
+    /*
+     * the blocks have to be there, a store into a hole of a full disk
+     * kills the process with SIGBUS. posix_fallocate writes them where
+     * the file system cannot allocate.
+     */
+    int err = ::fallocate(fd, 0, 0, _segment_bytes) == 0 ? 0 : errno;
+
+    if (err == EOPNOTSUPP) {
+        err = posix_fallocate(fd, 0, _segment_bytes);
+    }
+
+    void* base = MAP_FAILED;
+
+    if (err == 0) {
+        // populated here, so the dispatcher does not take the page faults
+        base = mmap(NULL, _segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        err = base == MAP_FAILED ? errno : 0;
+    }
+
+    if (err != 0) {
+        printf("LOG segment %s failed: %s\n", file.c_str(), strerror(err));
+        ::close(fd);
+        ::unlink(file.c_str());
+        return 0;
+    }
+
+    Segment* seg = new Segment();
+    seg->_fd = fd;
+    seg->_base = static_cast<char*>(base);
+    seg->_size = _segment_bytes;
+    seg->_len = 0;
+    seg->_start_s = 0;
+    seg->_day_end_us = 0;
+    seg->_file = file;
+    return seg;
+}
+
+void CLogMmapSink::unmap(Segment* seg) {
+    if (seg->_base) {
+        munmap(seg->_base, seg->_size);
+        seg->_base = 0;
+    }
+
+    if (seg->_fd >= 0) {
+        if (ftruncate(seg->_fd, seg->_len) != 0) {
+            printf("LOG truncate %s failed: %s\n", seg->_file.c_str(), strerror(errno));
+        }
+
+        ::close(seg->_fd);
+        seg->_fd = -1;
+    }
+}
+
+void CLogMmapSink::retire(Segment* seg) {
+    unmap(seg);
+
+    std::string archive = archive_name(seg->_start_s);
+
+    if (::rename(seg->_file.c_str(), archive.c_str()) != 0) {
+        printf("LOG rename %s failed: %s\n", seg->_file.c_str(), strerror(errno));
+    } else {
+        CLogArchiver::add(archive);
+    }
+
+    delete seg;
+}
+
+void CLogMmapSink::promote(Segment* seg) {
+    if (::rename(seg->_file.c_str(), _path.c_str()) != 0) {
+        printf("LOG rename %s failed: %s\n", seg->_file.c_str(), strerror(errno));
+        return;
+    }
+
+    seg->_file = _path;
+}
+
+std::string CLogMmapSink::archive_name(long long start_s) {
+    time_t t = (time_t) start_s;
+    struct tm tm;
+    char stamp[32];
+    localtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+    std::string name = _path + "." + stamp;
+    std::string unique = name;
+    struct stat st;
+
+    // several segments filled within a second
+    for (int i = 1; ::stat(unique.c_str(), &st) == 0; i++) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), ".%d", i);
+        unique = name + suffix;
+    }
+
+    return unique;
+}
+
+void CLogMmapSink::background() {
+    for (;;) {
+        std::vector<Job> jobs;
+        int quit = 0;
+        int need_next = 0;
+        {
+            CScopedLock lc(&_lock);
+            jobs.swap(_jobs);
+            quit = _b_quit;
+            need_next = !_next && !quit;
+        }
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (jobs[i]._b_retire) {
+                retire(jobs[i]._seg);
+            } else {
+                promote(jobs[i]._seg);
+            }
+        }
+
+        if (quit) {
+            break;
+        }
+
+        Segment* seg = need_next ? make_segment() : 0;
+
+        if (seg) {
+            CScopedLock lc(&_lock);
+            _next = seg;
+        }
+
+        // wakes up on every swap, the timeout retries after a failed segment
+        _ev_work.wait(need_next && !seg ? LOG_MMAP_RETRY_MS : 60000);
+    }
+}
@@ -0,0 +1,316 @@
+#include "include/logimpl.hpp"
+#include "include/logpool.hpp"
+#include <scopedlock.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <unordered_set>
+
+/*
+ * short lines fit the small class, anything up to the vsnprintf buffer of
+ * v_log_log fits the large one
+ */
+#define LOG_POOL_CLASSES 2
+static const size_t s_class_capacity[LOG_POOL_CLASSES] = { 256, LOG_MAX_LINE };
+
+/*
+ * items moved between a thread and the depot at once, and how much the
+ * depot keeps per class before the rest go back to the heap. The pool
+ * only gets back what the dispatcher delivered, so it has to hold about a
+ * full queue of short items to stay off the heap when producers run ahead.
+ */
+#define LOG_POOL_BATCH 32
+#define LOG_POOL_DEPOT_MAX_BYTES (32 << 20)
+
+#define LOG_INTERN_CACHE 16
+
+namespace {
+
+struct LogItemDepot {
+    CCritSec _lock;
+    LogItem* _head;
+    size_t _count;
+
+    LogItemDepot() : _head(0), _count(0) {}
+};
+
+/*
+ * never destroyed, a dispatcher may still return items while statics go away
+ */
+LogItemDepot* depots() {
+    static LogItemDepot* s_depots = new LogItemDepot[LOG_POOL_CLASSES];
+    return s_depots;
+}
+
+struct CStrHash {
+    size_t operator()(const char* str) const {
+        // FNV-1a
+        size_t h = 14695981039346656037ULL;
+
+        while (*str) {
+            h = (h ^ (unsigned char) *str++) * 1099511628211ULL;
+        }
+
+        return h;
+    }
+};
+
+struct CStrEqual {
+    bool operator()(const char* a, const char* b) const {
+        return strcmp(a, b) == 0;
+    }
+};
+
+/*
+ * keyed by the char pointers themselves, so a lookup builds no string
+ */
+struct LogStringTable {
+    CCritSec _lock;
+    std::unordered_set<const char*, CStrHash, CStrEqual> _strings;
+};
+
+LogStringTable* string_table() {
+    static LogStringTable* s_table = new LogStringTable();
+    return s_table;
+}
+
+struct LogStringCacheEntry {
+    const char* _key;
+    const char* _interned;
+};
+
+__thread LogStringCacheEntry s_string_cache[LOG_INTERN_CACHE];
+
+}  // namespace
+
+/*
+ * per thread free lists, handed to the depot when the thread exits
+ */
+struct LogItemCache {
+    LogItem* _head[LOG_POOL_CLASSES];
+    size_t _count[LOG_POOL_CLASSES];
+
+    LogItemCache() {
+        memset(_head, 0, sizeof(_head));
+        memset(_count, 0, sizeof(_count));
+    }
+    ~LogItemCache();
+
+    // moves up to n items of class c to the depot, or frees them if it is full
+    void give_back(int c, size_t n);
+    void refill(int c);
+};
+
+static thread_local LogItemCache s_cache;
+
+static LogItem* new_item(int c, size_t capacity) {
+    void* p = malloc(sizeof(LogItem) + capacity);
+
+    if (!p) {
+        return 0;
+    }
+
+    return new (p) LogItem(c, capacity);
+}
+
+static void delete_item(LogItem* li) {
+    li->~LogItem();
+    ::free(li);
+}
+
+static int size_class(size_t len) {
+    int c = 0;
+
+    while (c < LOG_POOL_CLASSES && s_class_capacity[c] < len + 1) {
+        c++;
+    }
+
+    return c < LOG_POOL_CLASSES ? c : -1;
+}
+
+static int depot_full(int c, size_t count) {
+    return count * (sizeof(LogItem) + s_class_capacity[c]) > LOG_POOL_DEPOT_MAX_BYTES;
+}
+
+LogItemCache::~LogItemCache() {
+    for (int c = 0; c < LOG_POOL_CLASSES; c++) {
+        give_back(c, _count[c]);
+    }
+}
+
+void LogItemCache::give_back(int c, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    // detach n items as one chain
+    LogItem* first = _head[c];
+    LogItem* last = first;
+
+    for (size_t i = 1; i < n; i++) {
+        last = last->_next;
+    }
+
+    _head[c] = last->_next;
+    _count[c] -= n;
+
+    LogItemDepot& depot = depots()[c];
+    {
+        CScopedLock lc(&depot._lock);
+
+        if (!depot_full(c, depot._count + n)) {
+            last->_next = depot._head;
+            depot._head = first;
+            depot._count += n;
+            return;
+        }
+    }
+
+    while (first) {
+        LogItem* next = first == last ? 0 : first->_next;
+        delete_item(first);
+        first = next;
+    }
+}
+
+void LogItemCache::refill(int c) {
+    LogItemDepot& depot = depots()[c];
+    CScopedLock lc(&depot._lock);
+
+    for (size_t i = 0; i < LOG_POOL_BATCH && depot._head; i++) {
+        LogItem* li = depot._head;
+        depot._head = li->_next;
+        depot._count--;
+
+        li->_next = _head[c];
+        _head[c] = li;
+        _count[c]++;
+    }
+}
+
+LogItem::LogItem(int size_class, size_t capacity)
+    : _e_level(NOT_SET)
+    , _module("")
+    , _title("")
+    , _log(reinterpret_cast<char*>(this + 1))
+    , _n_log_len(0)
+    , _ctx(0)
+    , _n_ctx_len(0)
+    , _n_thrd_id(0)
+    , _n_time_us(0)
+    , _n_mono_us(0)
+    , _n_ref(1)
+    , _n_size_class(size_class)
+    , _n_capacity(capacity)
+    , _next(0) {
+    _log[0] = 0;
+}
+
+LogItem* CLogItemPool::alloc(size_t len) {
+    int c = size_class(len);
+
+    if (c < 0) {
+        return new_item(-1, len + 1);
+    }
+
+    LogItemCache& cache = s_cache;
+
+    if (!cache._head[c]) {
+        cache.refill(c);
+    }
+
+    LogItem* li = cache._head[c];
+
+    if (!li) {
+        return new_item(c, s_class_capacity[c]);
+    }
+
+    cache._head[c] = li->_next;
+    cache._count[c]--;
+
+    li->_next = 0;
+    li->_n_ref = 1;
+    li->_ctx = 0;
+    li->_n_ctx_len = 0;
+    return li;
+}
+
+void CLogItemPool::free(LogItem* li) {
+    int c = li->_n_size_class;
+
+    if (c < 0) {
+        delete_item(li);
+        return;
+    }
+
+    LogItemCache& cache = s_cache;
+    li->_next = cache._head[c];
+    cache._head[c] = li;
+    cache._count[c]++;
+
+    /*
+     * the dispatcher frees what producers allocate, so its list keeps
+     * growing, pass the surplus on in batches
+     */
+    if (cache._count[c] >= 2 * LOG_POOL_BATCH) {
+        cache.give_back(c, LOG_POOL_BATCH);
+    }
+}
+
+void CLogItemPool::reserve(size_t len, size_t count) {
+    int c = size_class(len);
+
+    if (c < 0) {
+        return;
+    }
+
+    LogItemDepot& depot = depots()[c];
+    CScopedLock lc(&depot._lock);
+
+    while (depot._count < count && !depot_full(c, depot._count + 1)) {
+        LogItem* li = new_item(c, s_class_capacity[c]);
+
+        if (!li) {
+            break;
+        }
+
+        li->_next = depot._head;
+        depot._head = li;
+        depot._count++;
+    }
+}
+
+const char* CLogStrings::intern(const char* str) {
+    if (!str) {
+        str = "";
+    }
+
+    // literals sit a few bytes apart, mix the address before picking a slot
+    uint64_t slot = ((uint64_t) (uintptr_t) str * 0x9E3779B97F4A7C15ULL) >> 32;
+    LogStringCacheEntry& e = s_string_cache[slot % LOG_INTERN_CACHE];
+
+    // a stack buffer may reuse the address with other text, hence the compare
+    if (e._key == str && strcmp(e._interned, str) == 0) {
+        return e._interned;
+    }
+
+    LogStringTable* table = string_table();
+    const char* interned = 0;
+    {
+        CScopedLock lc(&table->_lock);
+        std::unordered_set<const char*, CStrHash, CStrEqual>::const_iterator it =
+            table->_strings.find(str);
+
+        if (it != table->_strings.end()) {
+            interned = *it;
+        } else {
+            interned = strdup(str);
+            table->_strings.insert(interned);
+        }
+    }
+
+    e._key = str;
+    e._interned = interned;
+    return interned;
+}
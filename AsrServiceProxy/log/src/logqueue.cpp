@@ -0,0 +1,200 @@
+#include "include/logqueue.hpp"
+#include <stdint.h>
+
+CLogQueue::CLogQueue(size_t capacity)
+    : _cells(0)
+    , _mask(0)
+    , _tail(0)
+    , _head(0) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    _mask = size - 1;
+    _cells = new Cell[size];
+    for (size_t i = 0; i < size; i++) {
+        _cells[i].seq.store(i, std::memory_order_relaxed);
+        _cells[i].item = 0;
+    }
+}
+
+CLogQueue::~CLogQueue() {
+    delete [] _cells;
+}
+
+int CLogQueue::push(LogItem* li) {
+    size_t pos = _tail.load(std::memory_order_relaxed);
+    Cell* cell = 0;
+
+    for (;;) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            // the cell is free, claim it
+            if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the consumer has not freed this cell yet, a full lap behind
+            return 0;
+        } else {
+            pos = _tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->item = li;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return 1;
+}
+
+size_t CLogQueue::pop_batch(LogItem** items, size_t max_items) {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    size_t n = 0;
+
+    while (n < max_items) {
+        Cell* cell = &_cells[pos & _mask];
+
+        if (cell->seq.load(std::memory_order_acquire) != pos + 1) {
+            // empty, or the next producer has claimed the cell but not published yet
+            break;
+        }
+
+        items[n++] = cell->item;
+        cell->item = 0;
+        cell->seq.store(pos + _mask + 1, std::memory_order_release);
+        pos++;
+    }
+
+    _head.store(pos, std::memory_order_release);
+    return n;
+}
+
+LogItem* CLogQueue::peek() const {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    const Cell* cell = &_cells[pos & _mask];
+
+    return cell->seq.load(std::memory_order_acquire) == pos + 1 ? cell->item : 0;
+}
+
+void CLogQueue::pop() {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    Cell* cell = &_cells[pos & _mask];
+
+    cell->item = 0;
+    cell->seq.store(pos + _mask + 1, std::memory_order_release);
+    _head.store(pos + 1, std::memory_order_release);
+}
+
+int CLogQueue::empty() const {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    return _cells[pos & _mask].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+size_t CLogQueue::size() const {
+    size_t head = _head.load(std::memory_order_acquire);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+}
+
+void CLogQueue::visit(void (*fn)(const LogItem* li, void* arg), void* arg) const {
+    size_t head = _head.load(std::memory_order_acquire);
+
+    for (size_t pos = head; pos - head <= _mask; pos++) {
+        const Cell* cell = &_cells[pos & _mask];
+
+        if (cell->seq.load(std::memory_order_acquire) != pos + 1) {
+            break;
+        }
+
+        fn(cell->item, arg);
+    }
+}
+
+CLogRing::CLogRing(size_t capacity)
+    : _items(0)
+    , _mask(0)
+    , _n_ref(1)
+    , _b_closed(0)
+    , _b_detached(0)
+    , _tail(0)
+    , _head_cache(0)
+    , _head(0)
+    , _tail_cache(0) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    _mask = size - 1;
+    _items = new LogItem*[size];
+}
+
+CLogRing::~CLogRing() {
+    delete [] _items;
+}
+
+int CLogRing::push(LogItem* li) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail - _head_cache > _mask) {
+        _head_cache = _head.load(std::memory_order_acquire);
+
+        if (tail - _head_cache > _mask) {
+            return 0;
+        }
+    }
+
+    _items[tail & _mask] = li;
+    _tail.store(tail + 1, std::memory_order_release);
+    return 1;
+}
+
+LogItem* CLogRing::peek() {
+    size_t head = _head.load(std::memory_order_relaxed);
+
+    if (head == _tail_cache) {
+        _tail_cache = _tail.load(std::memory_order_acquire);
+
+        if (head == _tail_cache) {
+            return 0;
+        }
+    }
+
+    return _items[head & _mask];
+}
+
+void CLogRing::pop() {
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+int CLogRing::empty() const {
+    return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+}
+
+size_t CLogRing::size() const {
+    size_t head = _head.load(std::memory_order_acquire);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+}
+
+void CLogRing::visit(void (*fn)(const LogItem* li, void* arg), void* arg) const {
+    size_t head = _head.load(std::memory_order_acquire);
+    size_t tail = _tail.load(std::memory_order_acquire);
+
+    for (size_t pos = head; pos != tail && pos - head <= _mask; pos++) {
+        fn(_items[pos & _mask], arg);
+    }
+}
+
+void CLogRing::add_ref() {
+    _n_ref++;
+}
+
+void CLogRing::release() {
+    if (--_n_ref == 0) {
+        delete this;
+    }
+}
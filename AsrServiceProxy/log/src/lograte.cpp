@@ -0,0 +1,420 @@
+#include "include/lograte.hpp"
+#include "include/logpool.hpp"
+#include <aip_time.hpp>
+#include <scopedlock.hpp>
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * call sites tracked, probes before a site counts as untracked, and locks
+ * shared by the sites, a site's state only changes under its lock
+ */
+#define LOG_RATE_SLOTS 4096
+#define LOG_RATE_PROBES 16
+#define LOG_RATE_LOCKS 64
+
+// text of the folded line quoted in its summary
+#define LOG_RATE_EXCERPT 96
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int is_log_valid();
+void append_log(LogLevel level, const char* module, const char* log_title,
+                 const char* log);
+
+#if defined(__cplusplus)
+};
+#endif
+
+namespace {
+
+/*
+ * lines per window by level bit, 0 is unlimited
+ */
+std::atomic_int s_limits[16];
+std::atomic_int s_window_ms(1000);
+std::atomic_int s_fold(0);
+std::atomic_int s_enabled(0);
+
+std::atomic<long long> s_next_sweep_ms(0);
+
+std::atomic<unsigned long long> s_suppressed(0);
+std::atomic<unsigned long long> s_folded(0);
+
+struct LogRateSite {
+    std::atomic<const void*> _site;
+    LogLevel _e_level;
+    const char* _module;        // interned by CLogStrings
+    const char* _title;
+    int _b_ready;               // the fields above are set
+
+    // rate limit of the current window
+    long long _n_window_ms;
+    unsigned int _n_passed;
+    unsigned int _n_suppressed;
+    long long _n_suppressed_ms; // time of the last suppressed line
+
+    // the previous line and how often it repeated since _n_repeat_ms
+    uint64_t _n_hash;
+    int _b_has_last;
+    unsigned int _n_repeated;
+    long long _n_repeat_ms;
+    long long _n_repeated_ms;   // time of the last repeat
+    char _excerpt[LOG_RATE_EXCERPT];
+
+    LogRateSite()
+        : _site(0)
+        , _e_level(NOT_SET)
+        , _module("")
+        , _title("")
+        , _b_ready(0)
+        , _n_window_ms(0)
+        , _n_passed(0)
+        , _n_suppressed(0)
+        , _n_suppressed_ms(0)
+        , _n_hash(0)
+        , _b_has_last(0)
+        , _n_repeated(0)
+        , _n_repeat_ms(0)
+        , _n_repeated_ms(0) {
+        _excerpt[0] = 0;
+    }
+};
+
+struct LogRateTable {
+    LogRateSite _sites[LOG_RATE_SLOTS];
+    CCritSec _locks[LOG_RATE_LOCKS];
+};
+
+/*
+ * made on first use, never destroyed, logs may come in while statics go away
+ */
+LogRateTable* table() {
+    static LogRateTable* s_table = new LogRateTable();
+    return s_table;
+}
+
+int level_bit(LogLevel level) {
+    int bit = 0;
+
+    while (bit < 15 && !(level & (1 << bit))) {
+        bit++;
+    }
+
+    return bit;
+}
+
+int level_limit(LogLevel level) {
+    if (level == FATAL || level == NOTIFY) {
+        return 0;
+    }
+
+    return s_limits[level_bit(level)].load(std::memory_order_relaxed);
+}
+
+void update_enabled() {
+    int on = s_fold.load();
+
+    for (int i = 0; i < 16 && !on; i++) {
+        on = s_limits[i].load() > 0;
+    }
+
+    s_enabled.store(on);
+}
+
+uint64_t hash_text(const void* text, size_t len) {
+    // FNV-1a
+    const unsigned char* p = static_cast<const unsigned char*>(text);
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+size_t slot_of(const void* site) {
+    // format literals sit a few bytes apart, mix the address first
+    return (size_t) (((uint64_t) (uintptr_t) site * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+CCritSec& lock_of(int slot) {
+    return table()->_locks[slot % LOG_RATE_LOCKS];
+}
+
+/*
+ * a summary, made under the site's lock and logged after it is released
+ */
+struct LogRateSummary {
+    LogLevel _e_level;
+    const char* _module;
+    const char* _title;
+    char _text[LOG_RATE_EXCERPT + 128];
+
+    LogRateSummary() : _e_level(NOT_SET) {
+        _text[0] = 0;
+    }
+
+    void emit() {
+        if (_text[0] && is_log_valid()) {
+            append_log(_e_level, _module, _title, _text);
+        }
+    }
+};
+
+void take_suppressed(LogRateSite& s, LogRateSummary* out) {
+    if (s._n_suppressed > 0) {
+        out->_e_level = s._e_level;
+        out->_module = s._module;
+        out->_title = s._title;
+        snprintf(out->_text, sizeof(out->_text), "%u messages suppressed in %lld ms, limit %d",
+                 s._n_suppressed, s._n_suppressed_ms - s._n_window_ms, level_limit(s._e_level));
+    }
+
+    s._n_suppressed = 0;
+}
+
+void take_repeated(LogRateSite& s, LogRateSummary* out) {
+    if (s._n_repeated > 0) {
+        out->_e_level = s._e_level;
+        out->_module = s._module;
+        out->_title = s._title;
+        snprintf(out->_text, sizeof(out->_text), "message repeated %u times in %lld ms: %s",
+                 s._n_repeated, s._n_repeated_ms - s._n_repeat_ms, s._excerpt);
+    }
+
+    s._n_repeated = 0;
+}
+
+int find_slot(const void* site) {
+    LogRateTable* t = table();
+    size_t slot = slot_of(site);
+
+    for (size_t i = 0; i < LOG_RATE_PROBES; i++) {
+        int n = (int) ((slot + i) % LOG_RATE_SLOTS);
+        LogRateSite& s = t->_sites[n];
+        const void* key = s._site.load(std::memory_order_acquire);
+
+        if (!key && s._site.compare_exchange_strong(key, site, std::memory_order_acq_rel)) {
+            key = site;
+        }
+
+        if (key == site) {
+            return n;
+        }
+    }
+
+    return -1;
+}
+
+}  // namespace
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void LOGAPI log_set_rate_limit(int levels, int lines_per_window) {
+    for (int i = 0; i < 16; i++) {
+        if (levels & (1 << i)) {
+            s_limits[i].store(lines_per_window > 0 ? lines_per_window : 0);
+        }
+    }
+
+    update_enabled();
+}
+
+void LOGAPI log_set_rate_window(int window_ms, int fold_duplicates) {
+    if (window_ms > 0) {
+        s_window_ms.store(window_ms);
+    }
+
+    s_fold.store(fold_duplicates ? 1 : 0);
+    update_enabled();
+}
+
+void LOGAPI log_get_rate_stats(log_rate_stats_t* stats) {
+    stats->_suppressed = s_suppressed.load(std::memory_order_relaxed);
+    stats->_folded = s_folded.load(std::memory_order_relaxed);
+}
+
+int LOGAPI log_rate_admit(LogLevel level, const void* site, const char* module,
+                          const char* log_title, const void* text, size_t len) {
+    int slot = -1;
+
+    if (!CLogRateLimiter::limit(level, site, module, log_title, &slot)) {
+        return 0;
+    }
+
+    return text ? CLogRateLimiter::fold(slot, text, len) : 1;
+}
+
+#if defined(__cplusplus)
+};
+#endif
+
+int CLogRateLimiter::enabled() {
+    return s_enabled.load(std::memory_order_relaxed);
+}
+
+int CLogRateLimiter::limit(LogLevel level, const void* site, const char* module,
+                           const char* log_title, int* slot) {
+    *slot = -1;
+
+    if (!enabled() || level == FATAL || level == NOTIFY) {
+        return 1;
+    }
+
+    long long now = monotonic_time_ms();
+    long long next_sweep = s_next_sweep_ms.load(std::memory_order_relaxed);
+
+    // one caller per window sweeps, sites gone quiet get their summary
+    if (now >= next_sweep && s_next_sweep_ms.compare_exchange_strong(next_sweep,
+            now + s_window_ms.load(std::memory_order_relaxed))) {
+        sweep(0);
+    }
+
+    int n = find_slot(site);
+
+    if (n < 0) {
+        return 1;
+    }
+
+    LogRateSite& s = table()->_sites[n];
+    int window_ms = s_window_ms.load(std::memory_order_relaxed);
+    int lines = level_limit(level);
+    int pass = 1;
+    LogRateSummary summary;
+    {
+        CScopedLock lc(&lock_of(n));
+
+        if (!s._b_ready) {
+            s._e_level = level;
+            s._module = CLogStrings::intern(module);
+            s._title = CLogStrings::intern(log_title);
+            s._n_window_ms = now;
+            s._b_ready = 1;
+        }
+
+        if (now - s._n_window_ms >= window_ms) {
+            take_suppressed(s, &summary);
+            s._n_window_ms = now;
+            s._n_passed = 0;
+        }
+
+        if (lines > 0 && s._n_passed >= (unsigned int) lines) {
+            s._n_suppressed++;
+            s._n_suppressed_ms = now;
+            pass = 0;
+        } else {
+            s._n_passed++;
+        }
+    }
+
+    summary.emit();
+
+    if (!pass) {
+        s_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    *slot = n;
+    return 1;
+}
+
+int CLogRateLimiter::fold(int slot, const void* text, size_t len) {
+    if (slot < 0 || !s_fold.load(std::memory_order_relaxed)) {
+        return 1;
+    }
+
+    LogRateSite& s = table()->_sites[slot];
+    uint64_t hash = hash_text(text, len);
+    long long now = monotonic_time_ms();
+    int window_ms = s_window_ms.load(std::memory_order_relaxed);
+    int pass = 1;
+    LogRateSummary summary;
+    {
+        CScopedLock lc(&lock_of(slot));
+
+        if (s._b_has_last && s._n_hash == hash) {
+            // a storm of one line shows as one summary per window
+            if (now - s._n_repeat_ms >= window_ms) {
+                take_repeated(s, &summary);
+                s._n_repeat_ms = now;
+            }
+
+            s._n_repeated++;
+            s._n_repeated_ms = now;
+
+            // folded lines do not use up the rate limit
+            if (s._n_passed > 0) {
+                s._n_passed--;
+            }
+            pass = 0;
+        } else {
+            take_repeated(s, &summary);
+            s._n_hash = hash;
+            s._b_has_last = 1;
+            s._n_repeat_ms = now;
+
+            size_t n = len < sizeof(s._excerpt) - 1 ? len : sizeof(s._excerpt) - 1;
+            memcpy(s._excerpt, text, n);
+            s._excerpt[n] = 0;
+        }
+    }
+
+    // the summary of the previous line goes out before the new one
+    summary.emit();
+
+    if (!pass) {
+        s_folded.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return pass;
+}
+
+void CLogRateLimiter::sweep(int force) {
+    if (!enabled()) {
+        return;
+    }
+
+    LogRateTable* t = table();
+    long long now = monotonic_time_ms();
+    int window_ms = s_window_ms.load(std::memory_order_relaxed);
+
+    for (int n = 0; n < LOG_RATE_SLOTS; n++) {
+        LogRateSite& s = t->_sites[n];
+
+        if (!s._site.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        LogRateSummary suppressed;
+        LogRateSummary repeated;
+        {
+            CScopedLock lc(&lock_of(n));
+
+            if (!s._b_ready) {
+                continue;
+            }
+
+            if (s._n_suppressed > 0 && (force || now - s._n_window_ms >= window_ms)) {
+                take_suppressed(s, &suppressed);
+                s._n_window_ms = now;
+                s._n_passed = 0;
+            }
+
+            if (s._n_repeated > 0 && (force || now - s._n_repeat_ms >= window_ms)) {
+                take_repeated(s, &repeated);
+                s._n_repeat_ms = now;
+            }
+        }
+
+        repeated.emit();
+        suppressed.emit();
+    }
+}
@@ -0,0 +1,65 @@
+#include "include/logroute.hpp"
+
+/*
+ * probes before a title counts as not cached, keeps a miss on a crowded
+ * map cheap
+ */
+#define LOG_TITLE_MAP_PROBES 16
+
+CLogTitleMap::CLogTitleMap() {
+    for (size_t i = 0; i < LOG_TITLE_MAP_SLOTS; i++) {
+        _slots[i]._title.store(0, std::memory_order_relaxed);
+        _slots[i]._value.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t CLogTitleMap::slot_of(const char* title) {
+    // interned strings sit a few bytes apart, mix the address first
+    return (size_t) (((uint64_t) (uintptr_t) title * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+int CLogTitleMap::find(const char* title, uint64_t* value) const {
+    size_t slot = slot_of(title);
+
+    for (size_t i = 0; i < LOG_TITLE_MAP_PROBES; i++) {
+        const Slot& s = _slots[(slot + i) % LOG_TITLE_MAP_SLOTS];
+        const char* key = s._title.load(std::memory_order_acquire);
+
+        if (key == title) {
+            uint64_t v = s._value.load(std::memory_order_acquire);
+
+            if (v == 0) {
+                return 0;
+            }
+
+            *value = v;
+            return 1;
+        }
+
+        if (!key) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+int CLogTitleMap::insert(const char* title, uint64_t value) {
+    size_t slot = slot_of(title);
+
+    for (size_t i = 0; i < LOG_TITLE_MAP_PROBES; i++) {
+        Slot& s = _slots[(slot + i) % LOG_TITLE_MAP_SLOTS];
+        const char* key = s._title.load(std::memory_order_acquire);
+
+        if (!key && s._title.compare_exchange_strong(key, title, std::memory_order_acq_rel)) {
+            key = title;
+        }
+
+        if (key == title) {
+            s._value.store(value, std::memory_order_release);
+            return 1;
+        }
+    }
+
+    return 0;
+}
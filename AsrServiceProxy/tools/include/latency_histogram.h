@@ -0,0 +1,50 @@
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <json/json.h>
+
+// HDR-style latency histogram: values are bucketed log-linearly so that every
+// recorded value keeps `significant_digits` of precision over the whole range
+// [1, highest_trackable]. record() is lock free and may be called from any
+// number of threads concurrently.
+class LatencyHistogram {
+public:
+    LatencyHistogram(int64_t highest_trackable = 60000000LL, int significant_digits = 3);
+    ~LatencyHistogram();
+
+    void record(int64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    int64_t count() const;
+    int64_t min() const;
+    int64_t max() const;
+    double mean() const;
+    int64_t percentile(double percent) const;
+
+    // {"count", "min", "max", "mean", "p50", "p90", "p99", "p999",
+    //  "buckets": [[highest_equivalent_value, count], ...]}
+    void to_json(Json::Value& out) const;
+
+private:
+    int bucket_index(int64_t value) const;
+    int counts_index(int64_t value) const;
+    int64_t value_at_index(int index) const;
+    int64_t highest_equivalent_value(int64_t value) const;
+
+    int64_t _highest_trackable;
+    int _sub_bucket_half_count_magnitude;
+    int64_t _sub_bucket_half_count;
+    int64_t _sub_bucket_mask;
+    int _counts_len;
+    std::unique_ptr<std::atomic<int64_t>[]> _counts;
+    std::atomic<int64_t> _total;
+    std::atomic<int64_t> _sum;
+    std::atomic<int64_t> _min;
+    std::atomic<int64_t> _max;
+};
+
+#endif  /*_LATENCY_HISTOGRAM_H_*/
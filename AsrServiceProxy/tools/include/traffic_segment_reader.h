@@ -0,0 +1,51 @@
+#ifndef _TRAFFIC_SEGMENT_READER_H_
+#define _TRAFFIC_SEGMENT_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Read-only view of one recorded traffic segment (see traffic_record.h).
+// The file is mmap'ed and records point straight into the mapping, so they
+// stay valid until close().
+class TrafficSegmentReader {
+public:
+    struct Record {
+        int64_t arrival_us;
+        const char* params;
+        uint32_t params_len;
+        const char* audio;
+        uint32_t audio_len;
+    };
+
+    TrafficSegmentReader();
+    ~TrafficSegmentReader();
+
+    // 0 on success, -1 if the file can not be mapped or is not a segment
+    int open(const std::string& path);
+    void close();
+
+    // false at the end of the segment or at the first partial record
+    bool next(Record* record);
+
+    // true if next() stopped before the end of the file
+    bool truncated() const { return _offset < _size; }
+    int64_t create_time_us() const { return _create_time_us; }
+    const std::string& path() const { return _path; }
+
+    // a segment file, or every segment in a recording directory in creation order
+    static int list_segments(const std::string& input, std::vector<std::string>& paths);
+
+private:
+    TrafficSegmentReader(const TrafficSegmentReader&);
+    TrafficSegmentReader& operator=(const TrafficSegmentReader&);
+
+    std::string _path;
+    const char* _base;
+    size_t _size;
+    size_t _offset;
+    int64_t _create_time_us;
+};
+
+#endif  /*_TRAFFIC_SEGMENT_READER_H_*/
@@ -0,0 +1,343 @@
+// asr_bench drives onething.AsrProxyService.asr with audio read from a corpus,
+// either closed-loop (a fixed number of callers, each waiting for its reply)
+// or open-loop (Poisson arrivals at a target qps, independent of replies).
+//
+// example:
+//   asr_bench -server=127.0.0.1:8005 -corpus=./audio -mode=closed -concurrency=16
+//   asr_bench -server=127.0.0.1:8005 -corpus=./audio -mode=open -qps=200 -json_out=run.json
+
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gflags/gflags.h>
+#include <butil/time.h>
+#include <butil/fast_rand.h>
+#include <bthread/bthread.h>
+#include <brpc/channel.h>
+#include <json_util.hpp>
+#include "latency_histogram.h"
+#include "asr_service_proxy.pb.h"
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_string(server, "127.0.0.1:8005", "address of the asr proxy");
+DEFINE_string(load_balancer, "", "load balancer when -server is a naming service url");
+DEFINE_string(protocol, "baidu_std", "protocol used to talk to the proxy");
+DEFINE_string(connection_type, "", "single, pooled or short, empty for protocol default");
+DEFINE_string(corpus, "", "audio file, or directory whose regular files are all used as audio");
+DEFINE_string(mode, "closed", "closed: -concurrency callers in a loop; open: Poisson arrivals at -qps");
+DEFINE_int32(concurrency, 8, "number of concurrent callers in closed-loop mode");
+DEFINE_double(qps, 100, "mean arrival rate in open-loop mode");
+DEFINE_int32(max_inflight, 10000, "open-loop requests beyond this many in flight are dropped client side");
+DEFINE_int32(duration_s, 30, "measured duration in seconds");
+DEFINE_int32(warmup_s, 3, "requests sent during warmup are not measured");
+DEFINE_int32(timeout_ms, 60000, "rpc timeout");
+DEFINE_int32(max_retry, 0, "rpc max retry");
+DEFINE_string(label, "", "free form label stored in the json report, e.g. a build id");
+DEFINE_string(json_out, "", "write the json report to this file instead of stdout");
+
+namespace {
+
+struct BenchStats {
+    BenchStats() : sent(0), ok(0), rpc_failed(0), asr_failed(0), dropped(0), inflight(0) {}
+
+    std::atomic<int64_t> sent;
+    std::atomic<int64_t> ok;
+    std::atomic<int64_t> rpc_failed;
+    std::atomic<int64_t> asr_failed;
+    std::atomic<int64_t> dropped;
+    std::atomic<int64_t> inflight;
+    LatencyHistogram latency_us;
+};
+
+std::vector<onething::AsrRequest> s_requests;
+std::atomic<uint64_t> s_next_request(0);
+brpc::Channel s_channel;
+BenchStats s_stats;
+int64_t s_measure_begin_us = 0;
+int64_t s_measure_end_us = 0;
+std::atomic<bool> s_stop(false);
+
+int read_file_content(const std::string& path, std::string& content) {
+    std::ifstream is(path.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (!is) {
+        return -1;
+    }
+    std::stringstream ss;
+    ss << is.rdbuf();
+    content = ss.str();
+    return 0;
+}
+
+int load_corpus(const std::string& corpus, std::vector<onething::AsrRequest>& requests) {
+    struct stat st;
+    if (stat(corpus.c_str(), &st) != 0) {
+        fprintf(stderr, "corpus %s does not exist\n", corpus.c_str());
+        return -1;
+    }
+
+    std::vector<std::string> files;
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(corpus.c_str());
+        if (dir == NULL) {
+            fprintf(stderr, "failed to open corpus dir %s\n", corpus.c_str());
+            return -1;
+        }
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dir)) != NULL) {
+            std::string path = corpus + "/" + entry->d_name;
+            if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                files.push_back(path);
+            }
+        }
+        closedir(dir);
+    } else {
+        files.push_back(corpus);
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::string audio;
+        if (read_file_content(files[i], audio) != 0 || audio.empty()) {
+            fprintf(stderr, "skip unreadable or empty audio %s\n", files[i].c_str());
+            continue;
+        }
+        onething::AsrRequest request;
+        request.set_audio(audio);
+        requests.push_back(request);
+    }
+
+    return requests.empty() ? -1 : 0;
+}
+
+const onething::AsrRequest& next_request() {
+    return s_requests[s_next_request.fetch_add(1, std::memory_order_relaxed) % s_requests.size()];
+}
+
+// a call is measured when it was meant to be sent inside the window, however
+// late it finishes, so slow calls near the end still count toward the tail
+bool in_measure_window(int64_t intended_us) {
+    return intended_us >= s_measure_begin_us && intended_us < s_measure_end_us;
+}
+
+// classify a finished call, latency is measured from the intended send time
+void on_call_done(brpc::Controller& cntl, const onething::AsrResponse& response,
+                  int64_t intended_us) {
+    if (!in_measure_window(intended_us)) {
+        return;
+    }
+
+    int64_t now_us = butil::gettimeofday_us();
+
+    if (cntl.Failed()) {
+        s_stats.rpc_failed.fetch_add(1, std::memory_order_relaxed);
+    } else if (response.code() != 0) {
+        s_stats.asr_failed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        s_stats.ok.fetch_add(1, std::memory_order_relaxed);
+        s_stats.latency_us.record(now_us - intended_us);
+    }
+}
+
+void* closed_loop_caller(void*) {
+    onething::AsrProxyService_Stub stub(&s_channel);
+    while (!s_stop.load(std::memory_order_relaxed)) {
+        brpc::Controller cntl;
+        onething::AsrResponse response;
+        int64_t begin_us = butil::gettimeofday_us();
+        if (in_measure_window(begin_us)) {
+            s_stats.sent.fetch_add(1, std::memory_order_relaxed);
+        }
+        stub.asr(&cntl, &next_request(), &response, NULL);
+        on_call_done(cntl, response, begin_us);
+        if (cntl.Failed() && cntl.ErrorCode() == ECONNREFUSED) {
+            // do not spin on a dead server
+            bthread_usleep(10000);
+        }
+    }
+    return NULL;
+}
+
+struct OpenLoopCall {
+    brpc::Controller cntl;
+    onething::AsrResponse response;
+    int64_t intended_us;
+};
+
+void on_open_loop_done(OpenLoopCall* call) {
+    on_call_done(call->cntl, call->response, call->intended_us);
+    s_stats.inflight.fetch_sub(1, std::memory_order_relaxed);
+    delete call;
+}
+
+void run_open_loop(int64_t end_us) {
+    onething::AsrProxyService_Stub stub(&s_channel);
+    double mean_interval_us = 1000000.0 / FLAGS_qps;
+    double next_us = (double) butil::gettimeofday_us();
+
+    while (true) {
+        // exponential inter-arrival time gives a Poisson arrival process
+        double u = butil::fast_rand_double();
+        next_us += -log(1.0 - u) * mean_interval_us;
+        if ((int64_t) next_us >= end_us) {
+            break;
+        }
+
+        int64_t now_us = butil::gettimeofday_us();
+        if ((int64_t) next_us > now_us) {
+            usleep((useconds_t) ((int64_t) next_us - now_us));
+        }
+
+        bool measured = in_measure_window((int64_t) next_us);
+        if (measured) {
+            s_stats.sent.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (s_stats.inflight.load(std::memory_order_relaxed) >= FLAGS_max_inflight) {
+            if (measured) {
+                s_stats.dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        OpenLoopCall* call = new OpenLoopCall;
+        call->intended_us = (int64_t) next_us;
+        s_stats.inflight.fetch_add(1, std::memory_order_relaxed);
+        stub.asr(&call->cntl, &next_request(), &call->response,
+                 brpc::NewCallback(on_open_loop_done, call));
+    }
+
+    // wait for outstanding calls, bounded by the rpc timeout
+    int64_t deadline_us = butil::gettimeofday_us() + FLAGS_timeout_ms * 1000LL;
+    while (s_stats.inflight.load() > 0 && butil::gettimeofday_us() < deadline_us) {
+        usleep(10000);
+    }
+}
+
+void run_closed_loop(int64_t end_us) {
+    std::vector<bthread_t> callers(FLAGS_concurrency);
+    for (int i = 0; i < FLAGS_concurrency; ++i) {
+        if (bthread_start_background(&callers[i], NULL, closed_loop_caller, NULL) != 0) {
+            fprintf(stderr, "failed to start caller %d\n", i);
+            callers.resize(i);
+            break;
+        }
+    }
+
+    while (butil::gettimeofday_us() < end_us) {
+        usleep(100000);
+    }
+    s_stop = true;
+
+    for (size_t i = 0; i < callers.size(); ++i) {
+        bthread_join(callers[i], NULL);
+    }
+}
+
+void report() {
+    double seconds = (s_measure_end_us - s_measure_begin_us) / 1000000.0;
+    int64_t ok = s_stats.ok.load();
+    int64_t rpc_failed = s_stats.rpc_failed.load();
+    int64_t asr_failed = s_stats.asr_failed.load();
+    int64_t completed = ok + rpc_failed + asr_failed;
+
+    Json::Value root(Json::objectValue);
+    root["label"] = FLAGS_label;
+    root["server"] = FLAGS_server;
+    root["mode"] = FLAGS_mode;
+    root["start_time"] = (Json::Int64) (s_measure_begin_us / 1000000);
+    root["duration_s"] = seconds;
+    root["corpus_files"] = (Json::UInt64) s_requests.size();
+    if (FLAGS_mode == "open") {
+        root["target_qps"] = FLAGS_qps;
+    } else {
+        root["concurrency"] = FLAGS_concurrency;
+    }
+    root["sent"] = (Json::Int64) s_stats.sent.load();
+    root["completed"] = (Json::Int64) completed;
+    root["ok"] = (Json::Int64) ok;
+    root["rpc_failed"] = (Json::Int64) rpc_failed;
+    root["asr_failed"] = (Json::Int64) asr_failed;
+    root["client_dropped"] = (Json::Int64) s_stats.dropped.load();
+    root["error_rate"] = completed > 0 ? (double) (rpc_failed + asr_failed) / completed : 0.0;
+    root["throughput_qps"] = seconds > 0 ? ok / seconds : 0.0;
+
+    Json::Value latency(Json::objectValue);
+    s_stats.latency_us.to_json(latency);
+    root["latency_us"] = latency;
+
+    printf("mode=%s sent=%ld completed=%ld ok=%ld rpc_failed=%ld asr_failed=%ld dropped=%ld\n",
+           FLAGS_mode.c_str(), (long) s_stats.sent.load(), (long) completed, (long) ok, (long) rpc_failed,
+           (long) asr_failed, (long) s_stats.dropped.load());
+    printf("throughput=%.1f qps error_rate=%.4f\n",
+           root["throughput_qps"].asDouble(), root["error_rate"].asDouble());
+    printf("latency(us) p50=%ld p90=%ld p99=%ld p999=%ld max=%ld\n",
+           (long) s_stats.latency_us.percentile(50.0), (long) s_stats.latency_us.percentile(90.0),
+           (long) s_stats.latency_us.percentile(99.0), (long) s_stats.latency_us.percentile(99.9),
+           (long) s_stats.latency_us.max());
+
+    std::string json = JsonUtils::parse_to_string(root, true);
+    if (FLAGS_json_out.empty()) {
+        printf("%s", json.c_str());
+    } else {
+        std::ofstream os(FLAGS_json_out.c_str(), std::ofstream::out | std::ofstream::trunc);
+        os << json;
+        if (!os) {
+            fprintf(stderr, "failed to write %s\n", FLAGS_json_out.c_str());
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (FLAGS_mode != "closed" && FLAGS_mode != "open") {
+        fprintf(stderr, "unknown -mode=%s, expect closed or open\n", FLAGS_mode.c_str());
+        return 1;
+    }
+    if ((FLAGS_mode == "closed" && FLAGS_concurrency <= 0)
+        || (FLAGS_mode == "open" && FLAGS_qps <= 0)
+        || FLAGS_duration_s <= 0) {
+        fprintf(stderr, "concurrency, qps and duration_s must be positive\n");
+        return 1;
+    }
+    if (load_corpus(FLAGS_corpus, s_requests) != 0) {
+        fprintf(stderr, "no audio loaded from -corpus=%s\n", FLAGS_corpus.c_str());
+        return 1;
+    }
+
+    brpc::ChannelOptions options;
+    options.protocol = FLAGS_protocol;
+    options.connection_type = FLAGS_connection_type;
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = FLAGS_max_retry;
+    if (s_channel.Init(FLAGS_server.c_str(), FLAGS_load_balancer.c_str(), &options) != 0) {
+        fprintf(stderr, "failed to initialize channel to %s\n", FLAGS_server.c_str());
+        return 1;
+    }
+
+    int64_t start_us = butil::gettimeofday_us();
+    s_measure_begin_us = start_us + FLAGS_warmup_s * 1000000LL;
+    s_measure_end_us = s_measure_begin_us + FLAGS_duration_s * 1000000LL;
+
+    if (FLAGS_mode == "open") {
+        run_open_loop(s_measure_end_us);
+    } else {
+        run_closed_loop(s_measure_end_us);
+    }
+
+    report();
+    return 0;
+}
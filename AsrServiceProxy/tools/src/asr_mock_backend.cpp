@@ -0,0 +1,126 @@
+// asr_mock_backend stands in for the baidu asr api during capacity tests, so
+// the proxy can be loaded without quota limits or network noise. It serves
+//     /oauth/2.0/token   an access token, for the proxy's token_server
+//     /server_api        a fixed transcript, for the proxy's asr_server
+// and answers /server_api after a delay modelled on the real backend: a fixed
+// think time plus a cost per second of audio, with uniform jitter.
+//
+// example:
+//   asr_mock_backend -port=8090 -think_ms=200 -ms_per_audio_s=50 -error_rate=0.01
+// and in conf/default.json of the proxy:
+//   "asr_server": "http://127.0.0.1:8090/server_api",
+//   "token_server": "http://127.0.0.1:8090/oauth/2.0/token"
+
+#include <stdio.h>
+#include <string>
+#include <gflags/gflags.h>
+#include <butil/fast_rand.h>
+#include <bthread/bthread.h>
+#include <bvar/bvar.h>
+#include <brpc/server.h>
+#include <json_util.hpp>
+#include "asr_mock_backend.pb.h"
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_int32(port, 8090, "http port");
+DEFINE_int32(think_ms, 200, "fixed latency of every asr call");
+DEFINE_int32(ms_per_audio_s, 50, "additional latency per second of audio");
+DEFINE_int32(jitter_ms, 20, "latency is spread uniformly by up to this much either way");
+DEFINE_int32(audio_bytes_per_s, 32000, "audio bytes per second, 16k 16bit mono pcm by default");
+DEFINE_double(error_rate, 0, "fraction of asr calls answered with an asr error");
+DEFINE_string(result, "mock result", "transcript returned for every asr call");
+DEFINE_int32(max_concurrency, 0, "limit of concurrent requests, 0 for unlimited");
+
+namespace {
+
+bvar::Adder<int64_t> s_token_calls("asr_mock_token_calls");
+bvar::Adder<int64_t> s_asr_errors("asr_mock_asr_errors");
+bvar::LatencyRecorder s_asr_latency("asr_mock_asr");
+
+class AsrMockBackendImpl : public onething::AsrMockBackend {
+public:
+    void token(google::protobuf::RpcController* cntl_base,
+               const onething::MockHttpRequest* request,
+               onething::MockHttpResponse* response,
+               google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        s_token_calls << 1;
+
+        Json::Value root(Json::objectValue);
+        root["access_token"] = "mock-access-token";
+        root["expires_in"] = 2592000;
+        root["scope"] = "audio_voice_assistant_get brain_enhanced_asr";
+        reply(cntl, root);
+    }
+
+    void server_api(google::protobuf::RpcController* cntl_base,
+                    const onething::MockHttpRequest* request,
+                    onething::MockHttpResponse* response,
+                    google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        int64_t begin_us = butil::gettimeofday_us();
+
+        size_t audio_bytes = cntl->request_attachment().size();
+        double audio_s = FLAGS_audio_bytes_per_s > 0 ?
+            (double) audio_bytes / FLAGS_audio_bytes_per_s : 0;
+        int64_t delay_us = FLAGS_think_ms * 1000LL + (int64_t) (audio_s * FLAGS_ms_per_audio_s * 1000);
+        if (FLAGS_jitter_ms > 0) {
+            delay_us += (int64_t) ((butil::fast_rand_double() * 2 - 1) * FLAGS_jitter_ms * 1000);
+        }
+        if (delay_us > 0) {
+            // parks the bthread, not the worker pthread
+            bthread_usleep(delay_us);
+        }
+
+        Json::Value root(Json::objectValue);
+        root["corpus_no"] = "0";
+        root["sn"] = "mock";
+        if (FLAGS_error_rate > 0 && butil::fast_rand_double() < FLAGS_error_rate) {
+            s_asr_errors << 1;
+            root["err_no"] = 3301;
+            root["err_msg"] = "speech quality error.";
+        } else {
+            root["err_no"] = 0;
+            root["err_msg"] = "success.";
+            root["result"].append(FLAGS_result);
+        }
+        reply(cntl, root);
+        s_asr_latency << (butil::gettimeofday_us() - begin_us);
+    }
+
+private:
+    static void reply(brpc::Controller* cntl, Json::Value& root) {
+        cntl->http_response().set_content_type("application/json");
+        cntl->response_attachment().append(JsonUtils::parse_to_string(root, false));
+    }
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::Server server;
+    AsrMockBackendImpl backend;
+    if (server.AddService(&backend, brpc::SERVER_DOESNT_OWN_SERVICE,
+                          "/oauth/2.0/token => token,"
+                          "/server_api => server_api") != 0) {
+        fprintf(stderr, "failed to add the mock backend service\n");
+        return 1;
+    }
+
+    brpc::ServerOptions options;
+    options.max_concurrency = FLAGS_max_concurrency;
+    if (server.Start(FLAGS_port, &options) != 0) {
+        fprintf(stderr, "failed to start the mock backend on port %d\n", FLAGS_port);
+        return 1;
+    }
+
+    server.RunUntilAskedToQuit();
+    return 0;
+}
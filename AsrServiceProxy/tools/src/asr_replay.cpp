@@ -0,0 +1,322 @@
+// asr_replay sends recorded traffic (see traffic_record.h, recorded by the
+// proxy when traffic_record_dir is set) to onething.AsrProxyService.asr.
+// With -speed=N requests are sent at N times their recorded arrival rate,
+// keeping the original gaps between them; with -speed=0 they are sent as fast
+// as -concurrency callers can go. Point the proxy at asr_mock_backend to
+// measure the proxy alone.
+//
+// example:
+//   asr_replay -server=127.0.0.1:8005 -input=./traffic -speed=1
+//   asr_replay -server=127.0.0.1:8005 -input=./traffic -speed=4 -loops=3 -json_out=run.json
+//   asr_replay -server=127.0.0.1:8005 -input=./traffic -speed=0 -concurrency=64
+
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include <butil/time.h>
+#include <bthread/bthread.h>
+#include <brpc/channel.h>
+#include <json_util.hpp>
+#include "latency_histogram.h"
+#include "traffic_segment_reader.h"
+#include "asr_service_proxy.pb.h"
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_string(server, "127.0.0.1:8005", "address of the asr proxy");
+DEFINE_string(load_balancer, "", "load balancer when -server is a naming service url");
+DEFINE_string(protocol, "baidu_std", "protocol used to talk to the proxy");
+DEFINE_string(connection_type, "", "single, pooled or short, empty for protocol default");
+DEFINE_string(input, "", "traffic segment file, or a recording directory");
+DEFINE_double(speed, 1.0, "replay at this multiple of the recorded rate, 0 for as fast as possible");
+DEFINE_int32(concurrency, 8, "number of concurrent callers when -speed=0");
+DEFINE_int32(max_inflight, 10000, "timed replay drops requests beyond this many in flight");
+DEFINE_int32(loops, 1, "replay the recording this many times");
+DEFINE_int32(timeout_ms, 60000, "rpc timeout");
+DEFINE_int32(max_retry, 0, "rpc max retry");
+DEFINE_string(label, "", "free form label stored in the json report, e.g. a build id");
+DEFINE_string(json_out, "", "write the json report to this file instead of stdout");
+
+namespace {
+
+struct ReplayStats {
+    ReplayStats() : sent(0), ok(0), rpc_failed(0), asr_failed(0), dropped(0), inflight(0) {}
+
+    std::atomic<int64_t> sent;
+    std::atomic<int64_t> ok;
+    std::atomic<int64_t> rpc_failed;
+    std::atomic<int64_t> asr_failed;
+    std::atomic<int64_t> dropped;
+    std::atomic<int64_t> inflight;
+    LatencyHistogram latency_us;
+    // how late requests were sent compared to the schedule, timed replay only
+    LatencyHistogram send_lag_us;
+};
+
+std::vector<std::unique_ptr<TrafficSegmentReader> > s_segments;
+std::vector<TrafficSegmentReader::Record> s_records;
+int64_t s_recording_span_us = 0;
+int64_t s_audio_bytes = 0;
+std::atomic<uint64_t> s_next_record(0);
+brpc::Channel s_channel;
+ReplayStats s_stats;
+
+bool arrival_less(const TrafficSegmentReader::Record& a, const TrafficSegmentReader::Record& b) {
+    return a.arrival_us < b.arrival_us;
+}
+
+int load_recording(const std::string& input) {
+    std::vector<std::string> paths;
+    if (TrafficSegmentReader::list_segments(input, paths) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::unique_ptr<TrafficSegmentReader> segment(new TrafficSegmentReader);
+        if (segment->open(paths[i]) != 0) {
+            fprintf(stderr, "skip %s\n", paths[i].c_str());
+            continue;
+        }
+        TrafficSegmentReader::Record record;
+        while (segment->next(&record)) {
+            s_records.push_back(record);
+            s_audio_bytes += record.audio_len;
+        }
+        if (segment->truncated()) {
+            fprintf(stderr, "%s ends with a partial record, ignored\n", paths[i].c_str());
+        }
+        s_segments.push_back(std::move(segment));
+    }
+    if (s_records.empty()) {
+        return -1;
+    }
+
+    // arrival times are taken before queueing in the proxy, so neighbouring
+    // records may be slightly out of order
+    std::stable_sort(s_records.begin(), s_records.end(), arrival_less);
+    s_recording_span_us = s_records.back().arrival_us - s_records.front().arrival_us;
+    return 0;
+}
+
+void fill_request(const TrafficSegmentReader::Record& record, onething::AsrRequest& request) {
+    request.set_audio(record.audio, record.audio_len);
+}
+
+void on_call_done(brpc::Controller& cntl, const onething::AsrResponse& response,
+                  int64_t intended_us) {
+    if (cntl.Failed()) {
+        s_stats.rpc_failed.fetch_add(1, std::memory_order_relaxed);
+    } else if (response.code() != 0) {
+        s_stats.asr_failed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        s_stats.ok.fetch_add(1, std::memory_order_relaxed);
+        s_stats.latency_us.record(butil::gettimeofday_us() - intended_us);
+    }
+}
+
+void* fast_replay_caller(void*) {
+    onething::AsrProxyService_Stub stub(&s_channel);
+    uint64_t total = (uint64_t) s_records.size() * FLAGS_loops;
+    while (true) {
+        uint64_t index = s_next_record.fetch_add(1, std::memory_order_relaxed);
+        if (index >= total) {
+            break;
+        }
+
+        brpc::Controller cntl;
+        onething::AsrRequest request;
+        onething::AsrResponse response;
+        fill_request(s_records[index % s_records.size()], request);
+        int64_t begin_us = butil::gettimeofday_us();
+        s_stats.sent.fetch_add(1, std::memory_order_relaxed);
+        stub.asr(&cntl, &request, &response, NULL);
+        on_call_done(cntl, response, begin_us);
+        if (cntl.Failed() && cntl.ErrorCode() == ECONNREFUSED) {
+            // do not spin on a dead server
+            bthread_usleep(10000);
+        }
+    }
+    return NULL;
+}
+
+void run_fast_replay() {
+    std::vector<bthread_t> callers(FLAGS_concurrency);
+    for (int i = 0; i < FLAGS_concurrency; ++i) {
+        if (bthread_start_background(&callers[i], NULL, fast_replay_caller, NULL) != 0) {
+            fprintf(stderr, "failed to start caller %d\n", i);
+            callers.resize(i);
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < callers.size(); ++i) {
+        bthread_join(callers[i], NULL);
+    }
+}
+
+struct TimedCall {
+    brpc::Controller cntl;
+    onething::AsrRequest request;
+    onething::AsrResponse response;
+    int64_t intended_us;
+};
+
+void on_timed_call_done(TimedCall* call) {
+    on_call_done(call->cntl, call->response, call->intended_us);
+    s_stats.inflight.fetch_sub(1, std::memory_order_relaxed);
+    delete call;
+}
+
+void run_timed_replay() {
+    onething::AsrProxyService_Stub stub(&s_channel);
+    int64_t first_arrival_us = s_records.front().arrival_us;
+    // keep the average gap between loops so they do not collapse into a burst
+    int64_t loop_span_us = s_recording_span_us
+        + (s_records.size() > 1 ? s_recording_span_us / (int64_t) (s_records.size() - 1) : 0);
+    int64_t start_us = butil::gettimeofday_us();
+
+    for (int loop = 0; loop < FLAGS_loops; ++loop) {
+        for (size_t i = 0; i < s_records.size(); ++i) {
+            const TrafficSegmentReader::Record& record = s_records[i];
+            int64_t offset_us = loop * loop_span_us + (record.arrival_us - first_arrival_us);
+            int64_t intended_us = start_us + (int64_t) (offset_us / FLAGS_speed);
+
+            int64_t now_us = butil::gettimeofday_us();
+            if (intended_us > now_us) {
+                usleep((useconds_t) (intended_us - now_us));
+                now_us = butil::gettimeofday_us();
+            }
+            s_stats.send_lag_us.record(now_us > intended_us ? now_us - intended_us : 0);
+
+            s_stats.sent.fetch_add(1, std::memory_order_relaxed);
+            if (s_stats.inflight.load(std::memory_order_relaxed) >= FLAGS_max_inflight) {
+                s_stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            TimedCall* call = new TimedCall;
+            fill_request(record, call->request);
+            call->intended_us = intended_us;
+            s_stats.inflight.fetch_add(1, std::memory_order_relaxed);
+            stub.asr(&call->cntl, &call->request, &call->response,
+                     brpc::NewCallback(on_timed_call_done, call));
+        }
+    }
+
+    // wait for outstanding calls, bounded by the rpc timeout
+    int64_t deadline_us = butil::gettimeofday_us() + FLAGS_timeout_ms * 1000LL;
+    while (s_stats.inflight.load() > 0 && butil::gettimeofday_us() < deadline_us) {
+        usleep(10000);
+    }
+}
+
+void report(int64_t begin_us, int64_t end_us) {
+    double seconds = (end_us - begin_us) / 1000000.0;
+    int64_t ok = s_stats.ok.load();
+    int64_t rpc_failed = s_stats.rpc_failed.load();
+    int64_t asr_failed = s_stats.asr_failed.load();
+    int64_t completed = ok + rpc_failed + asr_failed;
+
+    Json::Value root(Json::objectValue);
+    root["label"] = FLAGS_label;
+    root["server"] = FLAGS_server;
+    root["input"] = FLAGS_input;
+    root["speed"] = FLAGS_speed;
+    if (FLAGS_speed <= 0) {
+        root["concurrency"] = FLAGS_concurrency;
+    }
+    root["loops"] = FLAGS_loops;
+    root["segments"] = (Json::UInt64) s_segments.size();
+    root["records"] = (Json::UInt64) s_records.size();
+    root["audio_bytes"] = (Json::Int64) s_audio_bytes;
+    root["recording_span_s"] = s_recording_span_us / 1000000.0;
+    root["start_time"] = (Json::Int64) (begin_us / 1000000);
+    root["duration_s"] = seconds;
+    root["sent"] = (Json::Int64) s_stats.sent.load();
+    root["completed"] = (Json::Int64) completed;
+    root["ok"] = (Json::Int64) ok;
+    root["rpc_failed"] = (Json::Int64) rpc_failed;
+    root["asr_failed"] = (Json::Int64) asr_failed;
+    root["client_dropped"] = (Json::Int64) s_stats.dropped.load();
+    root["error_rate"] = completed > 0 ? (double) (rpc_failed + asr_failed) / completed : 0.0;
+    root["throughput_qps"] = seconds > 0 ? ok / seconds : 0.0;
+
+    Json::Value latency(Json::objectValue);
+    s_stats.latency_us.to_json(latency);
+    root["latency_us"] = latency;
+    if (FLAGS_speed > 0) {
+        Json::Value send_lag(Json::objectValue);
+        s_stats.send_lag_us.to_json(send_lag);
+        root["send_lag_us"] = send_lag;
+    }
+
+    printf("records=%ld speed=%g completed=%ld ok=%ld rpc_failed=%ld asr_failed=%ld dropped=%ld\n",
+           (long) s_records.size(), FLAGS_speed, (long) completed, (long) ok, (long) rpc_failed,
+           (long) asr_failed, (long) s_stats.dropped.load());
+    printf("duration=%.1fs (recorded %.1fs) throughput=%.1f qps error_rate=%.4f\n",
+           seconds, s_recording_span_us / 1000000.0,
+           root["throughput_qps"].asDouble(), root["error_rate"].asDouble());
+    printf("latency(us) p50=%ld p90=%ld p99=%ld p999=%ld max=%ld\n",
+           (long) s_stats.latency_us.percentile(50.0), (long) s_stats.latency_us.percentile(90.0),
+           (long) s_stats.latency_us.percentile(99.0), (long) s_stats.latency_us.percentile(99.9),
+           (long) s_stats.latency_us.max());
+    if (FLAGS_speed > 0) {
+        // a large send lag means the replayer could not keep up with the schedule
+        printf("send lag(us) p99=%ld max=%ld\n", (long) s_stats.send_lag_us.percentile(99.0),
+               (long) s_stats.send_lag_us.max());
+    }
+
+    std::string json = JsonUtils::parse_to_string(root, true);
+    if (FLAGS_json_out.empty()) {
+        printf("%s", json.c_str());
+    } else {
+        std::ofstream os(FLAGS_json_out.c_str(), std::ofstream::out | std::ofstream::trunc);
+        os << json;
+        if (!os) {
+            fprintf(stderr, "failed to write %s\n", FLAGS_json_out.c_str());
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (FLAGS_speed < 0 || FLAGS_loops <= 0 || (FLAGS_speed == 0 && FLAGS_concurrency <= 0)) {
+        fprintf(stderr, "speed must not be negative, loops and concurrency must be positive\n");
+        return 1;
+    }
+    if (load_recording(FLAGS_input) != 0) {
+        fprintf(stderr, "no traffic loaded from -input=%s\n", FLAGS_input.c_str());
+        return 1;
+    }
+
+    brpc::ChannelOptions options;
+    options.protocol = FLAGS_protocol;
+    options.connection_type = FLAGS_connection_type;
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = FLAGS_max_retry;
+    if (s_channel.Init(FLAGS_server.c_str(), FLAGS_load_balancer.c_str(), &options) != 0) {
+        fprintf(stderr, "failed to initialize channel to %s\n", FLAGS_server.c_str());
+        return 1;
+    }
+
+    int64_t begin_us = butil::gettimeofday_us();
+    if (FLAGS_speed > 0) {
+        run_timed_replay();
+    } else {
+        run_fast_replay();
+    }
+
+    report(begin_us, butil::gettimeofday_us());
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "latency_histogram.h"
+#include <math.h>
+#include <limits.h>
+
+LatencyHistogram::LatencyHistogram(int64_t highest_trackable, int significant_digits)
+    : _highest_trackable(highest_trackable < 2 ? 2 : highest_trackable),
+      _total(0), _sum(0), _min(LLONG_MAX), _max(0) {
+    if (significant_digits < 1) {
+        significant_digits = 1;
+    } else if (significant_digits > 5) {
+        significant_digits = 5;
+    }
+
+    int64_t single_unit_resolution = 2 * (int64_t) pow(10, significant_digits);
+    int sub_bucket_count_magnitude = (int) ceil(log((double) single_unit_resolution) / log(2.0));
+    _sub_bucket_half_count_magnitude = sub_bucket_count_magnitude > 1 ? sub_bucket_count_magnitude - 1 : 0;
+
+    int64_t sub_bucket_count = 1LL << sub_bucket_count_magnitude;
+    _sub_bucket_half_count = sub_bucket_count / 2;
+    _sub_bucket_mask = sub_bucket_count - 1;
+
+    int64_t smallest_untrackable = sub_bucket_count;
+    int bucket_count = 1;
+    while (smallest_untrackable <= _highest_trackable) {
+        if (smallest_untrackable > LLONG_MAX / 2) {
+            bucket_count++;
+            break;
+        }
+        smallest_untrackable <<= 1;
+        bucket_count++;
+    }
+
+    _counts_len = (bucket_count + 1) * (int) _sub_bucket_half_count;
+    _counts.reset(new std::atomic<int64_t>[_counts_len]());
+}
+
+LatencyHistogram::~LatencyHistogram() {
+}
+
+int LatencyHistogram::bucket_index(int64_t value) const {
+    int pow2_ceiling = 64 - __builtin_clzll((unsigned long long) (value | _sub_bucket_mask));
+    return pow2_ceiling - (_sub_bucket_half_count_magnitude + 1);
+}
+
+int LatencyHistogram::counts_index(int64_t value) const {
+    int bucket = bucket_index(value);
+    int64_t sub_bucket = value >> bucket;
+    return (int) (((int64_t) (bucket + 1) << _sub_bucket_half_count_magnitude)
+                  + (sub_bucket - _sub_bucket_half_count));
+}
+
+int64_t LatencyHistogram::value_at_index(int index) const {
+    int bucket = (index >> _sub_bucket_half_count_magnitude) - 1;
+    int64_t sub_bucket = (index & (_sub_bucket_half_count - 1)) + _sub_bucket_half_count;
+    if (bucket < 0) {
+        sub_bucket -= _sub_bucket_half_count;
+        bucket = 0;
+    }
+    return sub_bucket << bucket;
+}
+
+int64_t LatencyHistogram::highest_equivalent_value(int64_t value) const {
+    int bucket = bucket_index(value);
+    int64_t lowest = (value >> bucket) << bucket;
+    return lowest + (1LL << bucket) - 1;
+}
+
+void LatencyHistogram::record(int64_t value) {
+    if (value < 0) {
+        value = 0;
+    } else if (value > _highest_trackable) {
+        value = _highest_trackable;
+    }
+
+    _counts[counts_index(value)].fetch_add(1, std::memory_order_relaxed);
+    _total.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+
+    int64_t cur = _min.load(std::memory_order_relaxed);
+    while (value < cur && !_min.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+    }
+    cur = _max.load(std::memory_order_relaxed);
+    while (value > cur && !_max.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    // both histograms must share the same layout, re-record otherwise
+    if (other._counts_len != _counts_len
+        || other._sub_bucket_half_count_magnitude != _sub_bucket_half_count_magnitude) {
+        for (int i = 0; i < other._counts_len; ++i) {
+            int64_t n = other._counts[i].load(std::memory_order_relaxed);
+            int64_t v = other.value_at_index(i);
+            while (n-- > 0) {
+                record(v);
+            }
+        }
+        return;
+    }
+
+    for (int i = 0; i < _counts_len; ++i) {
+        _counts[i].fetch_add(other._counts[i].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+    }
+    _total.fetch_add(other.count(), std::memory_order_relaxed);
+    _sum.fetch_add(other._sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    if (other.count() > 0) {
+        if (other.min() < _min.load(std::memory_order_relaxed)) {
+            _min.store(other.min(), std::memory_order_relaxed);
+        }
+        if (other.max() > max()) {
+            _max.store(other.max(), std::memory_order_relaxed);
+        }
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < _counts_len; ++i) {
+        _counts[i].store(0, std::memory_order_relaxed);
+    }
+    _total.store(0);
+    _sum.store(0);
+    _min.store(LLONG_MAX);
+    _max.store(0);
+}
+
+int64_t LatencyHistogram::count() const {
+    return _total.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::min() const {
+    return count() > 0 ? _min.load(std::memory_order_relaxed) : 0;
+}
+
+int64_t LatencyHistogram::max() const {
+    return _max.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const {
+    int64_t n = count();
+    return n > 0 ? (double) _sum.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+int64_t LatencyHistogram::percentile(double percent) const {
+    int64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    if (percent > 100.0) {
+        percent = 100.0;
+    }
+
+    int64_t wanted = (int64_t) ceil(percent / 100.0 * total);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+
+    int64_t seen = 0;
+    for (int i = 0; i < _counts_len; ++i) {
+        seen += _counts[i].load(std::memory_order_relaxed);
+        if (seen >= wanted) {
+            int64_t value = highest_equivalent_value(value_at_index(i));
+            return value < max() ? value : max();
+        }
+    }
+    return max();
+}
+
+void LatencyHistogram::to_json(Json::Value& out) const {
+    out["count"] = (Json::Int64) count();
+    out["min"] = (Json::Int64) min();
+    out["max"] = (Json::Int64) max();
+    out["mean"] = mean();
+    out["p50"] = (Json::Int64) percentile(50.0);
+    out["p90"] = (Json::Int64) percentile(90.0);
+    out["p99"] = (Json::Int64) percentile(99.0);
+    out["p999"] = (Json::Int64) percentile(99.9);
+
+    Json::Value buckets(Json::arrayValue);
+    for (int i = 0; i < _counts_len; ++i) {
+        int64_t n = _counts[i].load(std::memory_order_relaxed);
+        if (n == 0) {
+            continue;
+        }
+        Json::Value bucket(Json::arrayValue);
+        bucket.append((Json::Int64) highest_equivalent_value(value_at_index(i)));
+        bucket.append((Json::Int64) n);
+        buckets.append(bucket);
+    }
+    out["buckets"] = buckets;
+}
@@ -0,0 +1,172 @@
+// log_alloc_bench counts heap allocations per log call, to keep the log
+// path allocation free once the item pool is warm. malloc and friends are
+// interposed and counted per thread; logs go to a receiver that only counts
+// lines, so the figures cover the log library and not log4cpp.
+//
+// example:
+//   log_alloc_bench -threads=4 -lines=100000
+// a warm run prints 0 allocations per line for the producers.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gflags/gflags.h>
+#include <logapi.hpp>
+#include <logpool.hpp>
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_int32(threads, 4, "producer threads");
+DEFINE_int32(lines, 100000, "measured lines per thread");
+DEFINE_int32(warmup_lines, 10000, "lines per thread logged before measuring");
+DEFINE_int32(reserve, 65536, "log items put in the pool up front, one queue full by default");
+DEFINE_int32(message_len, 100, "length of the formatted message");
+
+extern "C" {
+int log_init();
+int log_term();
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+}
+
+namespace {
+
+__thread long long s_thread_allocs = 0;
+std::atomic<long long> s_total_allocs(0);
+std::atomic<int> s_counting(0);
+std::atomic<int> s_warm(0);
+
+inline void count_alloc() {
+    s_thread_allocs++;
+    if (s_counting.load(std::memory_order_relaxed)) {
+        s_total_allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+class CountingReceiver : public CLogReceiver {
+public:
+    CountingReceiver() : _lines(0) {}
+
+    virtual int LOGAPI on_receive_log(LogLevel level, const char* module,
+                                      const char* log_title,
+                                      const char* log, unsigned long thrd_id) {
+        _lines.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    long long lines() const { return _lines.load(); }
+
+private:
+    std::atomic<long long> _lines;
+};
+
+void produce(int id, const char* text, long long* allocs, double* seconds) {
+    // the first lines fill the item pool and the interned names
+    for (int i = 0; i < FLAGS_warmup_lines; i++) {
+        log_notice("bench", "alloc", "thread %d line %d %s", id, i, text);
+    }
+
+    // main flushes once everyone is warm, the delivered items are the pool
+    s_warm.fetch_add(1);
+    while (!s_counting.load()) {
+        std::this_thread::yield();
+    }
+
+    long long before = s_thread_allocs;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < FLAGS_lines; i++) {
+        log_notice("bench", "alloc", "thread %d line %d %s", id, i, text);
+    }
+    *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    *allocs = s_thread_allocs - before;
+}
+
+}  // namespace
+
+extern "C" {
+
+void* malloc(size_t size) {
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    count_alloc();
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) {
+    count_alloc();
+    return __libc_realloc(p, size);
+}
+
+void free(void* p) {
+    __libc_free(p);
+}
+
+}
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_threads <= 0 || FLAGS_lines <= 0) {
+        fprintf(stderr, "-threads and -lines must be positive\n");
+        return 1;
+    }
+
+    std::string text(FLAGS_message_len > 0 ? FLAGS_message_len : 0, 'x');
+    set_log_level(DEBUG);
+    // keep every line, a full queue should stall the producers rather than skew the count
+    log_set_overflow_policy(LOG_OVERFLOW_BLOCK, 1000000);
+    log_init();
+    // items only come back once delivered, so the pool has to cover what producers run ahead
+    CLogItemPool::reserve(FLAGS_message_len + 32, FLAGS_reserve);
+
+    long long delivered = 0;
+    long long total_allocs = 0;
+    std::vector<long long> allocs(FLAGS_threads, 0);
+    std::vector<double> seconds(FLAGS_threads, 0);
+    {
+        CountingReceiver receiver;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < FLAGS_threads; i++) {
+            threads.emplace_back(produce, i, text.c_str(), &allocs[i], &seconds[i]);
+        }
+        while (s_warm.load() < FLAGS_threads) {
+            std::this_thread::yield();
+        }
+        log_flush(10000);
+        s_counting = 1;
+
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        log_flush(10000);
+        s_counting = 0;
+        total_allocs = s_total_allocs.load();
+        delivered = receiver.lines();
+    }
+    log_term();
+
+    long long producer_allocs = 0;
+    double producer_seconds = 0;
+    for (int i = 0; i < FLAGS_threads; i++) {
+        producer_allocs += allocs[i];
+        producer_seconds += seconds[i];
+    }
+    long long lines = (long long) FLAGS_threads * FLAGS_lines;
+
+    printf("lines:                 %lld measured, %lld delivered in all\n", lines, delivered);
+    printf("ns per call:           %.1f\n", producer_seconds * 1e9 / lines);
+    printf("producer allocs/line:  %.4f\n", (double) producer_allocs / lines);
+    printf("process allocs/line:   %.4f\n", (double) total_allocs / lines);
+    return producer_allocs == 0 ? 0 : 2;
+}
@@ -0,0 +1,357 @@
+// log_bench measures the log pipeline: nanoseconds per log call on the
+// producer side and the lines per second the dispatcher sustains, for each
+// receiver setup and producer thread count. Producers log for -duration_ms,
+// then the run waits until everything queued is delivered; with the default
+// block policy producers are held back to what the receivers take, so
+// delivered lines over that time is the sustained rate. Receivers write to
+// local files at most, no network is needed.
+//
+// scenarios:
+//   disabled  log_debug below the log level, the cost of a filtered call
+//   none      enabled calls, no receiver
+//   null      a receiver of single logs that only counts
+//   batch     a batch receiver that only counts
+//   file      the native file sink into -dir
+//   mmap      the mmap sink into -dir
+//
+// example:
+//   log_bench -scenarios=null,file -threads=1,4,16,64 -format=csv
+//   log_bench -format=json -out=before.json -label=$(git rev-parse --short HEAD)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gflags/gflags.h>
+#include <json_util.hpp>
+#include <logapi.hpp>
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_string(scenarios, "disabled,none,null,batch,file,mmap", "comma separated, see the top of log_bench.cpp");
+DEFINE_string(threads, "1,2,4,8,16,32,64", "comma separated producer thread counts");
+DEFINE_int32(duration_ms, 2000, "how long producers log per run");
+DEFINE_int32(message_len, 100, "length of the string argument of each line");
+DEFINE_string(overflow_policy, "block", "block, drop_newest, drop_low or spill");
+DEFINE_string(dir, "/tmp", "where the file and mmap scenarios write, removed after each run");
+DEFINE_string(format, "csv", "csv or json");
+DEFINE_string(out, "", "write the results to this file instead of stdout");
+DEFINE_string(label, "", "free form label stored with the results, e.g. a build id");
+
+extern "C" {
+int log_init();
+int log_term();
+}
+
+namespace {
+
+struct RunResult {
+    std::string scenario;
+    int threads;
+    long long calls;
+    long long delivered;
+    long long dropped;
+    double seconds;             // producers started -> everything delivered
+    double ns_per_call;         // producer time per call, all threads
+    double lines_per_sec;       // delivered over seconds
+};
+
+std::atomic<long long> s_received(0);
+
+int LOGAPI count_log(LogLevel level, const char* module, const char* log_title,
+                     const char* log, unsigned long thrd_id, void* usr_data) {
+    s_received.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+int LOGAPI count_batch(const log_record_t* records, size_t count, void* usr_data) {
+    s_received.fetch_add(count, std::memory_order_relaxed);
+    return 0;
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > begin) {
+            items.push_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return items;
+}
+
+class Scenario {
+public:
+    explicit Scenario(const std::string& name) : _name(name), _path(FLAGS_dir + "/log_bench.log") {
+        memset(&_receiver, 0, sizeof(_receiver));
+    }
+
+    bool valid() const {
+        return _name == "disabled" || _name == "none" || _name == "null" || _name == "batch"
+            || _name == "file" || _name == "mmap";
+    }
+
+    bool setup() {
+        set_log_level(_name == "disabled" ? INFO : DEBUG);
+        s_received = 0;
+
+        if (_name == "null" || _name == "batch") {
+            if (_name == "null") {
+                _receiver._receive_log = count_log;
+            } else {
+                _receiver._receive_batch = count_batch;
+            }
+            return register_log_receiver(&_receiver, "*", 0) == 0;
+        } else if (_name == "file") {
+            log_get_file_sink_stats(&_file_before);
+            return log_file_sink_open(_path.c_str(), 1 << 20, 200);
+        } else if (_name == "mmap") {
+            log_get_mmap_sink_stats(&_mmap_before);
+            return log_mmap_sink_open(_path.c_str(), 64, 0);
+        }
+        return true;
+    }
+
+    void log(int thread, long long i, const char* text) {
+        if (_name == "disabled") {
+            log_debug("bench", "bench", "asr result is %s thread %d line %lld", text, thread, i);
+        } else {
+            log_notice("bench", "bench", "asr result is %s thread %d line %lld", text, thread, i);
+        }
+    }
+
+    // lines the receivers got since setup
+    long long delivered() {
+        if (_name == "file") {
+            log_file_sink_stats_t stats;
+            log_get_file_sink_stats(&stats);
+            return stats._records - _file_before._records;
+        } else if (_name == "mmap") {
+            log_mmap_sink_stats_t stats;
+            log_get_mmap_sink_stats(&stats);
+            return stats._records - _mmap_before._records;
+        }
+        return s_received.load();
+    }
+
+    void teardown() {
+        if (_name == "null" || _name == "batch") {
+            unregister_log_receiver(&_receiver);
+        } else if (_name == "file" || _name == "mmap") {
+            if (_name == "file") {
+                log_file_sink_close();
+            } else {
+                log_mmap_sink_close();
+            }
+            // the mmap sink renames full segments to <path>.<time>
+            std::string cmd = "rm -f '" + _path + "' '" + _path + "'.*";
+            if (system(cmd.c_str()) != 0) {
+                fprintf(stderr, "failed to remove %s\n", _path.c_str());
+            }
+        }
+    }
+
+    const std::string& name() const { return _name; }
+
+private:
+    std::string _name;
+    std::string _path;
+    log_receiver_t _receiver;
+    log_file_sink_stats_t _file_before;
+    log_mmap_sink_stats_t _mmap_before;
+};
+
+RunResult run(Scenario& scenario, int threads, const std::string& text) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::vector<long long> calls(threads, 0);
+    std::vector<double> seconds(threads, 0);
+
+    log_overflow_stats_t before;
+    log_get_overflow_stats(&before);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; t++) {
+        producers.emplace_back([&, t]() {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            auto begin = std::chrono::steady_clock::now();
+            long long i = 0;
+            // the stop flag is read every 64 calls, it should not show in the figures
+            do {
+                for (int j = 0; j < 64; j++, i++) {
+                    scenario.log(t, i, text.c_str());
+                }
+            } while (!stop.load(std::memory_order_relaxed));
+            seconds[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            calls[t] = i;
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_duration_ms));
+    stop = true;
+    for (size_t i = 0; i < producers.size(); i++) {
+        producers[i].join();
+    }
+    log_flush(60000);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    log_overflow_stats_t after;
+    log_get_overflow_stats(&after);
+
+    RunResult result;
+    result.scenario = scenario.name();
+    result.threads = threads;
+    result.calls = 0;
+    double producer_seconds = 0;
+    for (int t = 0; t < threads; t++) {
+        result.calls += calls[t];
+        producer_seconds += seconds[t];
+    }
+    result.delivered = scenario.delivered();
+    result.dropped = (long long) (after._dropped - before._dropped);
+    result.seconds = elapsed;
+    result.ns_per_call = result.calls > 0 ? producer_seconds * 1e9 / result.calls : 0;
+    result.lines_per_sec = elapsed > 0 ? result.delivered / elapsed : 0;
+    return result;
+}
+
+std::string to_csv(const std::vector<RunResult>& results) {
+    std::string csv = "label,scenario,threads,calls,delivered,dropped,seconds,ns_per_call,lines_per_sec\n";
+    char line[512];
+    for (size_t i = 0; i < results.size(); i++) {
+        const RunResult& r = results[i];
+        snprintf(line, sizeof(line), "%s,%s,%d,%lld,%lld,%lld,%.3f,%.1f,%.0f\n",
+                 FLAGS_label.c_str(), r.scenario.c_str(), r.threads, r.calls, r.delivered,
+                 r.dropped, r.seconds, r.ns_per_call, r.lines_per_sec);
+        csv += line;
+    }
+    return csv;
+}
+
+std::string to_json(const std::vector<RunResult>& results) {
+    Json::Value root(Json::objectValue);
+    root["label"] = FLAGS_label;
+    root["duration_ms"] = FLAGS_duration_ms;
+    root["message_len"] = FLAGS_message_len;
+    root["overflow_policy"] = FLAGS_overflow_policy;
+
+    Json::Value runs(Json::arrayValue);
+    for (size_t i = 0; i < results.size(); i++) {
+        const RunResult& r = results[i];
+        Json::Value run(Json::objectValue);
+        run["scenario"] = r.scenario;
+        run["threads"] = r.threads;
+        run["calls"] = (Json::Int64) r.calls;
+        run["delivered"] = (Json::Int64) r.delivered;
+        run["dropped"] = (Json::Int64) r.dropped;
+        run["seconds"] = r.seconds;
+        run["ns_per_call"] = r.ns_per_call;
+        run["lines_per_sec"] = r.lines_per_sec;
+        runs.append(run);
+    }
+    root["runs"] = runs;
+    return JsonUtils::parse_to_string(root, true);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (FLAGS_format != "csv" && FLAGS_format != "json") {
+        fprintf(stderr, "unknown -format=%s, expect csv or json\n", FLAGS_format.c_str());
+        return 1;
+    }
+    if (FLAGS_duration_ms <= 0) {
+        fprintf(stderr, "-duration_ms must be positive\n");
+        return 1;
+    }
+
+    LogOverflowPolicy policy = LOG_OVERFLOW_BLOCK;
+    if (FLAGS_overflow_policy == "drop_newest") {
+        policy = LOG_OVERFLOW_DROP_NEWEST;
+    } else if (FLAGS_overflow_policy == "drop_low") {
+        policy = LOG_OVERFLOW_DROP_LOW;
+    } else if (FLAGS_overflow_policy == "spill") {
+        policy = LOG_OVERFLOW_SPILL;
+    } else if (FLAGS_overflow_policy != "block") {
+        fprintf(stderr, "unknown -overflow_policy=%s\n", FLAGS_overflow_policy.c_str());
+        return 1;
+    }
+
+    std::vector<Scenario> scenarios;
+    std::vector<std::string> names = split(FLAGS_scenarios);
+    for (size_t i = 0; i < names.size(); i++) {
+        scenarios.push_back(Scenario(names[i]));
+        if (!scenarios.back().valid()) {
+            fprintf(stderr, "unknown scenario %s\n", names[i].c_str());
+            return 1;
+        }
+    }
+
+    std::vector<int> thread_counts;
+    std::vector<std::string> counts = split(FLAGS_threads);
+    for (size_t i = 0; i < counts.size(); i++) {
+        int n = atoi(counts[i].c_str());
+        if (n <= 0) {
+            fprintf(stderr, "bad thread count %s\n", counts[i].c_str());
+            return 1;
+        }
+        thread_counts.push_back(n);
+    }
+
+    // block for up to a second, long enough that a slow receiver throttles instead of dropping
+    log_set_overflow_policy(policy, 1000000);
+    log_init();
+
+    std::string text(FLAGS_message_len > 0 ? FLAGS_message_len : 0, 'x');
+    std::vector<RunResult> results;
+    for (size_t s = 0; s < scenarios.size(); s++) {
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            if (!scenarios[s].setup()) {
+                fprintf(stderr, "failed to set up %s\n", scenarios[s].name().c_str());
+                scenarios[s].teardown();
+                continue;
+            }
+            results.push_back(run(scenarios[s], thread_counts[t], text));
+            scenarios[s].teardown();
+
+            const RunResult& r = results.back();
+            fprintf(stderr, "%-8s threads=%-3d ns/call=%-8.1f lines/s=%.0f dropped=%lld\n",
+                    r.scenario.c_str(), r.threads, r.ns_per_call, r.lines_per_sec, r.dropped);
+        }
+    }
+
+    log_term();
+
+    std::string report = FLAGS_format == "csv" ? to_csv(results) : to_json(results);
+    if (FLAGS_out.empty()) {
+        printf("%s", report.c_str());
+    } else {
+        std::ofstream os(FLAGS_out.c_str(), std::ofstream::out | std::ofstream::trunc);
+        os << report;
+        if (!os) {
+            fprintf(stderr, "failed to write %s\n", FLAGS_out.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+// logdecode turns binary logs written with log_binary_open() back into the
+// text lines of the file sink. Each call site's format is stored once per
+// file, records only carry its id and the raw arguments, so the printf
+// work happens here instead of on the logging threads.
+//
+// example:
+//   logdecode asr_proxy.blog > asr_proxy.log
+//   logdecode -show_source asr_proxy.blog.1 asr_proxy.blog
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include <logbinary.hpp>
+#include <logformat.hpp>
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_bool(show_source, false, "append file:line of the call site to every line");
+
+namespace {
+
+struct Format {
+    bool _valid;
+    LogLevel _level;
+    uint32_t _line;
+    std::string _file;
+    std::string _module;
+    std::string _title;
+    std::string _fmt;
+
+    Format() : _valid(false), _level(NOT_SET), _line(0) {}
+};
+
+struct Arg {
+    uint8_t _type;
+    int64_t _int;
+    uint64_t _uint;
+    double _double;
+    std::string _string;
+};
+
+class Reader {
+public:
+    Reader(const char* data, size_t size) : _data(data), _size(size), _pos(0) {}
+
+    size_t left() const { return _size - _pos; }
+
+    bool bytes(void* out, size_t len) {
+        if (len > left()) {
+            return false;
+        }
+        memcpy(out, _data + _pos, len);
+        _pos += len;
+        return true;
+    }
+
+    bool string(std::string* out) {
+        uint16_t len = 0;
+        if (!bytes(&len, sizeof(len)) || len > left()) {
+            return false;
+        }
+        out->assign(_data + _pos, len);
+        _pos += len;
+        return true;
+    }
+
+private:
+    const char* _data;
+    size_t _size;
+    size_t _pos;
+};
+
+bool read_args(Reader* r, std::vector<Arg>* args) {
+    args->clear();
+    while (r->left() > 0) {
+        Arg arg;
+        if (!r->bytes(&arg._type, sizeof(arg._type))) {
+            return false;
+        }
+
+        bool ok = true;
+        switch (arg._type) {
+        case LOG_BINARY_ARG_INT:
+            ok = r->bytes(&arg._int, sizeof(arg._int));
+            arg._uint = arg._int;
+            arg._double = arg._int;
+            break;
+        case LOG_BINARY_ARG_UINT:
+        case LOG_BINARY_ARG_POINTER:
+            ok = r->bytes(&arg._uint, sizeof(arg._uint));
+            arg._int = arg._uint;
+            arg._double = arg._uint;
+            break;
+        case LOG_BINARY_ARG_DOUBLE:
+            ok = r->bytes(&arg._double, sizeof(arg._double));
+            arg._int = (int64_t) arg._double;
+            arg._uint = (uint64_t) arg._double;
+            break;
+        case LOG_BINARY_ARG_STRING:
+            ok = r->string(&arg._string);
+            arg._int = 0;
+            arg._uint = 0;
+            arg._double = 0;
+            break;
+        default:
+            return false;
+        }
+        if (!ok) {
+            return false;
+        }
+        args->push_back(arg);
+    }
+    return true;
+}
+
+void append(std::string* out, const char* spec, ...) __attribute__((format(printf, 2, 3)));
+
+void append(std::string* out, const char* spec, ...) {
+    char buf[LOG_MAX_LINE];
+    va_list ap;
+    va_start(ap, spec);
+    int n = vsnprintf(buf, sizeof(buf), spec, ap);
+    va_end(ap);
+    if (n > 0) {
+        out->append(buf, (size_t) n < sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+}
+
+/*
+ * walks the format like printf does, taking the recorded arguments in
+ * order. The argument types come from the record, so a conversion that
+ * does not match them is converted instead of read as garbage.
+ */
+std::string render(const std::string& fmt, const std::vector<Arg>& args) {
+    std::string out;
+    size_t next = 0;
+    const char* p = fmt.c_str();
+
+    while (*p) {
+        if (*p != '%') {
+            out.push_back(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            out.push_back('%');
+            p += 2;
+            continue;
+        }
+
+        // the spec without length modifiers, those are replaced below
+        const char* start = p;
+        std::string spec("%");
+        const char* q = p + 1;
+        while (*q && strchr("-+ #0", *q)) {
+            spec.push_back(*q++);
+        }
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*q != '.') {
+                    break;
+                }
+                spec.push_back(*q++);
+            }
+            if (*q == '*') {
+                q++;
+                long long v = next < args.size() ? args[next++]._int : 0;
+                spec += std::to_string(v);
+            } else {
+                while (*q >= '0' && *q <= '9') {
+                    spec.push_back(*q++);
+                }
+            }
+        }
+        while (*q && strchr("hlLqjzt", *q)) {
+            q++;
+        }
+
+        char conv = *q;
+        if (!conv) {
+            out.append(p);
+            break;
+        }
+        p = q + 1;
+
+        if (conv == 'n') {
+            continue;
+        }
+        if (next >= args.size()) {
+            out += "<missing>";
+            continue;
+        }
+
+        const Arg& arg = args[next++];
+        switch (conv) {
+        case 'd':
+        case 'i':
+            append(&out, (spec + "lld").c_str(), (long long) arg._int);
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            append(&out, (spec + "ll" + conv).c_str(), (unsigned long long) arg._uint);
+            break;
+        case 'c':
+            append(&out, (spec + "c").c_str(), (int) arg._int);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            append(&out, (spec + conv).c_str(), arg._double);
+            break;
+        case 'p':
+            append(&out, (spec + "p").c_str(), (void*) (uintptr_t) arg._uint);
+            break;
+        case 's':
+            if (arg._type == LOG_BINARY_ARG_STRING) {
+                append(&out, (spec + "s").c_str(), arg._string.c_str());
+            } else {
+                append(&out, (spec + "s").c_str(), std::to_string((long long) arg._int).c_str());
+            }
+            break;
+        default:
+            // unknown conversion, print it as it is and keep the argument
+            out.append(start, p - start);
+            next--;
+            break;
+        }
+    }
+
+    if (out.size() >= LOG_MAX_LINE) {
+        out.resize(LOG_MAX_LINE - 1);
+    }
+    return out;
+}
+
+int decode(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "failed to stat %s: %s\n", path, strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        ::close(fd);
+        return 0;
+    }
+
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "failed to mmap %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    const char* data = (const char*) base;
+    size_t size = st.st_size;
+    size_t pos = 0;
+    int ret = 0;
+    std::vector<Format> formats;
+    std::vector<Arg> args;
+    char line[LOG_MAX_LINE + 512];
+
+    while (pos < size) {
+        // every open writes a header, the format ids start over after it
+        if (size - pos >= sizeof(LogBinaryFileHeader)
+            && memcmp(data + pos, LOG_BINARY_MAGIC, sizeof(((LogBinaryFileHeader*) 0)->_magic)) == 0) {
+            LogBinaryFileHeader header;
+            memcpy(&header, data + pos, sizeof(header));
+            if (header._version != LOG_BINARY_VERSION) {
+                fprintf(stderr, "%s: version %u is not supported\n", path, header._version);
+                ret = -1;
+                break;
+            }
+            formats.clear();
+            pos += sizeof(header);
+            continue;
+        }
+
+        LogBinaryFrame frame;
+        if (size - pos < sizeof(frame)) {
+            fprintf(stderr, "%s: truncated frame at %zu\n", path, pos);
+            ret = -1;
+            break;
+        }
+        memcpy(&frame, data + pos, sizeof(frame));
+        pos += sizeof(frame);
+        if (frame._size > size - pos) {
+            // the process died mid write, the frames before are fine
+            fprintf(stderr, "%s: truncated frame at %zu\n", path, pos - sizeof(frame));
+            ret = -1;
+            break;
+        }
+
+        Reader r(data + pos, frame._size);
+        pos += frame._size;
+
+        uint32_t id = 0;
+        if (!r.bytes(&id, sizeof(id))) {
+            fprintf(stderr, "%s: bad frame at %zu\n", path, pos - frame._size);
+            continue;
+        }
+
+        if (frame._type == LOG_BINARY_FORMAT) {
+            Format f;
+            f._level = (LogLevel) frame._level;
+            if (!r.bytes(&f._line, sizeof(f._line)) || !r.string(&f._file)
+                || !r.string(&f._module) || !r.string(&f._title) || !r.string(&f._fmt)) {
+                fprintf(stderr, "%s: bad format %u\n", path, id);
+                continue;
+            }
+            f._valid = true;
+            if (id >= formats.size()) {
+                formats.resize(id + 1);
+            }
+            formats[id] = f;
+            continue;
+        }
+        if (frame._type != LOG_BINARY_RECORD) {
+            // newer frame types, skip
+            continue;
+        }
+
+        uint64_t thrd_id = 0;
+        int64_t time_us = 0;
+        if (!r.bytes(&thrd_id, sizeof(thrd_id)) || !r.bytes(&time_us, sizeof(time_us))
+            || !read_args(&r, &args)) {
+            fprintf(stderr, "%s: bad record of format %u\n", path, id);
+            continue;
+        }
+        if (id >= formats.size() || !formats[id]._valid) {
+            fprintf(stderr, "%s: record of unknown format %u\n", path, id);
+            continue;
+        }
+
+        const Format& f = formats[id];
+        std::string text = render(f._fmt, args);
+        if (FLAGS_show_source) {
+            text += "\t(" + f._file + ":" + std::to_string(f._line) + ")";
+        }
+
+        log_record_t rec;
+        rec._level = (LogLevel) frame._level;
+        rec._module = f._module.c_str();
+        rec._title = f._title.c_str();
+        rec._log = text.c_str();
+        rec._log_len = text.size();
+        rec._thrd_id = thrd_id;
+        rec._time_us = time_us;
+        rec._ctx = NULL;
+        rec._ctx_len = 0;
+
+        size_t len = log_format_line(line, sizeof(line), &rec);
+        fwrite(line, 1, len, stdout);
+    }
+
+    munmap(base, st.st_size);
+    return ret;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (argc < 2) {
+        fprintf(stderr, "usage: logdecode [-show_source] file...\n");
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        if (decode(argv[i]) != 0) {
+            ret = 2;
+        }
+    }
+    return ret;
+}
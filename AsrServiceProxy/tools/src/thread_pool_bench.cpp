@@ -0,0 +1,175 @@
+// thread_pool_bench measures ThreadPool throughput for fine-grained tasks
+// as the worker count grows, to check that it scales to all cores.
+//
+// modes:
+//   spawn     tasks enqueue their own subtasks, fork/join style, so the
+//             submissions go to the workers' deques and get stolen
+//   external  -submitters threads outside the pool enqueue all tasks
+//
+// -api=post submits fire and forget, -api=enqueue takes a future per task
+// and drops it, which adds the promise. submit_ns is the submitters' time
+// per task, external mode only.
+//
+// example:
+//   thread_pool_bench -mode=spawn -tasks=4000000 -work_ns=500
+// prints one CSV line per worker count, speedup is against the first one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gflags/gflags.h>
+#include <thread_pool.hpp>
+
+#ifndef GFLAGS_NS
+#define GFLAGS_NS google
+#endif
+
+DEFINE_string(mode, "spawn", "spawn or external");
+DEFINE_string(api, "post", "post or enqueue");
+DEFINE_string(threads, "", "comma separated worker counts, powers of two up to the core count by default");
+DEFINE_int64(tasks, 2000000, "tasks per run");
+DEFINE_int32(work_ns, 200, "busy time of each task");
+DEFINE_int32(submitters, 1, "threads submitting in external mode");
+
+namespace {
+
+std::atomic<long long> s_left(0);
+std::mutex s_done_lock;
+std::condition_variable s_done_cond;
+std::atomic<long long> s_submit_ns(0);
+
+void burn(int ns) {
+    if (ns <= 0) {
+        return;
+    }
+    auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+
+void finish_one() {
+    if (s_left.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(s_done_lock);
+        s_done_cond.notify_all();
+    }
+}
+
+void wait_all() {
+    std::unique_lock<std::mutex> lock(s_done_lock);
+    s_done_cond.wait(lock, []() { return s_left.load() == 0; });
+}
+
+template<class F, class... Args>
+void submit(ThreadPool* pool, F&& f, Args&&... args) {
+    if (FLAGS_api == "post") {
+        pool->post(std::forward<F>(f), std::forward<Args>(args)...);
+    } else {
+        pool->enqueue(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+}
+
+// covers n tasks: hands halves to the pool until one is left, then works
+void split(ThreadPool* pool, long long n) {
+    while (n > 1) {
+        long long half = n / 2;
+        submit(pool, split, pool, half);
+        n -= half;
+    }
+    burn(FLAGS_work_ns);
+    finish_one();
+}
+
+void work() {
+    burn(FLAGS_work_ns);
+    finish_one();
+}
+
+double run(size_t threads) {
+    ThreadPool pool(threads, 1 << 30);
+    s_left = FLAGS_tasks;
+    s_submit_ns = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    if (FLAGS_mode == "spawn") {
+        submit(&pool, split, &pool, (long long) FLAGS_tasks);
+    } else {
+        std::vector<std::thread> submitters;
+        for (int s = 0; s < FLAGS_submitters; s++) {
+            long long n = FLAGS_tasks / FLAGS_submitters + (s < FLAGS_tasks % FLAGS_submitters ? 1 : 0);
+            submitters.emplace_back([&pool, n]() {
+                auto begin = std::chrono::steady_clock::now();
+                for (long long i = 0; i < n; i++) {
+                    submit(&pool, work);
+                }
+                s_submit_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - begin).count();
+            });
+        }
+        for (size_t s = 0; s < submitters.size(); s++) {
+            submitters[s].join();
+        }
+    }
+    wait_all();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (FLAGS_mode != "spawn" && FLAGS_mode != "external") {
+        fprintf(stderr, "unknown -mode=%s, expect spawn or external\n", FLAGS_mode.c_str());
+        return 1;
+    }
+    if (FLAGS_api != "post" && FLAGS_api != "enqueue") {
+        fprintf(stderr, "unknown -api=%s, expect post or enqueue\n", FLAGS_api.c_str());
+        return 1;
+    }
+    if (FLAGS_tasks <= 0 || FLAGS_submitters <= 0) {
+        fprintf(stderr, "-tasks and -submitters must be positive\n");
+        return 1;
+    }
+
+    std::vector<size_t> counts;
+    if (FLAGS_threads.empty()) {
+        size_t cores = std::thread::hardware_concurrency();
+        for (size_t n = 1; n < cores; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(cores > 0 ? cores : 1);
+    } else {
+        const char* p = FLAGS_threads.c_str();
+        while (*p) {
+            char* end = NULL;
+            long n = strtol(p, &end, 10);
+            if (end == p || n <= 0) {
+                fprintf(stderr, "bad -threads=%s\n", FLAGS_threads.c_str());
+                return 1;
+            }
+            counts.push_back(n);
+            p = *end == ',' ? end + 1 : end;
+        }
+    }
+
+    printf("mode,api,threads,tasks,work_ns,seconds,tasks_per_sec,submit_ns,speedup\n");
+    double base = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        double seconds = run(counts[i]);
+        double rate = FLAGS_tasks / seconds;
+        if (i == 0) {
+            base = rate;
+        }
+        printf("%s,%s,%zu,%lld,%d,%.3f,%.0f,%.1f,%.2f\n", FLAGS_mode.c_str(), FLAGS_api.c_str(),
+               counts[i], (long long) FLAGS_tasks, FLAGS_work_ns, seconds, rate,
+               (double) s_submit_ns.load() / FLAGS_tasks, rate / base);
+        fflush(stdout);
+    }
+    return 0;
+}
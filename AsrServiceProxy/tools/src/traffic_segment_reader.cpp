@@ -0,0 +1,134 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "traffic_record.h"
+#include "traffic_segment_reader.h"
+
+TrafficSegmentReader::TrafficSegmentReader()
+    : _base(NULL), _size(0), _offset(0), _create_time_us(0) {
+}
+
+TrafficSegmentReader::~TrafficSegmentReader() {
+    close();
+}
+
+int TrafficSegmentReader::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(TrafficSegmentHeader)) {
+        fprintf(stderr, "%s is too small to be a traffic segment\n", path.c_str());
+        ::close(fd);
+        return -1;
+    }
+
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "failed to mmap %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    // records are read once, front to back
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    const TrafficSegmentHeader* header = (const TrafficSegmentHeader*) base;
+    if (memcmp(header->magic, TRAFFIC_SEGMENT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != TRAFFIC_SEGMENT_VERSION
+        || header->header_size < sizeof(TrafficSegmentHeader)
+        || header->header_size > (size_t) st.st_size) {
+        fprintf(stderr, "%s is not a version %u traffic segment\n", path.c_str(),
+                TRAFFIC_SEGMENT_VERSION);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    _path = path;
+    _base = (const char*) base;
+    _size = st.st_size;
+    _offset = header->header_size;
+    _create_time_us = header->create_time_us;
+    return 0;
+}
+
+void TrafficSegmentReader::close() {
+    if (_base != NULL) {
+        munmap((void*) _base, _size);
+    }
+    _base = NULL;
+    _size = 0;
+    _offset = 0;
+    _create_time_us = 0;
+}
+
+bool TrafficSegmentReader::next(Record* record) {
+    if (_base == NULL || _size - _offset < sizeof(TrafficRecordHeader)) {
+        return false;
+    }
+
+    const TrafficRecordHeader* header = (const TrafficRecordHeader*) (_base + _offset);
+    if (header->magic != TRAFFIC_RECORD_MAGIC) {
+        return false;
+    }
+    size_t size = traffic_record_size(header->params_len, header->audio_len);
+    if (size > _size - _offset) {
+        return false;
+    }
+
+    const char* payload = (const char*) (header + 1);
+    record->arrival_us = header->arrival_us;
+    record->params = payload;
+    record->params_len = header->params_len;
+    record->audio = payload + header->params_len;
+    record->audio_len = header->audio_len;
+    _offset += size;
+    return true;
+}
+
+int TrafficSegmentReader::list_segments(const std::string& input, std::vector<std::string>& paths) {
+    struct stat st;
+    if (stat(input.c_str(), &st) != 0) {
+        fprintf(stderr, "%s does not exist\n", input.c_str());
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        paths.push_back(input);
+        return 0;
+    }
+
+    DIR* dir = opendir(input.c_str());
+    if (dir == NULL) {
+        fprintf(stderr, "failed to open dir %s\n", input.c_str());
+        return -1;
+    }
+    std::vector<std::string> names;
+    size_t prefix_len = strlen(TRAFFIC_SEGMENT_PREFIX);
+    size_t suffix_len = strlen(TRAFFIC_SEGMENT_SUFFIX);
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name = entry->d_name;
+        if (name.size() > prefix_len + suffix_len
+            && name.compare(0, prefix_len, TRAFFIC_SEGMENT_PREFIX) == 0
+            && name.compare(name.size() - suffix_len, suffix_len, TRAFFIC_SEGMENT_SUFFIX) == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+
+    // names start with a zero padded timestamp, so name order is creation order
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); ++i) {
+        paths.push_back(input + "/" + names[i]);
+    }
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include "aip_common.hpp"
 #include <logapi.hpp>
+#include <logbinary.hpp>
 
 #define AIP_DEBUG(...) \
   printf("%s: Line %d: \t", __FILE_, __LINE__);\
@@ -30,20 +31,54 @@
     printf(fmt, ## __VA_ARGS__); \
     printf("\n")
 #else 
+/*
+ * the lowest level compiled in, statements below it are dropped at
+ * compile time, e.g. -DAIP_LOG_MIN_LEVEL=AIP_LOG_LEVEL_NOTICE. Same values
+ * as LogLevel, usable in #if.
+ */
+#define AIP_LOG_LEVEL_DEBUG     0x01
+#define AIP_LOG_LEVEL_TRACE     0x02
+#define AIP_LOG_LEVEL_NOTICE    0x04
+#define AIP_LOG_LEVEL_WARNING   0x08
+#define AIP_LOG_LEVEL_FATAL     0x20
+
+#ifndef AIP_LOG_MIN_LEVEL
+#define AIP_LOG_MIN_LEVEL AIP_LOG_LEVEL_DEBUG
+#endif
+
+/*
+ * the level is checked before any argument is evaluated, so a disabled
+ * statement costs one call and never builds its arguments.
+ * With log_binary_open() the call only queues a format id and the raw
+ * arguments, fmt has to be a literal then, logdecode renders the text.
+ */
+#define AIP_LOG_AT(level, text_log, fmt, ...) \
+    do { \
+        if ((level) >= AIP_LOG_MIN_LEVEL && is_log_level_enabled(level)) { \
+            if (is_log_binary()) { \
+                static std::atomic<unsigned int> s_aip_log_site(0); \
+                log_binary(level, &s_aip_log_site, "facetracer", "facetracer", \
+                           __FILE__, __LINE__, "" fmt, ## __VA_ARGS__); \
+            } else { \
+                text_log("facetracer", "facetracer", fmt, ## __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
 #define AIP_LOG_DEBUG(fmt, ...) \
-    log_debug("facetracer", "facetracer", fmt, ## __VA_ARGS__)
+    AIP_LOG_AT(DEBUG, log_debug, fmt, ## __VA_ARGS__)
     
 #define AIP_LOG_TRACE(fmt, ...) \
-    log_info("facetracer", "facetracer", fmt, ## __VA_ARGS__)
+    AIP_LOG_AT(INFO, log_info, fmt, ## __VA_ARGS__)
  
 #define AIP_LOG_NOTICE(fmt, ...) \
-    log_notice("facetracer", "facetracer", fmt, ## __VA_ARGS__)
+    AIP_LOG_AT(NOTICE, log_notice, fmt, ## __VA_ARGS__)
 
 #define AIP_LOG_WARNING(fmt, ...) \
-    log_warning("facetracer", "facetracer", fmt, ## __VA_ARGS__)
+    AIP_LOG_AT(WARNING, log_warning, fmt, ## __VA_ARGS__)
 
 #define AIP_LOG_FATAL(fmt, ...) \
-    log_fatal("facetracer", "facetracer", fmt, ## __VA_ARGS__)
+    AIP_LOG_AT(FATAL, log_fatal, fmt, ## __VA_ARGS__)
     
 #endif 
 #endif  // UTILS_AIP_LOG_HPP
@@ -1,8 +1,11 @@
 #ifndef THREAD_POOL_HPP
 #define THREAD_POOL_HPP
 
+#include <cstddef>
+#include <new>
 #include <vector>
-#include <queue>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -10,97 +13,582 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 
+/*
+ * Chase-Lev work-stealing deque of T*. The owning worker pushes and pops
+ * at the bottom, any other thread steals from the top, only the last item
+ * is contended. The ring doubles when full; replaced rings are kept until
+ * the deque goes away since a thief may still read from one.
+ */
+template<class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256);
+    ~WorkStealingDeque();
+
+    // owner only
+    void push(T* item);
+    // owner only, NULL when empty
+    T* pop();
+    // any thread, NULL when empty or another thread took the item first
+    T* steal();
+
+    // racy, a hint for spinning and wakeup decisions
+    bool empty() const {
+        return _n_bottom.load(std::memory_order_relaxed) <= _n_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    WorkStealingDeque(const WorkStealingDeque&);
+    WorkStealingDeque& operator=(const WorkStealingDeque&);
+
+    struct Ring {
+        explicit Ring(long long capacity) : _n_mask(capacity - 1), _slots(new std::atomic<T*>[capacity]) {}
+        ~Ring() { delete[] _slots; }
+
+        T* get(long long i) const { return _slots[i & _n_mask].load(std::memory_order_relaxed); }
+        void put(long long i, T* item) { _slots[i & _n_mask].store(item, std::memory_order_relaxed); }
+
+        long long _n_mask;
+        std::atomic<T*>* _slots;
+    };
+
+    Ring* grow(Ring* ring, long long bottom, long long top);
+
+private:
+    std::atomic<long long> _n_top;
+    char _pad[64];                      // thieves hit _n_top, the owner _n_bottom
+    std::atomic<long long> _n_bottom;
+    std::atomic<Ring*> _ring;
+    std::vector<Ring*> _retired;        // owner only
+};
+
+template<class T>
+WorkStealingDeque<T>::WorkStealingDeque(size_t capacity)
+    : _n_top(0), _n_bottom(0) {
+    long long n = 2;
+    while (n < (long long) capacity) {
+        n <<= 1;
+    }
+    _ring.store(new Ring(n), std::memory_order_relaxed);
+}
+
+template<class T>
+WorkStealingDeque<T>::~WorkStealingDeque() {
+    delete _ring.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < _retired.size(); i++) {
+        delete _retired[i];
+    }
+}
+
+template<class T>
+typename WorkStealingDeque<T>::Ring* WorkStealingDeque<T>::grow(Ring* ring, long long bottom, long long top) {
+    Ring* bigger = new Ring((ring->_n_mask + 1) * 2);
+    for (long long i = top; i < bottom; i++) {
+        bigger->put(i, ring->get(i));
+    }
+    _retired.push_back(ring);
+    _ring.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+template<class T>
+void WorkStealingDeque<T>::push(T* item) {
+    long long bottom = _n_bottom.load(std::memory_order_relaxed);
+    long long top = _n_top.load(std::memory_order_acquire);
+    Ring* ring = _ring.load(std::memory_order_relaxed);
+    if (bottom - top > ring->_n_mask) {
+        ring = grow(ring, bottom, top);
+    }
+    ring->put(bottom, item);
+    _n_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+template<class T>
+T* WorkStealingDeque<T>::pop() {
+    long long bottom = _n_bottom.load(std::memory_order_relaxed) - 1;
+    Ring* ring = _ring.load(std::memory_order_relaxed);
+    _n_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long top = _n_top.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+        _n_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    T* item = ring->get(bottom);
+    if (top == bottom) {
+        // the last item, race the thieves for it
+        if (!_n_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                            std::memory_order_relaxed)) {
+            item = NULL;
+        }
+        _n_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+}
+
+template<class T>
+T* WorkStealingDeque<T>::steal() {
+    long long top = _n_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long bottom = _n_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    Ring* ring = _ring.load(std::memory_order_acquire);
+    T* item = ring->get(top);
+    if (!_n_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        return NULL;
+    }
+    return item;
+}
+
+/*
+ * Recycles the memory of queued tasks and of future states, so submitting
+ * a task does not touch the heap once the pool is warm. Blocks come in a
+ * few size classes, bigger requests go to the heap. Each thread keeps a
+ * small free list per class and trades whole batches with a shared depot,
+ * since tasks are mostly freed on another thread than they were made on.
+ */
+class TaskBlockPool {
+public:
+    static void* alloc(size_t size);
+    static void free(void* p, size_t size);
+};
+
+// hands TaskBlockPool blocks to std::promise and the like
+template<class T>
+struct TaskBlockAllocator {
+    typedef T value_type;
+
+    TaskBlockAllocator() {}
+    template<class U>
+    TaskBlockAllocator(const TaskBlockAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(TaskBlockPool::alloc(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { TaskBlockPool::free(p, n * sizeof(T)); }
+};
+
+template<class T, class U>
+bool operator==(const TaskBlockAllocator<T>&, const TaskBlockAllocator<U>&) { return true; }
+template<class T, class U>
+bool operator!=(const TaskBlockAllocator<T>&, const TaskBlockAllocator<U>&) { return false; }
+
+/*
+ * Move-only void() callable. Callables up to POOL_TASK_INLINE bytes that
+ * move without throwing are stored in place, bigger ones on the heap, so
+ * the usual bound function with a few arguments and a promise costs no
+ * allocation, unlike std::function which also has to be copyable.
+ */
+#define POOL_TASK_INLINE 64
+
+class PoolTask {
+public:
+    PoolTask() : _ops(NULL) {}
+
+    template<class F, class Fn = typename std::decay<F>::type,
+             class = typename std::enable_if<!std::is_same<Fn, PoolTask>::value>::type>
+    explicit PoolTask(F&& f) {
+        construct<Fn>(std::forward<F>(f), std::integral_constant<bool, fits_inline<Fn>()>());
+    }
+
+    PoolTask(PoolTask&& other) : _ops(other._ops) {
+        if (_ops) {
+            _ops->_move(&_storage, &other._storage);
+            other._ops = NULL;
+        }
+    }
+
+    PoolTask& operator=(PoolTask&& other) {
+        if (this != &other) {
+            reset();
+            if (other._ops) {
+                _ops = other._ops;
+                _ops->_move(&_storage, &other._storage);
+                other._ops = NULL;
+            }
+        }
+        return *this;
+    }
+
+    ~PoolTask() { reset(); }
+
+    void operator()() { _ops->_invoke(&_storage); }
+    explicit operator bool() const { return _ops != NULL; }
+
+    void reset() {
+        if (_ops) {
+            _ops->_destroy(&_storage);
+            _ops = NULL;
+        }
+    }
+
+private:
+    PoolTask(const PoolTask&);
+    PoolTask& operator=(const PoolTask&);
+
+    typedef typename std::aligned_storage<POOL_TASK_INLINE, alignof(std::max_align_t)>::type Storage;
+
+    struct Ops {
+        void (*_invoke)(void* storage);
+        // move constructs into dst and destroys src
+        void (*_move)(void* dst, void* src);
+        void (*_destroy)(void* storage);
+    };
+
+    template<class Fn>
+    static constexpr bool fits_inline() {
+        return sizeof(Fn) <= sizeof(Storage) && alignof(Fn) <= alignof(Storage)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<class Fn>
+    struct InlineOps {
+        static void invoke(void* storage) { (*static_cast<Fn*>(storage))(); }
+        static void move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* storage) { static_cast<Fn*>(storage)->~Fn(); }
+        static const Ops s_ops;
+    };
+
+    template<class Fn>
+    struct HeapOps {
+        static Fn*& ptr(void* storage) { return *static_cast<Fn**>(storage); }
+        static void invoke(void* storage) { (*ptr(storage))(); }
+        static void move(void* dst, void* src) { new (dst) Fn*(ptr(src)); }
+        static void destroy(void* storage) { delete ptr(storage); }
+        static const Ops s_ops;
+    };
+
+    template<class Fn, class F>
+    void construct(F&& f, std::true_type) {
+        new (&_storage) Fn(std::forward<F>(f));
+        _ops = &InlineOps<Fn>::s_ops;
+    }
+
+    template<class Fn, class F>
+    void construct(F&& f, std::false_type) {
+        new (&_storage) Fn*(new Fn(std::forward<F>(f)));
+        _ops = &HeapOps<Fn>::s_ops;
+    }
+
+private:
+    Storage _storage;
+    const Ops* _ops;
+};
+
+template<class Fn>
+const PoolTask::Ops PoolTask::InlineOps<Fn>::s_ops = {
+    &PoolTask::InlineOps<Fn>::invoke, &PoolTask::InlineOps<Fn>::move, &PoolTask::InlineOps<Fn>::destroy
+};
+
+template<class Fn>
+const PoolTask::Ops PoolTask::HeapOps<Fn>::s_ops = {
+    &PoolTask::HeapOps<Fn>::invoke, &PoolTask::HeapOps<Fn>::move, &PoolTask::HeapOps<Fn>::destroy
+};
+
+/*
+ * runs a bound call and hands the result or exception to a promise whose
+ * shared state came from TaskBlockPool
+ */
+template<class R, class Fn>
+struct PromiseTask {
+    PromiseTask(std::promise<R>&& promise, Fn&& fn) : _promise(std::move(promise)), _fn(std::move(fn)) {}
+
+    void operator()() {
+        try {
+            set(std::is_void<R>());
+        } catch (...) {
+            _promise.set_exception(std::current_exception());
+        }
+    }
+
+    void set(std::false_type) { _promise.set_value(_fn()); }
+    void set(std::true_type) { _fn(); _promise.set_value(); }
+
+    std::promise<R> _promise;
+    Fn _fn;
+};
+
+/*
+ * what enqueue() does when the queue holds queue_size tasks
+ */
+typedef enum __ThreadPoolOverflow {
+    POOL_OVERFLOW_THROW        =    0,  /* throw std::runtime_error */
+    POOL_OVERFLOW_CALLER_RUNS  =    1,  /* run the task on the calling thread */
+    POOL_OVERFLOW_BLOCK        =    2,  /* wait up to the block timeout for room, then throw */
+} ThreadPoolOverflow;
+
+/*
+ * task classes, a worker takes from the first class that has a task
+ */
+typedef enum __ThreadPoolPriority {
+    POOL_PRIORITY_HIGH    =    0,   /* interactive work, runs before all else */
+    POOL_PRIORITY_NORMAL  =    1,   /* what enqueue() and post() submit */
+    POOL_PRIORITY_LOW     =    2,   /* bulk work, runs when nothing else is queued */
+} ThreadPoolPriority;
+
+#define POOL_PRIORITIES 3
+
+typedef struct {
+    unsigned long long _full;           /* submissions that found the queue full */
+    unsigned long long _rejected;       /* of those, tasks not run: thrown or nothing returned */
+    unsigned long long _caller_runs;    /* of those, tasks run by the caller */
+    unsigned long long _wait_timeouts;  /* waits for room that timed out */
+    unsigned long long _exceptions;     /* thrown out of post()ed tasks and swallowed */
+    unsigned long long _expired;        /* dropped unrun because their deadline passed */
+} thread_pool_stats_t;
+
+/*
+ * Work-stealing pool. Each worker owns a deque: tasks enqueued from a
+ * worker go to its own deque and run LIFO there, idle workers steal the
+ * oldest tasks of the others. Tasks from other threads go through one
+ * injection queue, which workers drain in batches. A worker that finds
+ * nothing spins for a while before it parks, and submitters only wake a
+ * parked worker when no worker is spinning, so busy pools make no
+ * futex calls per task. The destructor runs everything queued, including
+ * what those tasks enqueue. Tasks and their future states live in
+ * TaskBlockPool blocks, post() needs no future at all.
+ *
+ * enqueue_prio() and post_prio() add a class and a deadline. Those tasks
+ * wait in one queue per class ordered by deadline, earliest first, then
+ * by submission; NORMAL tasks without a deadline take the deques as
+ * above and come after the NORMAL ones with a deadline. A task whose
+ * deadline passed before a worker took it is dropped and counted, its
+ * future reports std::future_errc::broken_promise.
+ */
 class ThreadPool {
 public:
     ThreadPool(size_t, int);
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
+    auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
     ~ThreadPool();
 
+    /*
+     * never throws, the future is not valid() when the queue is full or
+     * the pool stopped
+     */
+    template<class F, class... Args>
+    auto try_enqueue(F&& f, Args&&... args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+
+    /*
+     * waits up to timeout_ms for room, forever if negative, the future is
+     * not valid() when it timed out or the pool stopped. Called from a
+     * task it ties up a worker, try_enqueue or caller runs suit tasks better.
+     */
+    template<class F, class... Args>
+    auto enqueue_wait(long timeout_ms, F&& f, Args&&... args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+
+    /*
+     * fire and forget, the cheapest way in, follows the overflow policy
+     * like enqueue(). An exception out of the task is counted and dropped.
+     */
+    template<class F, class... Args>
+    void post(F&& f, Args&&... args);
+
+    typedef std::chrono::steady_clock::time_point Deadline;
+    static Deadline no_deadline() { return Deadline::max(); }
+    // a deadline timeout_ms from now
+    static Deadline deadline_in(long timeout_ms) {
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+    // enqueue() and post() with a class and a deadline, see above
+    template<class F, class... Args>
+    auto enqueue_prio(ThreadPoolPriority priority, Deadline deadline, F&& f, Args&&... args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    template<class F, class... Args>
+    void post_prio(ThreadPoolPriority priority, Deadline deadline, F&& f, Args&&... args);
+
     void set_queue_size(int x) { _queue_size = x; }
+    size_t size() const { return _workers.size(); }
+
+    // block_timeout_ms is for POOL_OVERFLOW_BLOCK, negative waits forever
+    void set_overflow_policy(ThreadPoolOverflow policy, long block_timeout_ms);
+    void get_stats(thread_pool_stats_t* stats) const;
+
+private:
+    // a queued task, linked through _next while in the injection queue
+    struct Task {
+        explicit Task(PoolTask&& fn)
+            : _fn(std::move(fn)), _next(NULL), _e_priority(POOL_PRIORITY_NORMAL),
+              _n_seq(0), _deadline(no_deadline()) {}
+
+        PoolTask _fn;
+        Task* _next;
+        int _e_priority;
+        unsigned long long _n_seq;      // keeps equal deadlines in submission order
+        Deadline _deadline;
+    };
+
+    // the tasks of one class with a deadline or off the default class
+    struct PriorityQueue {
+        PriorityQueue() : _n_size(0) {}
+
+        std::mutex _lock;
+        std::vector<Task*> _heap;       // earliest deadline on top
+        std::atomic<size_t> _n_size;    // read without the lock to skip empty queues
+    };
+
+    static Task* with_priority(Task* task, ThreadPoolPriority priority, Deadline deadline);
+    // heap order, true if a runs after b
+    static bool runs_later(const Task* a, const Task* b);
+
+    static Task* new_task(PoolTask&& fn);
+    static void delete_task(Task* task);
+
+    template<class R, class F, class... Args>
+    static Task* new_promise_task(std::future<R>* res, F&& f, Args&&... args);
+
+    // runs and frees a task
+    void execute(Task* task);
+
+    struct Worker {
+        Worker() : _n_seed(0), _n_runs(0) {}
+
+        WorkStealingDeque<Task> _deque;
+        std::thread _thread;
+        unsigned int _n_seed;           // victim selection
+        unsigned int _n_runs;           // tasks run, the injection queue goes first every so often
+        char _pad[64];
+    };
+
+    // takes ownership of task, applies the overflow policy, throws if stopped or full
+    void submit(Task* task);
+    // takes ownership of task, 0 if it was dropped, waits up to timeout_ms for room
+    int try_submit(Task* task, long timeout_ms);
+
+    // whether the caller may enqueue, tasks still draining may after stop
+    bool accepting() const;
+    // reserves a place in the queue, 0 if full after timeout_ms or stopped
+    int admit(long timeout_ms);
+    void push(Task* task);
+
+    void run(size_t index);
+    Task* find_task(Worker& self, size_t index);
+    Task* take_injected(Worker& self);
+    // drops expired tasks on the way
+    Task* take_prioritized(int priority);
+    Task* steal(Worker& self, size_t index);
+    // spins looking for work, then parks, NULL once the pool stops
+    Task* wait_task(Worker& self, size_t index);
+    void wake_one();
+    void on_taken();
+
 private:
     int _queue_size;
-    // need to keep track of threads so we can join them
-    std::vector<std::thread> workers;
-    // the task queue
-    std::queue<std::function<void()>> tasks;
-    
-    // synchronization
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop;
+    std::atomic<int> _e_overflow;
+    std::atomic<long> _n_block_timeout_ms;
+    std::vector<std::unique_ptr<Worker> > _workers;
+
+    // tasks submitted from threads outside the pool, oldest at the head
+    std::mutex _inject_lock;
+    Task* _injected_head;
+    Task* _injected_tail;
+    size_t _n_injected;
+
+    PriorityQueue _prio[POOL_PRIORITIES];
+    std::atomic<unsigned long long> _n_seq;
+
+    // tasks submitted and not taken by a worker yet
+    std::atomic<long long> _n_queued;
+    std::atomic<int> _n_spinning;
+    std::atomic<int> _n_sleeping;
+
+    std::mutex _park_lock;
+    std::condition_variable _park_cond;
+    std::atomic<bool> _b_stop;
+
+    // submitters waiting for room
+    std::mutex _space_lock;
+    std::condition_variable _space_cond;
+    std::atomic<int> _n_space_waiters;
+
+    std::atomic<unsigned long long> _n_full;
+    std::atomic<unsigned long long> _n_rejected;
+    std::atomic<unsigned long long> _n_caller_runs;
+    std::atomic<unsigned long long> _n_wait_timeouts;
+    std::atomic<unsigned long long> _n_exceptions;
+    std::atomic<unsigned long long> _n_expired;
 };
- 
-// the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads, int queue_size)
-    :   stop(false), _queue_size(queue_size)
+
+template<class R, class F, class... Args>
+ThreadPool::Task* ThreadPool::new_promise_task(std::future<R>* res, F&& f, Args&&... args)
 {
-    for(size_t i = 0;i<threads;++i)
-        workers.emplace_back(
-            [this]
-            {
-                for(;;)
-                {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-
-                    task();
-                }
-            }
-        );
+    typedef decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)) Fn;
+
+    std::promise<R> promise(std::allocator_arg, TaskBlockAllocator<char>());
+    *res = promise.get_future();
+    return new_task(PoolTask(PromiseTask<R, Fn>(std::move(promise),
+                                                 std::bind(std::forward<F>(f), std::forward<Args>(args)...))));
 }
 
 // add new work item to the pool
 template<class F, class... Args>
-auto ThreadPool::enqueue(F && f, Args && ... args) 
+auto ThreadPool::enqueue(F && f, Args && ... args)
     -> std::future<typename std::result_of<F(Args...)>::type>
 {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
-        
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        // don't allow enqueueing after stopping the pool
-        if(stop) {
-            throw std::runtime_error("enqueue on stopped ThreadPool");
-        }
+    std::future<return_type> res;
+    submit(new_promise_task(&res, std::forward<F>(f), std::forward<Args>(args)...));
+    return res;
+}
 
-        if (tasks.size() <  _queue_size) {
-            tasks.emplace([task](){ (*task)(); });
-        } else {
-            throw std::runtime_error("task queue if full");
-        }
+template<class F, class... Args>
+auto ThreadPool::try_enqueue(F && f, Args && ... args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    return enqueue_wait(0, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<class F, class... Args>
+auto ThreadPool::enqueue_wait(long timeout_ms, F && f, Args && ... args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using return_type = typename std::result_of<F(Args...)>::type;
+
+    std::future<return_type> res;
+    if (!try_submit(new_promise_task(&res, std::forward<F>(f), std::forward<Args>(args)...), timeout_ms)) {
+        return std::future<return_type>();
     }
-    condition.notify_one();
     return res;
 }
 
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool()
+template<class F, class... Args>
+void ThreadPool::post(F && f, Args && ... args)
 {
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
-    }
-    condition.notify_all();
-    for(std::thread &worker: workers) {
-        worker.join();
-    }
+    submit(new_task(PoolTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...))));
+}
+
+template<class F, class... Args>
+auto ThreadPool::enqueue_prio(ThreadPoolPriority priority, Deadline deadline, F && f, Args && ... args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using return_type = typename std::result_of<F(Args...)>::type;
+
+    std::future<return_type> res;
+    submit(with_priority(new_promise_task(&res, std::forward<F>(f), std::forward<Args>(args)...),
+                         priority, deadline));
+    return res;
+}
+
+template<class F, class... Args>
+void ThreadPool::post_prio(ThreadPoolPriority priority, Deadline deadline, F && f, Args && ... args)
+{
+    submit(with_priority(new_task(PoolTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...))),
+                         priority, deadline));
 }
 
 #endif // THREAD_POOL_HPP
@@ -18,12 +18,14 @@ int CEvent::set_event() {
     _setted = true;
     pthread_cond_broadcast(&_cond);
     pthread_mutex_unlock(&_lock);
+    return 0;
 }
 
 int CEvent::reset_event() {
     pthread_mutex_lock(&_lock);
     _setted = false;
     pthread_mutex_unlock(&_lock);
+    return 0;
 }
 
 int CEvent::wait(long time_out) {
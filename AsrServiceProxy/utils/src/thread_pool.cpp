@@ -0,0 +1,569 @@
+#include "include/thread_pool.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// rounds an idle worker keeps looking for work before it parks
+#define THREAD_POOL_SPIN_ROUNDS     64
+// rounds of those that pause the core rather than yield it
+#define THREAD_POOL_PAUSE_ROUNDS    16
+// most injected tasks one worker moves to its deque at a time
+#define THREAD_POOL_INJECT_BATCH    32
+// a worker looks at the injection queue before its own deque every so many tasks
+#define THREAD_POOL_INJECT_EVERY    61
+
+/*
+ * a queued task is a node with an inline PoolTask, a future state is the
+ * shared state plus the result holder, each well under 256 bytes
+ */
+#define TASK_POOL_CLASSES 3
+static const size_t s_class_size[TASK_POOL_CLASSES] = { 64, 128, 256 };
+
+/*
+ * blocks moved between a thread and the depot at once, and how many the
+ * depot keeps per class before the rest go back to the heap
+ */
+#define TASK_POOL_BATCH 32
+#define TASK_POOL_DEPOT_MAX_BYTES (16 << 20)
+
+namespace {
+
+struct TaskBlock {
+    TaskBlock* _next;
+};
+
+struct TaskBlockDepot {
+    std::mutex _lock;
+    TaskBlock* _head;
+    size_t _count;
+
+    TaskBlockDepot() : _head(NULL), _count(0) {}
+};
+
+/*
+ * never destroyed, a future may be released while statics go away
+ */
+TaskBlockDepot* depots() {
+    static TaskBlockDepot* s_depots = new TaskBlockDepot[TASK_POOL_CLASSES];
+    return s_depots;
+}
+
+int size_class(size_t size) {
+    int c = 0;
+    while (c < TASK_POOL_CLASSES && s_class_size[c] < size) {
+        c++;
+    }
+    return c < TASK_POOL_CLASSES ? c : -1;
+}
+
+/*
+ * per thread free lists, handed to the depot when the thread exits
+ */
+struct TaskBlockCache {
+    TaskBlock* _head[TASK_POOL_CLASSES];
+    size_t _count[TASK_POOL_CLASSES];
+
+    TaskBlockCache() {
+        memset(_head, 0, sizeof(_head));
+        memset(_count, 0, sizeof(_count));
+    }
+
+    ~TaskBlockCache() {
+        for (int c = 0; c < TASK_POOL_CLASSES; c++) {
+            give_back(c, _count[c]);
+        }
+    }
+
+    // moves up to n blocks of class c to the depot, or frees them if it is full
+    void give_back(int c, size_t n) {
+        if (n == 0) {
+            return;
+        }
+
+        // detach n blocks as one chain
+        TaskBlock* first = _head[c];
+        TaskBlock* last = first;
+        for (size_t i = 1; i < n; i++) {
+            last = last->_next;
+        }
+        _head[c] = last->_next;
+        _count[c] -= n;
+
+        TaskBlockDepot& depot = depots()[c];
+        {
+            std::lock_guard<std::mutex> lock(depot._lock);
+            if ((depot._count + n) * s_class_size[c] <= TASK_POOL_DEPOT_MAX_BYTES) {
+                last->_next = depot._head;
+                depot._head = first;
+                depot._count += n;
+                return;
+            }
+        }
+
+        while (first) {
+            TaskBlock* next = first == last ? NULL : first->_next;
+            ::free(first);
+            first = next;
+        }
+    }
+
+    void refill(int c) {
+        TaskBlockDepot& depot = depots()[c];
+        std::lock_guard<std::mutex> lock(depot._lock);
+        for (size_t i = 0; i < TASK_POOL_BATCH && depot._head; i++) {
+            TaskBlock* block = depot._head;
+            depot._head = block->_next;
+            depot._count--;
+
+            block->_next = _head[c];
+            _head[c] = block;
+            _count[c]++;
+        }
+    }
+};
+
+thread_local TaskBlockCache s_cache;
+
+}  // namespace
+
+void* TaskBlockPool::alloc(size_t size) {
+    int c = size_class(size);
+    if (c < 0) {
+        return ::operator new(size);
+    }
+
+    TaskBlockCache& cache = s_cache;
+    if (!cache._head[c]) {
+        cache.refill(c);
+    }
+
+    TaskBlock* block = cache._head[c];
+    if (!block) {
+        void* p = malloc(s_class_size[c]);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    cache._head[c] = block->_next;
+    cache._count[c]--;
+    return block;
+}
+
+void TaskBlockPool::free(void* p, size_t size) {
+    int c = size_class(size);
+    if (c < 0) {
+        ::operator delete(p);
+        return;
+    }
+
+    TaskBlockCache& cache = s_cache;
+    TaskBlock* block = static_cast<TaskBlock*>(p);
+    block->_next = cache._head[c];
+    cache._head[c] = block;
+    cache._count[c]++;
+
+    /*
+     * workers free what submitters allocate, so their lists keep growing,
+     * pass the surplus on in batches
+     */
+    if (cache._count[c] >= 2 * TASK_POOL_BATCH) {
+        cache.give_back(c, TASK_POOL_BATCH);
+    }
+}
+
+// the pool and worker the calling thread belongs to, if any
+static thread_local ThreadPool* s_pool = NULL;
+static thread_local size_t s_index = 0;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// the constructor just launches some amount of workers
+ThreadPool::ThreadPool(size_t threads, int queue_size)
+    : _queue_size(queue_size), _e_overflow(POOL_OVERFLOW_THROW), _n_block_timeout_ms(0),
+      _injected_head(NULL), _injected_tail(NULL), _n_injected(0), _n_seq(0), _n_queued(0), _n_spinning(0), _n_sleeping(0), _b_stop(false), _n_space_waiters(0),
+      _n_full(0), _n_rejected(0), _n_caller_runs(0), _n_wait_timeouts(0), _n_exceptions(0),
+      _n_expired(0) {
+    for (size_t i = 0; i < threads; i++) {
+        _workers.emplace_back(new Worker());
+        _workers[i]->_n_seed = (unsigned int) (i * 2654435761u + 1);
+    }
+    // all deques exist before any worker may steal from them
+    for (size_t i = 0; i < threads; i++) {
+        _workers[i]->_thread = std::thread(&ThreadPool::run, this, i);
+    }
+}
+
+// the destructor runs what is queued, then joins all threads
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(_park_lock);
+        _b_stop = true;
+    }
+    _park_cond.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(_space_lock);
+    }
+    _space_cond.notify_all();
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->_thread.join();
+    }
+}
+
+void ThreadPool::set_overflow_policy(ThreadPoolOverflow policy, long block_timeout_ms) {
+    _e_overflow = policy;
+    _n_block_timeout_ms = block_timeout_ms;
+}
+
+void ThreadPool::get_stats(thread_pool_stats_t* stats) const {
+    stats->_full = _n_full.load();
+    stats->_rejected = _n_rejected.load();
+    stats->_caller_runs = _n_caller_runs.load();
+    stats->_wait_timeouts = _n_wait_timeouts.load();
+    stats->_exceptions = _n_exceptions.load();
+    stats->_expired = _n_expired.load();
+}
+
+ThreadPool::Task* ThreadPool::new_task(PoolTask&& fn) {
+    return new (TaskBlockPool::alloc(sizeof(Task))) Task(std::move(fn));
+}
+
+void ThreadPool::delete_task(Task* task) {
+    task->~Task();
+    TaskBlockPool::free(task, sizeof(Task));
+}
+
+ThreadPool::Task* ThreadPool::with_priority(Task* task, ThreadPoolPriority priority, Deadline deadline) {
+    task->_e_priority = priority < POOL_PRIORITY_HIGH || priority > POOL_PRIORITY_LOW
+        ? POOL_PRIORITY_NORMAL : priority;
+    task->_deadline = deadline;
+    return task;
+}
+
+bool ThreadPool::runs_later(const Task* a, const Task* b) {
+    return a->_deadline > b->_deadline || (a->_deadline == b->_deadline && a->_n_seq > b->_n_seq);
+}
+
+void ThreadPool::execute(Task* task) {
+    // enqueue()d tasks keep their exception for the future, only post()ed ones get here
+    try {
+        task->_fn();
+    } catch (...) {
+        _n_exceptions++;
+    }
+    delete_task(task);
+}
+
+bool ThreadPool::accepting() const {
+    // don't allow enqueueing after stopping the pool, except from the tasks
+    // still draining, a worker exits only once everything queued ran
+    return !_b_stop.load() || s_pool == this;
+}
+
+void ThreadPool::submit(Task* task) {
+    if (!accepting()) {
+        delete_task(task);
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+
+    int policy = _e_overflow.load();
+    if (admit(policy == POOL_OVERFLOW_BLOCK ? _n_block_timeout_ms.load() : 0)) {
+        push(task);
+        return;
+    }
+
+    if (policy == POOL_OVERFLOW_CALLER_RUNS) {
+        // slows the submitter down to the pace the pool keeps
+        _n_caller_runs++;
+        execute(task);
+        return;
+    }
+
+    _n_rejected++;
+    delete_task(task);
+    if (!accepting()) {
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+    throw std::runtime_error("task queue if full");
+}
+
+int ThreadPool::try_submit(Task* task, long timeout_ms) {
+    if (!accepting()) {
+        delete_task(task);
+        return 0;
+    }
+    if (!admit(timeout_ms)) {
+        _n_rejected++;
+        delete_task(task);
+        return 0;
+    }
+    push(task);
+    return 1;
+}
+
+int ThreadPool::admit(long timeout_ms) {
+    if (_n_queued.fetch_add(1) < _queue_size) {
+        return 1;
+    }
+    _n_queued.fetch_sub(1);
+    _n_full++;
+    if (timeout_ms == 0) {
+        return 0;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    int admitted = 0;
+    std::unique_lock<std::mutex> lock(_space_lock);
+    _n_space_waiters.fetch_add(1);
+    // a worker that took a task before this saw no waiter, so try once more
+    // before each wait
+    for (;;) {
+        if (!accepting()) {
+            break;
+        }
+        if (_n_queued.fetch_add(1) < _queue_size) {
+            admitted = 1;
+            break;
+        }
+        _n_queued.fetch_sub(1);
+
+        if (timeout_ms < 0) {
+            _space_cond.wait(lock);
+        } else if (std::chrono::steady_clock::now() >= deadline) {
+            _n_wait_timeouts++;
+            break;
+        } else {
+            _space_cond.wait_until(lock, deadline);
+        }
+    }
+    _n_space_waiters.fetch_sub(1);
+    return admitted;
+}
+
+void ThreadPool::push(Task* task) {
+    if (task->_e_priority != POOL_PRIORITY_NORMAL || task->_deadline != no_deadline()) {
+        PriorityQueue& queue = _prio[task->_e_priority];
+        task->_n_seq = _n_seq++;
+        std::lock_guard<std::mutex> lock(queue._lock);
+        queue._heap.push_back(task);
+        std::push_heap(queue._heap.begin(), queue._heap.end(), runs_later);
+        queue._n_size++;
+    } else if (s_pool == this) {
+        _workers[s_index]->_deque.push(task);
+    } else {
+        std::lock_guard<std::mutex> lock(_inject_lock);
+        if (_injected_tail) {
+            _injected_tail->_next = task;
+        } else {
+            _injected_head = task;
+        }
+        _injected_tail = task;
+        _n_injected++;
+    }
+
+    // a spinning worker will find it, or wake the next one when it does
+    if (_n_spinning.load() == 0 && _n_sleeping.load() > 0) {
+        wake_one();
+    }
+}
+
+void ThreadPool::wake_one() {
+    std::lock_guard<std::mutex> lock(_park_lock);
+    _park_cond.notify_one();
+}
+
+void ThreadPool::on_taken() {
+    _n_queued.fetch_sub(1);
+    if (_n_space_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(_space_lock);
+        _space_cond.notify_one();
+    }
+}
+
+void ThreadPool::run(size_t index) {
+    s_pool = this;
+    s_index = index;
+    Worker& self = *_workers[index];
+
+    for (;;) {
+        Task* task = find_task(self, index);
+        if (task == NULL) {
+            task = wait_task(self, index);
+            if (task == NULL) {
+                return;
+            }
+        }
+        on_taken();
+        self._n_runs++;
+
+        execute(task);
+    }
+}
+
+ThreadPool::Task* ThreadPool::find_task(Worker& self, size_t index) {
+    Task* task = take_prioritized(POOL_PRIORITY_HIGH);
+    if (task == NULL) {
+        task = take_prioritized(POOL_PRIORITY_NORMAL);
+    }
+    // keeps tasks from outside from starving behind a worker feeding itself
+    if (task == NULL && self._n_runs % THREAD_POOL_INJECT_EVERY == 0) {
+        task = take_injected(self);
+    }
+    if (task == NULL) {
+        task = self._deque.pop();
+    }
+    if (task == NULL) {
+        task = take_injected(self);
+    }
+    if (task == NULL) {
+        task = steal(self, index);
+    }
+    if (task == NULL) {
+        task = take_prioritized(POOL_PRIORITY_LOW);
+    }
+    return task;
+}
+
+ThreadPool::Task* ThreadPool::take_prioritized(int priority) {
+    PriorityQueue& queue = _prio[priority];
+    if (queue._n_size.load(std::memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    Task* task = NULL;
+    Task* expired = NULL;
+    {
+        std::lock_guard<std::mutex> lock(queue._lock);
+        Deadline now = std::chrono::steady_clock::now();
+        // the earliest deadline is on top, so expired tasks come off first
+        while (!queue._heap.empty()) {
+            std::pop_heap(queue._heap.begin(), queue._heap.end(), runs_later);
+            Task* top = queue._heap.back();
+            queue._heap.pop_back();
+            queue._n_size--;
+
+            if (top->_deadline < now) {
+                top->_next = expired;
+                expired = top;
+                continue;
+            }
+            task = top;
+            break;
+        }
+    }
+
+    // nobody waits for these any more, their futures get broken_promise
+    while (expired) {
+        Task* next = expired->_next;
+        _n_expired++;
+        on_taken();
+        delete_task(expired);
+        expired = next;
+    }
+    return task;
+}
+
+ThreadPool::Task* ThreadPool::take_injected(Worker& self) {
+    std::unique_lock<std::mutex> lock(_inject_lock, std::defer_lock);
+    if (!lock.try_lock()) {
+        // someone else is taking or adding, steal from them later instead
+        return NULL;
+    }
+    if (_injected_head == NULL) {
+        return NULL;
+    }
+
+    // take a share, the rest of the workers can steal it from this deque
+    size_t share = (_n_injected - 1) / _workers.size();
+    if (share > THREAD_POOL_INJECT_BATCH) {
+        share = THREAD_POOL_INJECT_BATCH;
+    }
+
+    Task* task = _injected_head;
+    Task* last = task;
+    for (size_t i = 0; i < share; i++) {
+        last = last->_next;
+    }
+    _injected_head = last->_next;
+    if (_injected_head == NULL) {
+        _injected_tail = NULL;
+    }
+    _n_injected -= share + 1;
+    lock.unlock();
+
+    for (Task* t = task->_next; share > 0; share--) {
+        Task* next = t->_next;
+        t->_next = NULL;
+        self._deque.push(t);
+        t = next;
+    }
+    task->_next = NULL;
+    return task;
+}
+
+ThreadPool::Task* ThreadPool::steal(Worker& self, size_t index) {
+    size_t n = _workers.size();
+    if (n < 2) {
+        return NULL;
+    }
+
+    self._n_seed = self._n_seed * 1103515245u + 12345u;
+    size_t start = (self._n_seed >> 16) % n;
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = (start + i) % n;
+        if (victim == index) {
+            continue;
+        }
+        Task* task = _workers[victim]->_deque.steal();
+        if (task != NULL) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+ThreadPool::Task* ThreadPool::wait_task(Worker& self, size_t index) {
+    for (;;) {
+        _n_spinning.fetch_add(1);
+        for (int round = 0; round < THREAD_POOL_SPIN_ROUNDS; round++) {
+            if (round < THREAD_POOL_PAUSE_ROUNDS) {
+                for (int i = 0; i < 32; i++) {
+                    cpu_relax();
+                }
+            } else {
+                std::this_thread::yield();
+            }
+
+            Task* task = find_task(self, index);
+            if (task != NULL) {
+                // the last spinner to find work passes the search on, submitters
+                // skipped the wakeup while it was spinning
+                if (_n_spinning.fetch_sub(1) == 1 && _n_queued.load() > 1
+                    && _n_sleeping.load() > 0) {
+                    wake_one();
+                }
+                return task;
+            }
+            if (_b_stop.load() && _n_queued.load() == 0) {
+                _n_spinning.fetch_sub(1);
+                return NULL;
+            }
+        }
+        _n_spinning.fetch_sub(1);
+
+        std::unique_lock<std::mutex> lock(_park_lock);
+        _n_sleeping.fetch_add(1);
+        // a submitter that saw no spinner and no sleeper queued before this check
+        while (!_b_stop.load() && _n_queued.load() == 0) {
+            _park_cond.wait(lock);
+        }
+        _n_sleeping.fetch_sub(1);
+        if (_b_stop.load() && _n_queued.load() == 0) {
+            return NULL;
+        }
+    }
+}